@@ -19,40 +19,74 @@
 
 using geigergen3::GeigerGen3,
       geigergen3::GeigerGen3NetworkLayer,
+      geigergen3::BootTimeline,
+      geigergen3::ClockProfile,
+      geigergen3::SupplyMonitor,
+      geigergen3::CoreIsolation,
       std::cerr;
 
+#ifndef GG3_SYS_CLOCK_KHZ
+#define GG3_SYS_CLOCK_KHZ 125000
+#endif
+
+#ifndef GG3_IDLE_TIMEOUT_S
+#define GG3_IDLE_TIMEOUT_S 120
+#endif
+
+#ifndef GG3_SUPPLY_GATE
+#define GG3_SUPPLY_GATE 2
+#endif
+
+#ifndef GG3_CORE1_ISOLATION
+#define GG3_CORE1_ISOLATION 0
+#endif
+
 int main(void) {
     const unsigned int  INPUT_PIN      { 31    },
                         VTHRESHOLD     { 2500  },
                         ZERO_THRESHOLD { 100   },
                         MAX_RETRIES    { 3 },
-                        GRACE_TIME     { 10000 };
+                        GRACE_TIME     { 10000 },
+                        READY_TIME     { 250 },
+                        SYS_CLOCK_KHZ  { GG3_SYS_CLOCK_KHZ },
+                        IDLE_TIMEOUT_S { GG3_IDLE_TIMEOUT_S },
+                        SUPPLY_GATE    { GG3_SUPPLY_GATE },
+                        CORE1_ISOLATION{ GG3_CORE1_ISOLATION },
+                        REBOOT_DELAY   { 100 };
+
+    // a warm reset keeps the random number pool, returning from main() would only stop the firmware
+    auto reboot = [](const char* msg){
+        cerr << msg << " Rebooting.\n";
+        watchdog_reboot(0, 0, REBOOT_DELAY);
+        for(;;) tight_loop_contents();
+    };
 
     GeigerGen3* gg3 { GeigerGen3::getInstance(INPUT_PIN, VTHRESHOLD, ZERO_THRESHOLD) };
     gg3->init();
+    if(!ClockProfile::apply(SYS_CLOCK_KHZ, GeigerGen3::loopStats)) cerr << "Warning: clock profile " << SYS_CLOCK_KHZ << " kHz not applied.\n";
+    SupplyMonitor::init(static_cast<SupplyMonitor::Mode>(SUPPLY_GATE));
+    CoreIsolation::request(static_cast<CoreIsolation::Mode>(CORE1_ISOLATION));
     gg3->detect();
 
-    sleep_ms(5000);
+    if(!GeigerGen3::waitReady(READY_TIME)) cerr << "Warning: detection not running yet.\n";
 
     for(;;){
 
-        if(cyw43_arch_init()) {
-            cerr << "Error: WIFI init.\n";
-            return 1;
-        }
+        if(cyw43_arch_init()) reboot("Error: WIFI init.");
+        BootTimeline::mark(BootTimeline::Phase::CYW43);
 
         cyw43_arch_enable_sta_mode();
 
         cerr << "Connecting to Wi-Fi...\n";
-        for(int i{1} ; cyw43_arch_wifi_connect_timeout_ms(WIFI_SSID, WIFI_PASSWORD, CYW43_AUTH_WPA2_MIXED_PSK, GRACE_TIME) != 0 ; i++){
+        for(unsigned int i{1} ; GeigerGen3NetworkLayer::connect(WIFI_SSID, WIFI_PASSWORD, GRACE_TIME) != 0 ; i++){
             cerr << "Connection attempt: " << i << '\n';
             if(i > MAX_RETRIES){
-                cerr << "Error: WIFI connection.\n";
-                return 1;
+                cyw43_arch_deinit();
+                reboot("Error: WIFI connection.");
             }
         } 
         
-        GeigerGen3NetworkLayer geigerGen2NetworkLayer;
+        GeigerGen3NetworkLayer geigerGen2NetworkLayer { 6666, IDLE_TIMEOUT_S };
         int ret = geigerGen2NetworkLayer.service();
         cerr << "Network loop exits with: " << ret << "\n";
     
@@ -18,18 +18,30 @@
 
 #include "pico/stdlib.h"
 #include "pico/multicore.h"
+#include "pico/stdio_usb.h"
 #include "pico/cyw43_arch.h" 
 #include "pico/mutex.h"
 #include "hardware/gpio.h"
 #include "hardware/adc.h"
 #include "hardware/timer.h"
+#include "hardware/irq.h"
+#include "hardware/clocks.h"
+#include "hardware/vreg.h"
+#include "hardware/sync.h"
+#include "hardware/watchdog.h"
+#include "hardware/structs/systick.h"
+#include "hardware/structs/scb.h"
+#include "hardware/structs/vreg_and_chip_reset.h"
 
 #include "lwip/pbuf.h"
 #include "lwip/tcp.h"
+#include "lwip/memp.h"
+#include "lwip/stats.h"
+
+#include <malloc.h>
 
 #include <iostream>
 #include <array>
-#include <deque>
 #include <utility>
 #include <string>
 #include <algorithm>
@@ -42,81 +54,180 @@ namespace geigergen3 {
           std::string,
           std::to_string,
           std::copy_n,
-          std::deque,
           std::numeric_limits;
 
-    class TimeStatistics{
-        private:
-             const uint64_t minute { 60'000'000 };
-             uint64_t       start  { 0 },
-                            stop   { 0 };
-    
+    extern "C" void isr_systick(void)                    noexcept;
+
+    class Timebase{
         public:
-            void      setStartingTime(void)               noexcept; 
-            void      setEndingTime(void)                 noexcept; 
-            uint64_t  getExecutionTime(void)      const   noexcept;
-            bool      isMinuteExpired(void)       const   noexcept;
-
-            static uint64_t getElapsedTime(void)          noexcept;
-            static uint64_t getMSec(uint64_t elapsed)     noexcept;
-            static uint64_t getSec(uint64_t elapsed)      noexcept;
+            static inline constexpr unsigned int        CORES                { 2 };
+            static inline constexpr uint32_t            SYSTICK_MASK         { 0x00FF'FFFF },
+                                                        SYSTICK_BITS         { 24 },
+                                                        // CLKSOURCE = processor clock, TICKINT, ENABLE
+                                                        SYSTICK_CSR          { 0b111 };
+
+            static void      initCore(void)                        noexcept;
+            static void      calibrate(void)                       noexcept;
+            static void      wrap(void)                            noexcept;
+            static void      poll(void)                            noexcept;
+            static uint64_t  now(void)                             noexcept;
+            static uint64_t  toNs(uint64_t ticks)                  noexcept;
+            static uint64_t  toUs(uint64_t ticks)                  noexcept;
+            static uint64_t  fromNs(uint64_t ns)                   noexcept;
+            static uint64_t  fromUs(uint64_t us)                   noexcept;
+            static uint64_t  getMicros(void)                       noexcept;
+            static uint32_t  getHz(void)                           noexcept;
+
+        private:
+            static inline uint32_t                                 hz                   { 125'000'000 };
+            // ticks to ns in Q24 and ticks to us in Q32: a couple of 32x32 multiplies, no division
+            static inline uint64_t                                 nsMulQ24             { 0 },
+                                                                   usMulQ32             { 0 };
+            static inline array<volatile uint32_t, CORES>          wraps                {};
+            static inline array<uint64_t, CORES>                   base                 {},
+                                                                   last                 {};
+
+            static uint64_t  getRaw(unsigned int core)             noexcept;
+            static uint64_t  mulShift(uint64_t ticks, 
+                                      uint64_t mul, 
+                                      unsigned int shift)          noexcept;
     };
 
-    void TimeStatistics::setStartingTime(void) noexcept{
-          start =  to_us_since_boot(get_absolute_time());
+    void Timebase::initCore(void) noexcept{
+        // SysTick is banked per core: each core runs its own counter and its own wrap count
+        systick_hw->csr = 0;
+        systick_hw->rvr = SYSTICK_MASK;
+        systick_hw->cvr = 0;
+        systick_hw->csr = SYSTICK_CSR;
+        calibrate();
     }
 
-    void TimeStatistics::setEndingTime(void) noexcept{
-          stop  =  to_us_since_boot(get_absolute_time());
+    void Timebase::calibrate(void) noexcept{
+        // to be called on each core again after any change of clk_sys
+        hz       = clock_get_hz(clk_sys);
+        nsMulQ24 = ( 1'000'000'000ULL << 24 ) / hz;
+        usMulQ32 = ( 1'000'000ULL << 32 ) / hz;
+
+        // align the epoch to the boot timer, so both cores and the old us timestamps agree
+        unsigned int core { get_core_num() };
+        base[core] = fromUs(time_us_64()) - getRaw(core);
+        last[core] = 0;
     }
 
-    uint64_t TimeStatistics::getExecutionTime(void) const noexcept{
-         return stop - start;
+    void Timebase::wrap(void) noexcept{
+        wraps[get_core_num()]++;
     }
 
-    bool   TimeStatistics::isMinuteExpired(void) const   noexcept{
-        if(TimeStatistics::getElapsedTime() - start >= minute ) return true;
-        return false;
+    void Timebase::poll(void) noexcept{
+        // interrupts masked: the wrap exception stays pending, count it here and drop it. Call at least once per wrap
+        if(scb_hw->icsr & M0PLUS_ICSR_PENDSTSET_BITS){
+            scb_hw->icsr = M0PLUS_ICSR_PENDSTCLR_BITS;
+            wrap();
+        }
+    }
+
+    uint64_t Timebase::getRaw(unsigned int core) noexcept{
+#if GG3_HOST
+        // host simulation (host/sim): no SysTick, the shim clock already counts 64 bit ticks
+        static_cast<void>(core);
+        return gg3HostTicks();
+#else
+        uint32_t hi  { 0 },
+                 cvr { 0 };
+        do{
+            hi  = wraps[core];
+            cvr = systick_hw->cvr;
+        }while(hi != wraps[core]);
+        return ( static_cast<uint64_t>(hi) << SYSTICK_BITS ) | ( SYSTICK_MASK - cvr );
+#endif
+    }
+
+    uint64_t Timebase::now(void) noexcept{
+        unsigned int core  { get_core_num() };
+        uint64_t     ticks { getRaw(core) + base[core] };
+        // the counter wrapped but the exception is still pending (masked irqs): extend it here.
+        // Small steps back are only an irq on this core reading the time in between, not a wrap
+        if(ticks < last[core] && last[core] - ticks > ( SYSTICK_MASK >> 1 )) ticks += 1ULL << SYSTICK_BITS;
+        last[core] = ticks;
+        return ticks;
+    }
+
+    uint64_t Timebase::mulShift(uint64_t ticks, uint64_t mul, unsigned int shift) noexcept{
+        uint64_t hi { ticks >> 32 },
+                 lo { ticks & 0xFFFF'FFFF };
+        return ( ( hi * mul ) << ( 32 - shift ) ) + ( ( lo * mul ) >> shift );
+    }
+
+    uint64_t Timebase::toNs(uint64_t ticks) noexcept{
+        return mulShift(ticks, nsMulQ24, 24);
+    }
+
+    uint64_t Timebase::toUs(uint64_t ticks) noexcept{
+        return mulShift(ticks, usMulQ32, 32);
+    }
+
+    uint64_t Timebase::fromNs(uint64_t ns) noexcept{
+        return ns / 1'000'000'000 * hz + ns % 1'000'000'000 * hz / 1'000'000'000;
+    }
+
+    uint64_t Timebase::fromUs(uint64_t us) noexcept{
+        return us / 1'000'000 * hz + us % 1'000'000 * hz / 1'000'000;
     }
 
-    uint64_t TimeStatistics::getElapsedTime(void) noexcept{
-         return to_us_since_boot(get_absolute_time());
+    uint64_t Timebase::getMicros(void) noexcept{
+        return toUs(now());
     }
 
-    uint64_t TimeStatistics::getMSec(uint64_t elapsed) noexcept{
-          return elapsed / 1'000;
+    uint32_t Timebase::getHz(void) noexcept{
+        return hz;
     }
 
-    uint64_t TimeStatistics::getSec(uint64_t elapsed) noexcept{
-          return elapsed / 1'000'000;
+    extern "C" void isr_systick(void) noexcept{
+        Timebase::wrap();
     }
 
     class DetectionLoopStats{
         private:
-             TimeStatistics   stats;
-
-             uint64_t         max         { 0 },
+             // everything is kept in ticks: the loop pays two counter reads, conversions happen on demand
+             uint64_t         begin       { 0 },
+                              max         { 0 },
                               min         { numeric_limits<uint64_t>::max() },
-                              last        { 0 };
-             const size_t     UNDER_THR   { 3 },
-                              ABOVE_THR   { 2500 };
+                              last        { 0 },
+                              loops       { 0 };
+             uint64_t         underTicks  { 0 },
+                              aboveTicks  { numeric_limits<uint64_t>::max() };
+             size_t           UNDER_THR   { BASE_UNDER_THR },
+                              ABOVE_THR   { BASE_ABOVE_THR };
              size_t           underAll    { 0 },
                               aboveAll    { 0 };
+             // longest loop since the last history roll-up, ticks
+             volatile uint32_t windowMax  { 0 };
                               
 
         public:
+             // ns
+             static inline constexpr size_t   BASE_UNDER_THR  { 3'000 },
+                                              BASE_ABOVE_THR  { 2'500'000 };
+
              void      start(void)          noexcept;
              void      stop(void)           noexcept;
+             void      calibrate(size_t under, 
+                                 size_t above)     noexcept;
 
              uint64_t  getMax(void)   const noexcept;
              uint64_t  getMin(void)   const noexcept;
              uint64_t  getLast(void)  const noexcept;
+             uint64_t  getBegin(void) const noexcept;
              size_t    getUnder(void) const noexcept;
              size_t    getAbove(void) const noexcept;
+             uint64_t  getLoops(void) const noexcept;
+             size_t    getUnderThr(void) const noexcept;
+             size_t    getAboveThr(void) const noexcept;
+             uint64_t  takeWindowMax(void)      noexcept;
     };
 
     void  DetectionLoopStats::start(void)    noexcept{
-        stats.setStartingTime();
+        begin = Timebase::now();
     }
 
     size_t DetectionLoopStats::getUnder(void) const noexcept{
@@ -127,28 +238,59 @@ namespace geigergen3 {
         return aboveAll;
     }
 
+    void  DetectionLoopStats::calibrate(size_t under, size_t above) noexcept{
+        UNDER_THR  = under;
+        ABOVE_THR  = above;
+        underTicks = Timebase::fromNs(under);
+        aboveTicks = Timebase::fromNs(above);
+    }
+
+    uint64_t DetectionLoopStats::getLoops(void) const noexcept{
+        return loops;
+    }
+
+    size_t DetectionLoopStats::getUnderThr(void) const noexcept{
+        return UNDER_THR;
+    }
+
+    size_t DetectionLoopStats::getAboveThr(void) const noexcept{
+        return ABOVE_THR;
+    }
+
     void  DetectionLoopStats::stop(void)     noexcept{
-        stats.setEndingTime();
-        last = stats.getExecutionTime();
-        if(last >= UNDER_THR && last <= ABOVE_THR){
+        loops++;
+        last = Timebase::now() - begin;
+        if(last >= underTicks && last <= aboveTicks){
             if(max < last) max = last;
             if(min > last || min == 0) min = last;
+            if(last > windowMax) windowMax = static_cast<uint32_t>(std::min<uint64_t>(last, numeric_limits<uint32_t>::max()));
         }else{
-            if(last < UNDER_THR ) underAll++;
-            if(last > ABOVE_THR ) aboveAll++;
+            if(last < underTicks ) underAll++;
+            if(last > aboveTicks ) aboveAll++;
         }
     }
 
     uint64_t DetectionLoopStats::getMax(void)  const noexcept{
-         return max;
+         return Timebase::toNs(max);
     }
 
     uint64_t DetectionLoopStats::getMin(void)  const noexcept{
-         return min;
+         return min == numeric_limits<uint64_t>::max() ? 0 : Timebase::toNs(min);
     }
 
     uint64_t DetectionLoopStats::getLast(void) const noexcept{
-         return last;
+         return Timebase::toNs(last);
+    }
+
+    uint64_t DetectionLoopStats::getBegin(void) const noexcept{
+         return begin;
+    }
+
+    uint64_t DetectionLoopStats::takeWindowMax(void) noexcept{
+         // a loop ending right now may be lost from the window, it's a statistic
+         uint32_t ticks { windowMax };
+         windowMax = 0;
+         return Timebase::toNs(ticks);
     }
 
     class Cpm{
@@ -158,7 +300,8 @@ namespace geigergen3 {
                              minutes { 0 };
             unsigned long    sumCpms { 0 };
 
-            TimeStatistics   stats;
+            uint64_t         begin   { 0 },
+                             minute  { 0 };
 
         public:
             void          start(void)                         noexcept;
@@ -168,17 +311,18 @@ namespace geigergen3 {
     };
 
     void  Cpm::start(void) noexcept{
-         stats.setStartingTime();
+         minute = Timebase::fromUs(60'000'000);
+         begin  = Timebase::now();
     }
 
     void  Cpm::update(void) noexcept{
          cpmTmp++;
-         if(stats.isMinuteExpired()){
+         if(uint64_t now { Timebase::now() }; now - begin >= minute){
             sumCpms += cpmTmp;
             cpm      = cpmTmp;
             cpmTmp   = 0;
             minutes++;
-            stats.setStartingTime();
+            begin    = now;
          }
     }
 
@@ -187,20 +331,1417 @@ namespace geigergen3 {
     }
 
     unsigned long Cpm::getAverage(void) const noexcept{
-         return sumCpms / minutes;
+         return minutes > 0 ? sumCpms / minutes : 0;
+    }
+
+    class ClockProfile{
+        public:
+            static inline constexpr uint32_t            BASE_KHZ             { 125'000 },
+                                                        ADC_HZ               { 48'000'000 },
+                                                        HIGH_VREG_KHZ        { 200'000 },
+                                                        PIO_MAX_KHZ          { 62'500 },
+                                                        CALIBRATION_LOOPS    { 20'000 };
+
+            static bool      apply(uint32_t khz, DetectionLoopStats& loopStats)    noexcept;
+            static uint64_t  measureLoop(void)                                      noexcept;
+            static uint32_t  getKhz(void)                                           noexcept;
+            static string    getStats(const DetectionLoopStats& loopStats)          noexcept;
+
+        private:
+            static inline uint32_t      khz         { BASE_KHZ };
+            static inline uint64_t      baseLoopNs  { 0 },
+                                        loopNs      { 0 };
+    };
+
+    uint64_t ClockProfile::measureLoop(void) noexcept{
+        // same work as an idle detection iteration: one conversion and the counter update
+        volatile unsigned int counter { 0 };
+        uint16_t              result  { 0 };
+        uint64_t              begin   { Timebase::now() };
+        for(uint32_t i{0}; i < CALIBRATION_LOOPS; i++){
+            result = std::max(result, adc_read());
+            counter = counter + 1;
+        }
+        return Timebase::toNs(Timebase::now() - begin) / CALIBRATION_LOOPS;
+    }
+
+    bool ClockProfile::apply(uint32_t target, DetectionLoopStats& loopStats) noexcept{
+        baseLoopNs = measureLoop();
+
+        if(target != clock_get_hz(clk_sys) / 1'000){
+            // the regulator has no getter in the SDK: the selection is read back from its register
+            vreg_voltage previous { static_cast<vreg_voltage>(( vreg_and_chip_reset_hw->vreg & VREG_AND_CHIP_RESET_VREG_VSEL_BITS )
+                                                              >> VREG_AND_CHIP_RESET_VREG_VSEL_LSB) };
+            if(target > HIGH_VREG_KHZ){
+                vreg_set_voltage(VREG_VOLTAGE_1_20);
+                sleep_ms(10);
+            }
+            if(!set_sys_clock_khz(target, false)){
+                // the clock didn't move: no reason to keep the core overvolted
+                vreg_set_voltage(previous);
+                cerr << "ClockProfile : Error: " << target << " kHz not reachable\n";
+                return false;
+            }
+#if CYW43_PIO_CLOCK_DIV_DYNAMIC
+            // keep the wireless chip spi within the speed validated at the default clock
+            cyw43_set_pio_clock_divisor(static_cast<uint16_t>(( target + PIO_MAX_KHZ - 1 ) / PIO_MAX_KHZ), 0);
+#endif
+        }
+        khz = clock_get_hz(clk_sys) / 1'000;
+        // tick thresholds follow the new clock even if the profile is rejected below
+        Timebase::calibrate();
+        loopStats.calibrate(loopStats.getUnderThr(), loopStats.getAboveThr());
+
+        // the converter runs from the usb pll, a profile must never move it
+        if(clock_get_hz(clk_adc) != ADC_HZ){
+            cerr << "ClockProfile : Error: adc clock " << clock_get_hz(clk_adc) << " Hz\n";
+            return false;
+        }
+
+        loopNs = measureLoop();
+        if(loopNs == 0 || baseLoopNs == 0) return false;
+
+        loopStats.calibrate(std::max<size_t>(1, DetectionLoopStats::BASE_UNDER_THR * loopNs / baseLoopNs),
+                            std::max<size_t>(1, DetectionLoopStats::BASE_ABOVE_THR * loopNs / baseLoopNs));
+        return true;
+    }
+
+    uint32_t ClockProfile::getKhz(void) noexcept{
+        return khz;
+    }
+
+    string ClockProfile::getStats(const DetectionLoopStats& loopStats) noexcept{
+        uint64_t elapsed { Timebase::getMicros() };
+        return string("clk:").append(to_string(khz))
+                             .append(":").append(to_string(clock_get_hz(clk_adc)))
+                             .append(":").append(to_string(baseLoopNs))
+                             .append(":").append(to_string(loopNs))
+                             .append(":").append(to_string(loopNs > 0 ? baseLoopNs * 1'000 / loopNs : 0))
+                             .append(":").append(to_string(loopStats.getUnderThr()))
+                             .append(":").append(to_string(loopStats.getAboveThr()))
+                             .append(":").append(to_string(elapsed > 0 ? loopStats.getLoops() * 1'000'000 / elapsed : 0))
+                             .append("\n");
+    }
+
+    class BootTimeline{
+        public:
+            enum class Phase : unsigned int { STDIO, ADC, CORE1, FIRST_EVENT, CYW43, ASSOCIATION, DHCP, LISTEN, PHASES };
+
+            static void      mark(Phase phase)                     noexcept;
+            static bool      isMarked(Phase phase)                 noexcept;
+            static uint64_t  getTime(Phase phase)                  noexcept;
+            static string    getStats(void)                        noexcept;
+
+        private:
+            static inline array<volatile uint64_t, static_cast<size_t>(Phase::PHASES)>  timeline  {};
+    };
+
+    void BootTimeline::mark(Phase phase) noexcept{
+        // only the first occurrence is kept: reconnections don't rewrite the boot history
+        if(timeline.at(static_cast<size_t>(phase)) == 0) timeline.at(static_cast<size_t>(phase)) = Timebase::getMicros();
+    }
+
+    bool BootTimeline::isMarked(Phase phase) noexcept{
+        return timeline.at(static_cast<size_t>(phase)) != 0;
+    }
+
+    uint64_t BootTimeline::getTime(Phase phase) noexcept{
+        return timeline.at(static_cast<size_t>(phase));
+    }
+
+    string BootTimeline::getStats(void) noexcept{
+        string ret { "boot" };
+        for(const volatile uint64_t& time : timeline) ret.append(":").append(to_string(time));
+        return ret.append("\n");
+    }
+
+    extern "C" void gg3PcSampleIsr(void)                 noexcept;
+    extern "C" void gg3PcSampleRecord(uint32_t pc)       noexcept;
+
+    class PcSampler{
+        public:
+            static inline constexpr unsigned int        CORES                { 2 },
+                                                        HIST_LEN             { 512 },
+                                                        PROBES               { 8 },
+                                                        DUMP_LEN             { 64 },
+                                                        // per core "pcs:c:samples:dropped\n" and DUMP_LEN "pc:c:address:hits\n", then "pce\n"
+                                                        DUMP_MAX             { CORES * ( 28 + DUMP_LEN * 25 ) + 4 };
+            static inline constexpr uint32_t            DEFAULT_PERIOD       { 1000 };
+
+            static void            init(void)                          noexcept;
+            static void            enableOnCore(void)                  noexcept;
+            static void            start(uint32_t periodUs=DEFAULT_PERIOD) noexcept;
+            static void            stop(void)                          noexcept;
+            static bool            isRunning(void)                     noexcept;
+            static string          dump(void)                          noexcept;
+            static void            record(uint32_t pc)                 noexcept;
+
+        private:
+            struct Slot{
+                uint32_t  pc,
+                          hits;
+            };
+
+            static inline array<array<Slot, HIST_LEN>, CORES>      histogram;
+            // sorted copy for dump(), kept off the stack: it runs in the lwIP callback, on the small core0 stack
+            static inline array<Slot, HIST_LEN>                    sorted;
+            static inline array<uint32_t, CORES>                   samples;
+            static inline array<uint32_t, CORES>                   dropped;
+            static inline array<unsigned int, CORES>               alarms;
+            static inline volatile bool                            running              { false };
+            static inline volatile uint32_t                        period               { DEFAULT_PERIOD };
+
+            static void            arm(void)                           noexcept;
+    };
+
+    void PcSampler::init(void) noexcept{
+        for(unsigned int core{0}; core < CORES; core++){
+            alarms.at(core) = static_cast<unsigned int>(hardware_alarm_claim_unused(true));
+            // the vector table is shared, each core only unmasks the line of its own alarm
+            irq_set_exclusive_handler(TIMER_IRQ_0 + alarms.at(core), gg3PcSampleIsr);
+            hw_set_bits(&timer_hw->inte, 1u << alarms.at(core));
+        }
+    }
+
+    void PcSampler::enableOnCore(void) noexcept{
+        irq_set_enabled(TIMER_IRQ_0 + alarms.at(get_core_num()), true);
+    }
+
+    void PcSampler::start(uint32_t periodUs) noexcept{
+        stop();
+        for(unsigned int core{0}; core < CORES; core++){
+            histogram.at(core).fill({0, 0});
+            samples.at(core) = 0;
+            dropped.at(core) = 0;
+        }
+        period  = periodUs;
+        arm();
+    }
+
+    void PcSampler::arm(void) noexcept{
+        running = true;
+        for(unsigned int core{0}; core < CORES; core++)
+            timer_hw->alarm[alarms.at(core)] = timer_hw->timerawl + period + core * ( period / 2 );
+    }
+
+    void PcSampler::stop(void) noexcept{
+        running = false;
+        for(unsigned int core{0}; core < CORES; core++){
+            timer_hw->armed = 1u << alarms.at(core);
+            hw_clear_bits(&timer_hw->intr, 1u << alarms.at(core));
+        }
+    }
+
+    bool PcSampler::isRunning(void) noexcept{
+        return running;
+    }
+
+    void PcSampler::record(uint32_t pc) noexcept{
+        unsigned int core  { get_core_num() },
+                     alarm { alarms[core] };
+        hw_clear_bits(&timer_hw->intr, 1u << alarm);
+        if(!running) return;
+        timer_hw->alarm[alarm] = timer_hw->timerawl + period;
+
+        samples[core]++;
+        array<Slot, HIST_LEN>& hist { histogram[core] };
+        for(unsigned int probe{0}, idx{ ( pc >> 1 ) % HIST_LEN }; probe < PROBES; probe++, idx = ( idx + 1 ) % HIST_LEN){
+            if(hist[idx].pc == pc){ hist[idx].hits++; return; }
+            if(hist[idx].hits == 0){ hist[idx] = { pc, 1 }; return; }
+        }
+        dropped[core]++;
+    }
+
+    string PcSampler::dump(void) noexcept{
+        // sampling pauses while the histograms are copied, then goes on where it was
+        bool   resume { running };
+        stop();
+        string ret;
+        for(unsigned int core{0}; core < CORES; core++){
+            ret.append("pcs:").append(to_string(core)).append(":").append(to_string(samples.at(core)))
+               .append(":").append(to_string(dropped.at(core))).append("\n");
+
+            sorted = histogram.at(core);
+            std::partial_sort(sorted.begin(), sorted.begin() + DUMP_LEN, sorted.end(),
+                              [](const Slot& lhs, const Slot& rhs){ return lhs.hits > rhs.hits; });
+            for(unsigned int i{0}; i < DUMP_LEN && sorted.at(i).hits > 0; i++){
+                char addr[9] {};
+                snprintf(addr, sizeof(addr), "%08lx", static_cast<unsigned long>(sorted.at(i).pc));
+                ret.append("pc:").append(to_string(core)).append(":").append(addr)
+                   .append(":").append(to_string(sorted.at(i).hits)).append("\n");
+            }
+        }
+        if(resume) arm();
+        return ret.append("pce\n");
+    }
+
+#if GG3_HOST
+    // host simulation: alarms never fire, there is no exception frame to read
+    extern "C" void gg3PcSampleIsr(void) noexcept{
+    }
+#else
+    // the exception frame is on the main stack: r0-r3, r12, lr, pc, xpsr
+    extern "C" void __attribute__((naked)) gg3PcSampleIsr(void) noexcept{
+        __asm volatile(
+            "mrs  r0, msp                \n"
+            "ldr  r0, [r0, #24]          \n"
+            "ldr  r1, =gg3PcSampleRecord \n"
+            "bx   r1                     \n"
+        );
+    }
+#endif
+
+    extern "C" void gg3PcSampleRecord(uint32_t pc) noexcept{
+        PcSampler::record(pc);
+    }
+
+    // Timing determinism for core1. Isolated, core1 leaves every interrupt line to core0 (its own NVIC has none
+    // enabled, so the profiler sees core0 only), runs the loop with interrupts masked, counts the SysTick wraps
+    // by polling and waits by counting cycles instead of on the timer. The period between two consecutive plain
+    // samples is histogrammed in either mode: log2 bins of the excess over the shortest period seen.
+    class CoreIsolation{
+        public:
+            enum class Mode : unsigned int { SHARED=0, ISOLATED=1 };
+
+            static inline constexpr unsigned int        MODES                { 2 },
+                                                        BINS                 { 16 },
+                                                        IRQ_LINES            { 32 };
+
+            static void            request(Mode target)                     noexcept;
+            static Mode            getRequested(void)                       noexcept;
+            static bool            apply(void)                              noexcept;
+            static void            tick(uint64_t begin, bool steady)        noexcept;
+            static void            wait(uint32_t us)                        noexcept;
+            static string          dump(void)                               noexcept;
+            static string          getStats(void)                           noexcept;
+
+        private:
+            // core0 asks, core1 switches at the top of its loop
+            static inline volatile Mode                            requested            { Mode::SHARED };
+            static inline Mode                                     mode                 { Mode::SHARED };
+            static inline uint32_t                                 saved                { 0 },
+                                                                   lines                { 0 };
+            static inline volatile uint32_t                        switches             { 0 };
+            // ticks; the first periods are binned against a shortest one still settling
+            static inline uint64_t                                 previous             { 0 },
+                                                                   shortest             { numeric_limits<uint64_t>::max() };
+            static inline array<uint64_t, MODES>                   samples              {},
+                                                                   longest              {};
+            static inline array<array<uint32_t, BINS>, MODES>      bins                 {};
+    };
+
+    void CoreIsolation::request(Mode target) noexcept{
+        requested = target;
+    }
+
+    CoreIsolation::Mode CoreIsolation::getRequested(void) noexcept{
+        return requested;
+    }
+
+    bool CoreIsolation::apply(void) noexcept{
+        if(requested == mode) return false;
+        mode = requested;
+        if(mode == Mode::ISOLATED){
+            saved = save_and_disable_interrupts();
+            // a line left enabled would still be taken on the way back: none stays on core1, the ones
+            // it had are given back when shared again
+            lines = 0;
+            for(uint num{0}; num < IRQ_LINES; num++) if(irq_is_enabled(num)) lines |= 1U << num;
+            irq_set_mask_enabled(0xFFFF'FFFF, false);
+        }else{
+            // a wrap still pending is taken by the exception as soon as interrupts are back; the
+            // profiler may have been started while isolated
+            irq_set_mask_enabled(lines, true);
+            PcSampler::enableOnCore();
+            restore_interrupts(saved);
+        }
+        switches = switches + 1;
+        return true;
+    }
+
+    void CoreIsolation::tick(uint64_t begin, bool steady) noexcept{
+        if(mode == Mode::ISOLATED) Timebase::poll();
+        uint64_t period { begin - previous };
+        previous = begin;
+        if(!steady) return;
+
+        unsigned int idx { static_cast<unsigned int>(mode) };
+        if(period < shortest) shortest = period;
+        uint64_t excess { period - shortest };
+        // bin 0: the shortest period, bin n: up to 2^n - 1 ticks over it, the last one is open
+        unsigned int bin { excess == 0 ? 0 : std::min<unsigned int>(BINS - 1, 64 - static_cast<unsigned int>(__builtin_clzll(excess))) };
+        bins[idx][bin]++;
+        samples[idx]++;
+        if(period > longest[idx]) longest[idx] = period;
+    }
+
+    void CoreIsolation::wait(uint32_t us) noexcept{
+        if(mode == Mode::SHARED){
+            sleep_us(us);
+            return;
+        }
+        Timebase::poll();
+        busy_wait_at_least_cycles(static_cast<uint32_t>(Timebase::fromUs(us)));
+    }
+
+    string CoreIsolation::dump(void) noexcept{
+        // read from core0 while core1 counts: a line may mix two consecutive samples
+        string ret;
+        for(unsigned int idx{0}; idx < MODES; idx++){
+            ret.append("jit:").append(to_string(idx)).append(":").append(to_string(samples.at(idx)))
+               .append(":").append(to_string(shortest == numeric_limits<uint64_t>::max() ? 0 : Timebase::toNs(shortest)))
+               .append(":").append(to_string(Timebase::toNs(longest.at(idx))));
+            for(uint32_t count : bins.at(idx)) ret.append(":").append(to_string(count));
+            ret.append("\n");
+        }
+        return ret.append("jie\n");
     }
 
-    using  rng=unsigned char;
+    string CoreIsolation::getStats(void) noexcept{
+        return string(":iso:").append(to_string(static_cast<unsigned int>(requested)))
+                              .append(":").append(to_string(switches));
+    }
+
+    // wide enough for INVALID_RESULT, the empty pool marker
+    using  rng=unsigned short;
     using  registry=unsigned int;
     static_assert(  numeric_limits<rng>::max() <  numeric_limits<registry>::max() ); 
     using  Rng=std::pair<rng, registry>;
 
+    using JobFunc=void(*)(void*);
+
+    struct Job{
+        JobFunc   func;
+        void      *arg;
+        uint32_t  costUs;
+        bool      pinned;
+        uint64_t  queued;
+    };
+
+    class JobQueue{
+        public:
+            static inline constexpr size_t              LEN                  { 16 };
+
+            void      init(void)                                           noexcept;
+            bool      push(const Job& job)                                 noexcept;
+            bool      pop(Job& job, uint32_t budgetUs, bool steal,
+                          uint64_t stealBefore)                            noexcept;
+            size_t    size(void)                                   const   noexcept;
+
+        private:
+            // the M0+ has no compare and swap: one SIO hardware spinlock guards both ends
+            spin_lock_t                                            *lock                { nullptr };
+            array<Job, LEN>                                        ring;
+            size_t                                                 head                 { 0 },
+                                                                   count                { 0 };
+    };
+
+    void JobQueue::init(void) noexcept{
+        lock = spin_lock_instance(static_cast<uint>(spin_lock_claim_unused(true)));
+    }
+
+    bool JobQueue::push(const Job& job) noexcept{
+        uint32_t save { spin_lock_blocking(lock) };
+        bool     ret  { count < LEN };
+        if(ret){
+            ring[( head + count ) % LEN] = job;
+            count++;
+        }
+        spin_unlock(lock, save);
+        return ret;
+    }
+
+    bool JobQueue::pop(Job& job, uint32_t budgetUs, bool steal, uint64_t stealBefore) noexcept{
+        uint32_t save { spin_lock_blocking(lock) };
+        bool     ret  { false };
+        if(count > 0){
+            // the owner takes the oldest job, a thief the newest one
+            size_t idx { steal ? ( head + count - 1 ) % LEN : head };
+            if(ring[idx].costUs <= budgetUs && !( steal && ( ring[idx].pinned || ring[idx].queued > stealBefore ) )){
+                job = ring[idx];
+                if(!steal) head = ( head + 1 ) % LEN;
+                count--;
+                ret = true;
+            }
+        }
+        spin_unlock(lock, save);
+        return ret;
+    }
+
+    size_t JobQueue::size(void) const noexcept{
+        return count;
+    }
+
+    class Scheduler{
+        public:
+            static inline constexpr unsigned int        CORES                { 2 };
+            static inline constexpr uint32_t            CORE1_SLOT_US        { 10 },
+                                                        // a job is left to its own core this long before the other one may take it
+                                                        STEAL_AFTER_US       { 5'000 };
+
+            static void            init(void)                                               noexcept;
+            static bool            submit(unsigned int core, JobFunc func, void* arg,
+                                          uint32_t costUs, bool pinned=false)               noexcept;
+            static bool            runOne(uint32_t budgetUs)                                noexcept;
+            static void            runFor(uint32_t periodUs)                                noexcept;
+            static string          getStats(void)                                           noexcept;
+
+        private:
+            static inline array<JobQueue, CORES>                   queues;
+            static inline array<volatile uint32_t, CORES>          runs                 {},
+                                                                   steals               {},
+                                                                   maxUs                {};
+            static inline volatile uint32_t                        rejected             { 0 };
+    };
+
+    void Scheduler::init(void) noexcept{
+        for(JobQueue& queue : queues) queue.init();
+    }
+
+    bool Scheduler::submit(unsigned int core, JobFunc func, void* arg, uint32_t costUs, bool pinned) noexcept{
+        if(queues.at(core).push({ func, arg, costUs, pinned, Timebase::getMicros() })) return true;
+        rejected = rejected + 1;
+        return false;
+    }
+
+    bool Scheduler::runOne(uint32_t budgetUs) noexcept{
+        unsigned int core  { get_core_num() };
+        Job          job   {};
+        bool         stole { false };
+        if(!queues[core].pop(job, budgetUs, false, 0)){
+            uint64_t now { Timebase::getMicros() };
+            if(now < STEAL_AFTER_US || !queues[core ^ 1].pop(job, budgetUs, true, now - STEAL_AFTER_US)) return false;
+            stole = true;
+        }
+
+        uint64_t begin { Timebase::getMicros() };
+        job.func(job.arg);
+        uint32_t took  { static_cast<uint32_t>(Timebase::getMicros() - begin) };
+
+        runs[core] = runs[core] + 1;
+        if(stole) steals[core] = steals[core] + 1;
+        if(took > maxUs[core]) maxUs[core] = took;
+        return true;
+    }
+
+    void Scheduler::runFor(uint32_t periodUs) noexcept{
+        uint64_t deadline { Timebase::getMicros() + periodUs };
+        for(uint64_t now { Timebase::getMicros() }; now < deadline; now = Timebase::getMicros()){
+            if(!runOne(static_cast<uint32_t>(deadline - now))){
+                sleep_us(deadline - now);
+                break;
+            }
+        }
+    }
+
+    string Scheduler::getStats(void) noexcept{
+        string ret { ":sched" };
+        for(unsigned int core{0}; core < CORES; core++)
+            ret.append(":").append(to_string(runs[core]))
+               .append(":").append(to_string(steals[core]))
+               .append(":").append(to_string(maxUs[core]))
+               .append(":").append(to_string(queues[core].size()));
+        return ret.append(":").append(to_string(rejected));
+    }
+
+    struct RawEvent{
+        uint64_t  time;
+        registry  roulette;
+        uint8_t   frac;
+    };
+
+    class RawCapture{
+        public:
+            static inline constexpr size_t              LEN                  { 512 },
+                                                        DRAIN_LEN            { 64 };
+
+            static void            push(uint64_t time, registry roulette,
+                                        uint8_t frac)                      noexcept;
+            static string          drain(void)                             noexcept;
+
+        private:
+            // single producer (core1), single consumer (core0): indexes are only written by their owner
+            static inline array<RawEvent, LEN>                     ring;
+            static inline volatile size_t                          head                 { 0 },
+                                                                   tail                 { 0 };
+            static inline volatile uint32_t                        lost                 { 0 };
+    };
+
+    void RawCapture::push(uint64_t time, registry roulette, uint8_t frac) noexcept{
+        size_t next { ( head + 1 ) % LEN };
+        if(next == tail){
+            lost = lost + 1;
+            return;
+        }
+        ring[head] = { time, roulette, frac };
+        __dmb();
+        head = next;
+    }
+
+    string RawCapture::drain(void) noexcept{
+        string  lines;
+        size_t  count { 0 };
+        while(tail != head && count < DRAIN_LEN){
+            const RawEvent& event { ring[tail] };
+            lines.append(to_string(event.time)).append(":").append(to_string(event.roulette))
+                 .append(":").append(to_string(event.frac)).append("\n");
+            __dmb();
+            tail = ( tail + 1 ) % LEN;
+            count++;
+        }
+        return string("raw:").append(to_string(count)).append(":").append(to_string(lost)).append("\n").append(lines);
+    }
+
+    // arrival time below one loop period: the rising edge is interpolated against the threshold between the last
+    // sample under it and the first one above. The fraction extends the register only while its health tests pass
+    class SubsampleTiming{
+        public:
+            static inline constexpr unsigned int        FRAC_BITS            { 4 },
+                                                        BINS                 { 1U << FRAC_BITS },
+                                                        // no estimate: the previous sample isn't the adjacent one
+                                                        NONE                 { BINS };
+            static inline constexpr uint32_t            WINDOW               { 4'096 },
+                                                        // chi-square, 15 degrees of freedom, p = 1e-4, x100
+                                                        CHI2_LIMIT           { 4'430 },
+                                                        CHECK_COST_US        { Scheduler::CORE1_SLOT_US };
+
+            static uint32_t  interpolate(uint32_t prev, uint32_t cur, uint32_t thr)   noexcept;
+            static void      record(uint32_t frac)                                  noexcept;
+            static bool      isEnabled(void)                                        noexcept;
+            static bool      schedule(void)                                         noexcept;
+            static void      check(void *arg)                                       noexcept;
+            static string    getStats(void)                                         noexcept;
+
+        private:
+            // fractions and pairs of consecutive fractions (top 2 bits each), counted by core1 in the active window
+            struct Window{
+                array<uint32_t, BINS>                              bins;
+                array<uint32_t, BINS>                              pairs;
+                uint32_t                                           events;
+            };
+
+            static inline array<Window, 2>                         windows              {};
+            static inline volatile unsigned int                    active               { 0 };
+            static inline volatile bool                            full                 { false },
+                                                                   enabled              { false };
+            static inline bool                                     pending              { false };
+            static inline uint32_t                                 lastFrac             { 0 },
+                                                                   passed               { 0 },
+                                                                   failed               { 0 },
+                                                                   uniformChi2          { 0 },
+                                                                   serialChi2           { 0 };
+
+            static uint32_t  chi2(const array<uint32_t, BINS>& counts, uint32_t total)  noexcept;
+    };
+
+    uint32_t SubsampleTiming::interpolate(uint32_t prev, uint32_t cur, uint32_t thr) noexcept{
+        // prev <= thr < cur: the crossing is this far into the period, in 1/BINS steps
+        return ( ( thr - prev ) << FRAC_BITS ) / ( cur - prev );
+    }
+
+    void SubsampleTiming::record(uint32_t frac) noexcept{
+        Window& window { windows[active] };
+        window.bins[frac]++;
+        window.pairs[( ( lastFrac >> ( FRAC_BITS - 2 ) ) << 2 ) | ( frac >> ( FRAC_BITS - 2 ) )]++;
+        lastFrac = frac;
+        // the full window goes to core0, counting continues in the other one once it's cleared
+        if(++window.events >= WINDOW && !full){
+            __dmb();
+            active = active ^ 1;
+            full   = true;
+        }
+    }
+
+    bool SubsampleTiming::isEnabled(void) noexcept{
+        return enabled;
+    }
+
+    bool SubsampleTiming::schedule(void) noexcept{
+        // queued where the window is filled: core1 runs it in a pulse tail, core0 steals it if no pulse comes
+        if(!pending && full) pending = Scheduler::submit(1, check, nullptr, CHECK_COST_US);
+        return pending;
+    }
+
+    uint32_t SubsampleTiming::chi2(const array<uint32_t, BINS>& counts, uint32_t total) noexcept{
+        // within a full window |count * BINS - total| is under 2^16: single cycle 32 bit squares. A window
+        // left counting past WINDOW while the previous check is late takes the long multiply
+        uint64_t sum { 0 };
+        for(uint32_t count : counts){
+            uint32_t scaled { count * BINS },
+                     diff   { scaled > total ? scaled - total : total - scaled };
+            sum += diff < ( 1U << 16 ) ? diff * diff : static_cast<uint64_t>(diff) * diff;
+        }
+        return static_cast<uint32_t>(sum * 100 / ( static_cast<uint64_t>(total) * BINS ));
+    }
+
+    void SubsampleTiming::check(void *arg) noexcept{
+        static_cast<void>(arg);
+        Window& window { windows[active ^ 1] };
+        uniformChi2 = chi2(window.bins,  window.events);
+        serialChi2  = chi2(window.pairs, window.events);
+        // both uniform and without serial correlation, or the register goes back to whole periods
+        enabled     = uniformChi2 < CHI2_LIMIT && serialChi2 < CHI2_LIMIT;
+        enabled ? passed++ : failed++;
+
+        window = {};
+        __dmb();
+        full    = false;
+        pending = false;
+    }
+
+    string SubsampleTiming::getStats(void) noexcept{
+        return string(":frac:").append(to_string(enabled ? 1 : 0))
+                               .append(":").append(to_string(passed))
+                               .append(":").append(to_string(failed))
+                               .append(":").append(to_string(uniformChi2))
+                               .append(":").append(to_string(serialChi2));
+    }
+
+    // Bits taken per event follow the physics: the counter advances once per loop, so at a pulse it's spread over
+    // the interval since the previous one, in loops (16 times finer with the subsample fraction). Modulo 2^k an
+    // exponential interval of mean N loops leaves about k - log2(1 + 2^k / 2N) bits of min-entropy: keeping 2^k
+    // within N / 2^MARGIN_BITS bounds the loss under 1%. The fraction is credited a bit less than it holds, it's
+    // tested uniform, not proven. The target is lowered at once, raised one bit per RAISE_EVENTS pulses above it.
+    class AdaptiveExtraction{
+        public:
+            static inline constexpr unsigned int        MIN_BITS             { 1 },
+                                                        MAX_BITS             { 16 },
+                                                        MAX_OUT              { ( MAX_BITS + 7 ) / 8 },
+                                                        MARGIN_BITS          { 6 },
+                                                        FRAC_CREDIT          { SubsampleTiming::FRAC_BITS - 1 },
+                                                        MEAN_SHIFT           { 4 },
+                                                        WARMUP_EVENTS        { 1U << MEAN_SHIFT },
+                                                        RAISE_EVENTS         { 16 };
+
+            static void            observe(registry counter, uint64_t ticks)                 noexcept;
+            static unsigned int    pack(registry reg, array<uint8_t, MAX_OUT>& out)         noexcept;
+            static unsigned int    getBits(void)                                             noexcept;
+            static bool            setLimit(unsigned int bits)                               noexcept;
+            static unsigned int    getLimit(void)                                            noexcept;
+            static string          getStats(void)                                            noexcept;
+
+        private:
+            // core1 only, but for the limit set from core0; means are kept scaled by 2^MEAN_SHIFT
+            static inline volatile unsigned int                    bits                 { MIN_BITS },
+                                                                   limit                { MAX_BITS };
+            static inline unsigned int                             above                { 0 },
+                                                                   pending              { 0 };
+            static inline uint32_t                                 acc                  { 0 },
+                                                                   changes              { 0 };
+            static inline registry                                 lastCounter          { 0 };
+            static inline uint64_t                                 lastTicks            { 0 },
+                                                                   intervals            { 0 },
+                                                                   loopsQ               { 0 },
+                                                                   ticksQ               { 0 };
+    };
+    // the accumulator holds less than a byte between events
+    static_assert( AdaptiveExtraction::MAX_BITS + 7 <= 32 && AdaptiveExtraction::MAX_BITS <= numeric_limits<registry>::digits );
+    static_assert( AdaptiveExtraction::MIN_BITS <= AdaptiveExtraction::MAX_BITS );
+
+    void AdaptiveExtraction::observe(registry counter, uint64_t ticks) noexcept{
+        registry loops { static_cast<registry>(counter - lastCounter) };
+        uint64_t span  { ticks - lastTicks };
+        bool     first { lastTicks == 0 };
+        lastCounter = counter;
+        lastTicks   = ticks;
+        if(first) return;
+
+        // a plain sum over the warm up, exactly the scaled mean the average then keeps
+        intervals++;
+        loopsQ = ( intervals > WARMUP_EVENTS ? loopsQ - ( loopsQ >> MEAN_SHIFT ) : loopsQ ) + loops;
+        ticksQ = ( intervals > WARMUP_EVENTS ? ticksQ - ( ticksQ >> MEAN_SHIFT ) : ticksQ ) + span;
+        if(intervals < WARMUP_EVENTS) return;
+
+        uint64_t     spread    { loopsQ >> MEAN_SHIFT };
+        unsigned int available { spread == 0 ? 0 : 63 - static_cast<unsigned int>(__builtin_clzll(spread)) };
+        if(SubsampleTiming::isEnabled()) available += FRAC_CREDIT;
+        unsigned int target    { std::clamp(available > MARGIN_BITS ? available - MARGIN_BITS : 0, MIN_BITS, static_cast<unsigned int>(limit)) },
+                     current   { bits };
+        if(intervals == WARMUP_EVENTS || target < current){
+            above = 0;
+            if(target != current){ bits = target; changes++; }
+        }else if(target > current){
+            if(++above >= RAISE_EVENTS){ above = 0; bits = current + 1; changes++; }
+        }else{
+            above = 0;
+        }
+    }
+
+    unsigned int AdaptiveExtraction::pack(registry reg, array<uint8_t, MAX_OUT>& out) noexcept{
+        unsigned int take  { std::min(static_cast<unsigned int>(bits), static_cast<unsigned int>(limit)) },
+                     count { 0 };
+        acc     |= ( reg & ( ( 1U << take ) - 1 ) ) << pending;
+        pending += take;
+        for(; pending >= 8; pending -= 8, acc >>= 8) out[count++] = static_cast<uint8_t>(acc & 0xFF);
+        return count;
+    }
+
+    unsigned int AdaptiveExtraction::getBits(void) noexcept{
+        return std::min(static_cast<unsigned int>(bits), static_cast<unsigned int>(limit));
+    }
+
+    bool AdaptiveExtraction::setLimit(unsigned int maxBits) noexcept{
+        if(maxBits < MIN_BITS || maxBits > MAX_BITS) return false;
+        limit = maxBits;
+        return true;
+    }
+
+    unsigned int AdaptiveExtraction::getLimit(void) noexcept{
+        return limit;
+    }
+
+    string AdaptiveExtraction::getStats(void) noexcept{
+        // read from core0 while core1 updates: a statistic
+        uint64_t loops { intervals < WARMUP_EVENTS ? 0 : loopsQ >> MEAN_SHIFT },
+                 ticks { intervals < WARMUP_EVENTS ? 0 : ticksQ >> MEAN_SHIFT };
+        return string(":bits:").append(to_string(getBits()))
+                               .append(":").append(to_string(limit))
+                               .append(":").append(to_string(loops))
+                               .append(":").append(to_string(Timebase::toUs(ticks)))
+                               .append(":").append(to_string(ticks > 0 ? loops * Timebase::getHz() / ticks : 0))
+                               .append(":").append(to_string(changes));
+    }
+
+    class SupplyMonitor{
+        public:
+            enum class Mode : unsigned int { OFF=0, FLAG=1, REJECT=2 };
+
+            static inline constexpr unsigned int        VSYS_PIN             { 29 },
+                                                        VSYS_INPUT           { 3 },
+                                                        DETECT_INPUT         { 0 },
+                                                        SAMPLES              { 16 },
+                                                        SETTLE               { 4 };
+            // VSYS is divided by 3 on the board, the converter is 12 bits over 3.3V
+            static inline constexpr uint32_t            FULL_SCALE_MV        { 3 * 3'300 },
+                                                        NOISE_P2P_MV         { 60 },
+                                                        STEP_MV              { 150 },
+                                                        PERIOD_US            { 10'000 },
+                                                        PARK_TIMEOUT_US      { 1'000 },
+                                                        SAMPLE_COST_US       { 100 };
+
+            static void            init(Mode gating)                        noexcept;
+            static bool            schedule(void)                           noexcept;
+            static void            sample(void *arg)                        noexcept;
+            static bool            isRequested(void)                        noexcept;
+            static void            park(void)                               noexcept;
+            static bool            accept(void)                             noexcept;
+            static Mode            getMode(void)                            noexcept;
+            static string          getStats(void)                           noexcept;
+
+        private:
+            static inline Mode                                     mode                 { Mode::OFF };
+            // core0 asks, core1 stops converting until released: the converter input mux is shared
+            static inline volatile bool                            request              { false },
+                                                                   parked               { false },
+                                                                   disturbed            { false };
+            static inline bool                                     pending              { false };
+            static inline uint64_t                                 last                 { 0 };
+            static inline uint32_t                                 mv                   { 0 },
+                                                                   p2p                  { 0 },
+                                                                   maxP2p               { 0 },
+                                                                   baseline             { 0 },
+                                                                   disturbances         { 0 },
+                                                                   missed               { 0 };
+            static inline volatile uint32_t                        gated                { 0 };
+
+            static uint32_t        toMv(uint32_t raw)                       noexcept;
+    };
+
+    void SupplyMonitor::init(Mode gating) noexcept{
+        mode = gating;
+    }
+
+    uint32_t SupplyMonitor::toMv(uint32_t raw) noexcept{
+        return raw * FULL_SCALE_MV / 4'096;
+    }
+
+    bool SupplyMonitor::schedule(void) noexcept{
+        if(mode == Mode::OFF) return false;
+        // the wireless chip lock is a core0 one: never let core1 steal the job
+        if(!pending && Timebase::getMicros() - last >= PERIOD_US) pending = Scheduler::submit(0, sample, nullptr, SAMPLE_COST_US, true);
+        return pending;
+    }
+
+    void SupplyMonitor::sample(void *arg) noexcept{
+        static_cast<void>(arg);
+        pending = false;
+        last    = Timebase::getMicros();
+
+        // on the Pico W the VSYS pin is also the wireless SPI clock: own the chip while using it
+        cyw43_thread_enter();
+        cyw43_arch_gpio_get(CYW43_WL_GPIO_VBUS_PIN);
+
+        request = true;
+        for(uint64_t deadline { last + PARK_TIMEOUT_US }; !parked; tight_loop_contents()){
+            if(Timebase::getMicros() >= deadline){
+                request = false;
+                cyw43_thread_exit();
+                missed++;
+                return;
+            }
+        }
+
+        adc_gpio_init(VSYS_PIN);
+        adc_select_input(VSYS_INPUT);
+        // the first conversions after switching input read low
+        for(unsigned int i{0}; i < SETTLE; i++) adc_read();
+        uint32_t sum  { 0 },
+                 low  { numeric_limits<uint32_t>::max() },
+                 high { 0 };
+        for(unsigned int i{0}; i < SAMPLES; i++){
+            uint32_t raw { adc_read() };
+            sum += raw;
+            low  = std::min(low, raw);
+            high = std::max(high, raw);
+        }
+        adc_select_input(DETECT_INPUT);
+        request = false;
+        cyw43_thread_exit();
+
+        mv     = toMv(sum / SAMPLES);
+        p2p    = toMv(high - low);
+        maxP2p = std::max(maxP2p, p2p);
+        if(baseline == 0) baseline = mv;
+
+        uint32_t step  { mv > baseline ? mv - baseline : baseline - mv };
+        bool     noisy { p2p > NOISE_P2P_MV || step > STEP_MV };
+        if(noisy && !disturbed) disturbances++;
+        // the gate stays closed until a clean burst, the baseline only follows a quiet supply
+        disturbed = noisy;
+        if(!noisy) baseline = baseline + ( static_cast<int32_t>(mv) - static_cast<int32_t>(baseline) ) / 8;
+    }
+
+    bool SupplyMonitor::isRequested(void) noexcept{
+        return request;
+    }
+
+    void SupplyMonitor::park(void) noexcept{
+        parked = true;
+        while(request) tight_loop_contents();
+        parked = false;
+    }
+
+    bool SupplyMonitor::accept(void) noexcept{
+        if(!disturbed) return true;
+        gated = gated + 1;
+        return mode != Mode::REJECT;
+    }
+
+    SupplyMonitor::Mode SupplyMonitor::getMode(void) noexcept{
+        return mode;
+    }
+
+    string SupplyMonitor::getStats(void) noexcept{
+        return string(":supply:").append(to_string(mv))
+                                 .append(":").append(to_string(p2p))
+                                 .append(":").append(to_string(maxP2p))
+                                 .append(":").append(to_string(disturbances))
+                                 .append(":").append(to_string(gated))
+                                 .append(":").append(to_string(missed))
+                                 .append(":").append(to_string(static_cast<unsigned int>(mode)));
+    }
+
+    // linker symbols: heap after .bss up to the stack limit, core0 stack in SCRATCH_Y, core1 stack in SCRATCH_X
+    extern "C" uint32_t __end__, __StackLimit, __StackBottom, __StackTop, __StackOneBottom, __StackOneTop;
+
+    class MemoryStats{
+        public:
+            static inline constexpr unsigned int        CORES                { 2 };
+            static inline constexpr uint32_t            PAINT                { 0xC0DEFACE };
+            // below the stack pointer of the painting function: its frame and the calls it makes
+            static inline constexpr size_t              PAINT_GUARD          { 256 };
+
+            static void      paintCore0(void)                      noexcept;
+            static void      paintCore1(void)                      noexcept;
+            static void      sample(void)                          noexcept;
+            static size_t    getStackUsed(unsigned int core)       noexcept;
+            static size_t    getStackSize(unsigned int core)       noexcept;
+            static string    getStats(size_t queueLen, size_t queueMax, size_t queueCap) noexcept;
+
+        private:
+            static inline size_t                                   heapPeak             { 0 },
+                                                                   arenaPeak            { 0 };
+
+            static void      paint(uint32_t* bottom, uint32_t* top)                        noexcept;
+            static string    getPoolStats(const char* name, int pool)                      noexcept;
+    };
+
+    void MemoryStats::paint(uint32_t* bottom, uint32_t* top) noexcept{
+        for(volatile uint32_t* word { bottom }; word < top; word++) *word = PAINT;
+    }
+
+    void MemoryStats::paintCore0(void) noexcept{
+#if !GG3_HOST
+        // main() is running on this stack: only the part below the current frame is free
+        uint32_t  here  { 0 };
+        uint32_t  *top  { reinterpret_cast<uint32_t*>(reinterpret_cast<uintptr_t>(&here) - PAINT_GUARD) };
+        paint(&__StackBottom, top);
+#endif
+    }
+
+    void MemoryStats::paintCore1(void) noexcept{
+#if !GG3_HOST
+        // before the launch: the whole stack is free
+        paint(&__StackOneBottom, &__StackOneTop);
+#endif
+    }
+
+    size_t MemoryStats::getStackSize(unsigned int core) noexcept{
+#if GG3_HOST
+        static_cast<void>(core);
+        return 0;
+#else
+        return core == 0 ? reinterpret_cast<uintptr_t>(&__StackTop)    - reinterpret_cast<uintptr_t>(&__StackBottom)
+                         : reinterpret_cast<uintptr_t>(&__StackOneTop) - reinterpret_cast<uintptr_t>(&__StackOneBottom);
+#endif
+    }
+
+    size_t MemoryStats::getStackUsed(unsigned int core) noexcept{
+#if GG3_HOST
+        static_cast<void>(core);
+        return 0;
+#else
+        // the stacks grow down: the first overwritten word from the bottom is the high-water mark
+        const uint32_t *bottom { core == 0 ? &__StackBottom : &__StackOneBottom },
+                       *word   { bottom };
+        const size_t   size    { getStackSize(core) };
+        while(reinterpret_cast<uintptr_t>(word) - reinterpret_cast<uintptr_t>(bottom) < size && *word == PAINT) word++;
+        return size - ( reinterpret_cast<uintptr_t>(word) - reinterpret_cast<uintptr_t>(bottom) );
+#endif
+    }
+
+    void MemoryStats::sample(void) noexcept{
+#if !GG3_HOST
+        // malloc lock inside: allocations made by the other core meanwhile are counted consistently
+        struct mallinfo info { mallinfo() };
+        heapPeak  = std::max(heapPeak,  static_cast<size_t>(info.uordblks));
+        arenaPeak = std::max(arenaPeak, static_cast<size_t>(info.arena));
+#endif
+    }
+
+    string MemoryStats::getPoolStats(const char* name, int pool) noexcept{
+#if LWIP_STATS && MEMP_STATS
+        const stats_mem *stats { lwip_stats.memp[pool] };
+        return string(":").append(name).append(":").append(to_string(stats->used))
+                                       .append(":").append(to_string(stats->max))
+                                       .append(":").append(to_string(stats->avail))
+                                       .append(":").append(to_string(stats->err));
+#else
+        static_cast<void>(pool);
+        return string(":").append(name).append(":0:0:0:0");
+#endif
+    }
+
+    string MemoryStats::getStats(size_t queueLen, size_t queueMax, size_t queueCap) noexcept{
+        sample();
+        size_t heapSize  { 0 },
+               heapUsed  { 0 },
+               arena     { 0 };
+#if !GG3_HOST
+        struct mallinfo info { mallinfo() };
+        heapSize = reinterpret_cast<uintptr_t>(&__StackLimit) - reinterpret_cast<uintptr_t>(&__end__);
+        heapUsed = info.uordblks;
+        arena    = info.arena;
+#endif
+        string ret { "mem:stack" };
+        for(unsigned int core{0}; core < CORES; core++)
+            ret.append(":").append(to_string(getStackUsed(core))).append(":").append(to_string(getStackSize(core)));
+        ret.append(":heap:").append(to_string(heapSize))
+           .append(":").append(to_string(arena))
+           .append(":").append(to_string(arenaPeak))
+           .append(":").append(to_string(heapUsed))
+           .append(":").append(to_string(heapPeak));
+#if LWIP_STATS && MEM_STATS
+        ret.append(":lwip:").append(to_string(lwip_stats.mem.used))
+           .append(":").append(to_string(lwip_stats.mem.max))
+           .append(":").append(to_string(lwip_stats.mem.avail))
+           .append(":").append(to_string(lwip_stats.mem.err));
+#else
+        ret.append(":lwip:0:0:0:0");
+#endif
+        ret.append(getPoolStats("pool", MEMP_PBUF_POOL))
+           .append(getPoolStats("seg",  MEMP_TCP_SEG))
+           .append(getPoolStats("pcb",  MEMP_TCP_PCB))
+           .append(":queue:").append(to_string(queueLen))
+           .append(":").append(to_string(queueMax))
+           .append(":").append(to_string(queueCap));
+        return ret.append("\n");
+    }
+
+    // the random number queue, in RAM the runtime doesn't clear at startup: a warm reset (watchdog, reboot) finds it
+    // again, a cold boot fails the checks and starts empty. Entries are sealed with their sequence number,
+    // the header with its own check: a reset in the middle of an update loses at most what it was writing
+    class EntropyPool{
+        public:
+            static inline constexpr size_t              LEN                  { 10240 };
+            static inline constexpr uint32_t            MAGIC                { 0x47473350 };
+
+            static size_t    recover(void)                                 noexcept;
+            static void      push(const Rng& rnd)                          noexcept;
+            static bool      pop(Rng& rnd)                                 noexcept;
+            static size_t    size(void)                                    noexcept;
+            static string    getStats(void)                                noexcept;
+
+        private:
+            struct Entry{
+                registry                                           reg;
+                uint16_t                                           value,
+                                                                   check;
+            };
+            // head and tail are sequence numbers: oldest entry and next one
+            struct Header{
+                uint32_t                                           magic,
+                                                                   head,
+                                                                   tail,
+                                                                   check;
+            };
+            struct Store{
+                Header                                             header;
+                array<Entry, LEN>                                  entries;
+            };
+
+            static Store                                           store;
+            static inline size_t                                   recovered            { 0 },
+                                                                   discarded            { 0 };
+
+            static uint32_t  mix(uint32_t value)                           noexcept;
+            static uint32_t  headerCheck(const Header& header)             noexcept;
+            static uint16_t  entryCheck(uint32_t seq, const Entry& entry)  noexcept;
+            static void      seal(void)                                    noexcept;
+    };
+
+#if GG3_HOST
+    EntropyPool::Store EntropyPool::store;
+#else
+    EntropyPool::Store EntropyPool::store __attribute__((section(".uninitialized_data.gg3_pool")));
+#endif
+
+    uint32_t EntropyPool::mix(uint32_t value) noexcept{
+        value ^= value >> 16;
+        value *= 0x85EBCA6B;
+        value ^= value >> 13;
+        value *= 0xC2B2AE35;
+        return value ^ ( value >> 16 );
+    }
+
+    uint32_t EntropyPool::headerCheck(const Header& header) noexcept{
+        return mix(header.magic ^ mix(header.head ^ mix(header.tail)));
+    }
+
+    uint16_t EntropyPool::entryCheck(uint32_t seq, const Entry& entry) noexcept{
+        return static_cast<uint16_t>(mix(seq ^ mix(entry.reg ^ ( static_cast<uint32_t>(entry.value) << 16 ))));
+    }
+
+    void EntropyPool::seal(void) noexcept{
+        store.header.check = headerCheck(store.header);
+    }
+
+    size_t EntropyPool::recover(void) noexcept{
+        Header&  header  { store.header };
+        uint32_t valid   { header.head };
+        if(header.magic == MAGIC && header.check == headerCheck(header) && header.tail - header.head <= LEN){
+            // the queue is kept up to the first entry that doesn't match its sequence
+            for(; valid != header.tail; valid++){
+                const Entry& entry { store.entries[valid % LEN] };
+                if(entry.value > numeric_limits<uint8_t>::max() || entry.check != entryCheck(valid, entry)) break;
+            }
+            discarded   = header.tail - valid;
+            header.tail = valid;
+        }else{
+            header.head = 0;
+            header.tail = 0;
+        }
+        header.magic = MAGIC;
+        recovered    = header.tail - header.head;
+        seal();
+        return recovered;
+    }
+
+    void EntropyPool::push(const Rng& rnd) noexcept{
+        Header& header { store.header };
+        // full: the oldest entry goes, sealed before its slot is written so a reset mid-push leaves the slot
+        // outside the queue rather than a broken entry at its head
+        if(header.tail - header.head == LEN){
+            header.head++;
+            seal();
+        }
+        Entry&  entry  { store.entries[header.tail % LEN] };
+        entry.reg   = rnd.second;
+        entry.value = rnd.first;
+        entry.check = entryCheck(header.tail, entry);
+        header.tail++;
+        seal();
+    }
+
+    bool EntropyPool::pop(Rng& rnd) noexcept{
+        Header& header { store.header };
+        if(header.head == header.tail) return false;
+        const Entry& entry { store.entries[header.head % LEN] };
+        rnd = { static_cast<rng>(entry.value), entry.reg };
+        // sealed before the value leaves: a reset can lose it, never serve it twice
+        header.head++;
+        seal();
+        return true;
+    }
+
+    size_t EntropyPool::size(void) noexcept{
+        return store.header.tail - store.header.head;
+    }
+
+    string EntropyPool::getStats(void) noexcept{
+        return string(":pool:").append(to_string(recovered))
+                               .append(":").append(to_string(discarded));
+    }
+
+    // Entropy set aside for a scheduled consumer: until its deadline a reservation takes a share of the
+    // incoming bytes ahead of the pool, sized on the byte rate to be complete in time, earliest deadline
+    // first; the pool keeps at least a quarter of the bytes. Reservations are in normal RAM, a reset drops them.
+    class Reservations{
+        public:
+            static inline constexpr size_t              SLOTS                { 2 },
+                                                        MAX_BYTES            { 4064 },
+                                                        // "rcl:<bytes>\n" and the data
+                                                        MAX_ANSWER           { MAX_BYTES + 16 },
+                                                        TOKEN_DIGITS         { 12 },
+                                                        BYTES_DIGITS         { 6 },
+                                                        SECONDS_DIGITS       { 6 };
+            // shares in eighths of the bytes
+            static inline constexpr uint32_t            SHARE_STEPS          { 8 },
+                                                        MIN_SHARE            { 1 },
+                                                        MAX_SHARE            { 6 },
+                                                        MAX_SECONDS          { 7 * 24 * 3'600 },
+                                                        CLAIM_GRACE_S        { 600 },
+                                                        UPDATE_PERIOD_US     { 250'000 },
+                                                        UPDATE_COST_US       { Scheduler::CORE1_SLOT_US };
+            static inline constexpr int                 NONE                 { -1 };
+
+            static void      init(void)                                    noexcept;
+            static int       open(size_t bytes, uint32_t seconds, uint64_t token) noexcept;
+            static bool      offer(uint8_t value)                          noexcept;
+            static bool      schedule(unsigned int bytesPerMinute)         noexcept;
+            static string    query(uint64_t token)                         noexcept;
+            static string    claim(uint64_t token)                         noexcept;
+            static uint64_t  getToken(int slot)                            noexcept;
+            static string    getStats(void)                                noexcept;
+
+        private:
+            enum class State : uint8_t { FREE, FILLING, READY, EXPIRED, CLAIMING };
+
+            struct Slot{
+                uint64_t                                           token,
+                                                                   deadline;
+                uint32_t                                           target,
+                                                                   filled,
+                                                                   share,
+                                                                   credit;
+                State                                              state;
+                array<uint8_t, MAX_BYTES>                          data;
+            };
+
+            // core1 fills, core0 opens, updates and claims: one SIO spinlock, never held across a copy
+            static inline spin_lock_t                              *lock                { nullptr };
+            static inline array<Slot, SLOTS>                       slots                {};
+            static inline volatile uint32_t                        filling              { 0 };
+            static inline volatile bool                            pending              { false };
+            static inline unsigned int                             perMinute            { 0 };
+            static inline uint64_t                                 lastUpdate           { 0 };
+            static inline uint32_t                                 opened               { 0 },
+                                                                   completed            { 0 },
+                                                                   expired              { 0 },
+                                                                   claimed              { 0 },
+                                                                   abandoned            { 0 },
+                                                                   diverted             { 0 };
+
+            static void      update(void *arg)                             noexcept;
+            static void      reshare(void)                                 noexcept;
+            static int       find(uint64_t token)                          noexcept;
+    };
+
+    void Reservations::init(void) noexcept{
+        lock = spin_lock_instance(static_cast<uint>(spin_lock_claim_unused(true)));
+    }
+
+    int Reservations::find(uint64_t token) noexcept{
+        for(size_t i{0}; i < SLOTS; i++)
+            if(slots[i].state != State::FREE && slots[i].state != State::CLAIMING && slots[i].token == token) return static_cast<int>(i);
+        return NONE;
+    }
+
+    // the token comes from the pool (GeigerGen3::getToken), whoever holds it can claim the bytes
+    int Reservations::open(size_t bytes, uint32_t seconds, uint64_t token) noexcept{
+        if(bytes == 0 || bytes > MAX_BYTES || seconds == 0 || seconds > MAX_SECONDS) return NONE;
+
+        int      ret  { NONE };
+        uint32_t save { spin_lock_blocking(lock) };
+        for(size_t i{0}; i < SLOTS && ret == NONE; i++){
+            Slot& slot { slots[i] };
+            if(slot.state != State::FREE) continue;
+            slot.token    = token;
+            slot.deadline = Timebase::getMicros() + seconds * 1'000'000ULL;
+            slot.target   = static_cast<uint32_t>(bytes);
+            slot.filled   = 0;
+            slot.share    = 0;
+            slot.credit   = 0;
+            slot.state    = State::FILLING;
+            filling       = filling + 1;
+            opened++;
+            ret           = static_cast<int>(i);
+        }
+        spin_unlock(lock, save);
+        // shares at once, not at the next period: a job already queued stays pending, it runs as well
+        if(ret != NONE) reshare();
+        return ret;
+    }
+
+    // core1, for every accepted event: credits grow by the share, a slot with a whole event of credit takes it
+    bool Reservations::offer(uint8_t value) noexcept{
+        if(filling == 0) return false;
+        bool     taken { false };
+        uint32_t save  { spin_lock_blocking(lock) };
+        for(Slot& slot : slots){
+            if(slot.state != State::FILLING) continue;
+            slot.credit += slot.share;
+            if(taken || slot.credit < SHARE_STEPS) continue;
+            slot.credit                -= SHARE_STEPS;
+            slot.data[slot.filled++]    = value;
+            taken                       = true;
+            diverted++;
+            if(slot.filled == slot.target){
+                slot.state = State::READY;
+                filling    = filling - 1;
+                completed++;
+            }
+        }
+        spin_unlock(lock, save);
+        return taken;
+    }
+
+    bool Reservations::schedule(unsigned int bytesPerMinute) noexcept{
+        if(!pending && ( filling > 0 || opened != claimed + abandoned ) && Timebase::getMicros() - lastUpdate >= UPDATE_PERIOD_US){
+            perMinute = bytesPerMinute;
+            pending = Scheduler::submit(0, update, nullptr, UPDATE_COST_US);
+        }
+        return pending;
+    }
+
+    // the scheduled job: only the run the scheduler makes clears pending, a new one can't be queued beside it
+    void Reservations::update(void *arg) noexcept{
+        static_cast<void>(arg);
+        reshare();
+        pending = false;
+    }
+
+    // deadlines and shares: the earliest deadline gets the share it needs to be complete at 3/4 of the time left,
+    // the next one what remains within MAX_SHARE; without a rate yet, the first takes MAX_SHARE
+    void Reservations::reshare(void) noexcept{
+        uint64_t now    { Timebase::getMicros() };
+        uint32_t budget { MAX_SHARE };
+        uint32_t save   { spin_lock_blocking(lock) };
+        array<Slot*, SLOTS> order {};
+        size_t   count  { 0 };
+        for(Slot& slot : slots){
+            if(slot.state == State::FILLING && now >= slot.deadline){
+                slot.state = State::EXPIRED;
+                filling    = filling - 1;
+                expired++;
+            }
+            if(( slot.state == State::READY || slot.state == State::EXPIRED ) && now >= slot.deadline + CLAIM_GRACE_S * 1'000'000ULL){
+                slot.state = State::FREE;
+                abandoned++;
+            }
+            if(slot.state == State::FILLING) order[count++] = &slot;
+        }
+        std::sort(order.begin(), order.begin() + count, [](const Slot* a, const Slot* b){ return a->deadline < b->deadline; });
+        for(size_t i{0}; i < count; i++){
+            Slot&    slot  { *order[i] };
+            uint64_t left  { ( slot.deadline - now ) * 3 / 4 };
+            uint64_t need  { perMinute == 0 || left == 0 ? MAX_SHARE
+                                                         : ( static_cast<uint64_t>(slot.target - slot.filled) * 60'000'000ULL * SHARE_STEPS + perMinute * left - 1 ) / ( perMinute * left ) };
+            slot.share  = std::min(budget, static_cast<uint32_t>(std::clamp<uint64_t>(need, MIN_SHARE, MAX_SHARE)));
+            budget     -= slot.share;
+        }
+        lastUpdate = now;
+        spin_unlock(lock, save);
+    }
+
+    // rsq:<state>:<filled>:<target>:<eta_s>:<left_s>:<share_percent>, eta "-" while the rate is unknown
+    string Reservations::query(uint64_t token) noexcept{
+        uint64_t deadline { 0 };
+        uint32_t target   { 0 },
+                 filled   { 0 },
+                 share    { 0 };
+        State    state    { State::FREE };
+        uint32_t save     { spin_lock_blocking(lock) };
+        if(int idx { find(token) }; idx != NONE){
+            const Slot& slot { slots[static_cast<size_t>(idx)] };
+            deadline = slot.deadline;
+            target   = slot.target;
+            filled   = slot.filled;
+            share    = slot.share;
+            state    = slot.state;
+        }
+        spin_unlock(lock, save);
+        if(state == State::FREE) return "rsq:lost\n";
+
+        uint64_t now      { Timebase::getMicros() },
+                 rate     { static_cast<uint64_t>(perMinute) * share };
+        string   eta      { state == State::READY ? string("0")
+                          : state == State::EXPIRED || rate == 0 ? string("-")
+                          : to_string(( static_cast<uint64_t>(target - filled) * 60 * SHARE_STEPS + rate - 1 ) / rate) };
+        return string("rsq:").append(state == State::FILLING ? "filling" : state == State::READY ? "ready" : "expired")
+                             .append(":").append(to_string(filled))
+                             .append(":").append(to_string(target))
+                             .append(":").append(eta)
+                             .append(":").append(to_string(now < deadline ? ( deadline - now ) / 1'000'000 : 0))
+                             .append(":").append(to_string(share * 100 / SHARE_STEPS))
+                             .append("\n");
+    }
+
+    // rcl:<count>\n and the bytes set aside so far: claiming before completion ends the reservation early
+    string Reservations::claim(uint64_t token) noexcept{
+        uint32_t save  { spin_lock_blocking(lock) };
+        int      idx   { find(token) };
+        if(idx != NONE){
+            Slot& slot { slots[static_cast<size_t>(idx)] };
+            if(slot.state == State::FILLING) filling = filling - 1;
+            slot.state = State::CLAIMING;
+        }
+        spin_unlock(lock, save);
+        if(idx == NONE) return "rcl:lost\n";
+
+        // out of core1 reach now: copied without the lock
+        Slot&  slot { slots[static_cast<size_t>(idx)] };
+        string ret  { string("rcl:").append(to_string(slot.filled)).append("\n") };
+        ret.append(reinterpret_cast<const char*>(slot.data.data()), slot.filled);
+
+        save       = spin_lock_blocking(lock);
+        slot.state = State::FREE;
+        claimed++;
+        spin_unlock(lock, save);
+        return ret;
+    }
+
+    uint64_t Reservations::getToken(int slot) noexcept{
+        return slot == NONE ? 0 : slots[static_cast<size_t>(slot)].token;
+    }
+
+    string Reservations::getStats(void) noexcept{
+        return string(":rsv:").append(to_string(opened))
+                              .append(":").append(to_string(completed))
+                              .append(":").append(to_string(expired))
+                              .append(":").append(to_string(claimed))
+                              .append(":").append(to_string(abandoned))
+                              .append(":").append(to_string(diverted));
+    }
+
     class GeigerGen3 {
         public:
             static inline constexpr unsigned int        MAX_RESULT           { 255 },
                                                         INVALID_RESULT       { MAX_RESULT + 1 };
+            static inline constexpr size_t              MAX_QUEUE_LEN        { EntropyPool::LEN };
 
             static_assert( INVALID_RESULT <  numeric_limits<registry>::max() ); 
+            static_assert( INVALID_RESULT <= numeric_limits<rng>::max() ); 
             static_assert( MAX_RESULT < INVALID_RESULT ); 
 
             static GeigerGen3*     getInstance(unsigned int  pin, 
@@ -209,8 +1750,13 @@ namespace geigergen3 {
             void                   init(void)                          noexcept;
             static void            abort(const char* msg)              noexcept;
             void                   detect(void)                        noexcept;
+            static bool            waitReady(uint32_t timeoutMs)       noexcept;
             static Rng             getRnd(void)                        noexcept;
+            static bool            getToken(uint64_t& token, size_t digits) noexcept;
             static size_t          getAvailable(void)                  noexcept;
+            static long            getCount(void)                      noexcept;
+            static size_t          takeQueuePeak(void)                 noexcept;
+            static size_t          getQueueMax(void)                   noexcept;
             static string          getStats(void)                      noexcept;
 
             static inline Cpm                                      cpmStats;
@@ -218,8 +1764,8 @@ namespace geigergen3 {
 
         private:
             static inline mutex_t                                  rndMutex;
-            static inline deque<Rng>                               rndQueue; 
-            static inline const size_t                             MAX_QUEUE_LEN        { 10240 };
+            static inline volatile size_t                          queuePeak            { 0 };
+            static inline size_t                                   queueMax             { 0 };
             static inline long                                     count                { 0L },
                                                                    genCount             { 0L },
                                                                    lastCount            { 0L };
@@ -227,93 +1773,699 @@ namespace geigergen3 {
                                                                    vthreshold,
                                                                    zerothreshold;
 
-            static inline GeigerGen3*                              instance             { nullptr };
-            static inline unsigned int                             roulette             { 0 },
-                                                                   lastRnd              { INVALID_RESULT };
+            static inline GeigerGen3*                              instance             { nullptr };
+            static inline unsigned int                             roulette             { 0 },
+                                                                   lastRnd              { INVALID_RESULT };
+
+            explicit GeigerGen3(unsigned int pin, 
+                                unsigned int vhtr,
+                                unsigned int zero)                 noexcept;
+    };
+
+    GeigerGen3::GeigerGen3(unsigned int pin, unsigned int  vthr, unsigned int zero)  noexcept {
+        gpioPin       = pin;
+        vthreshold    = vthr;
+        zerothreshold = zero;
+    }
+
+    void  GeigerGen3::abort(const char* msg) noexcept{
+        cerr << "Abort : " << msg << "\n";
+        for(;;) sleep_ms(1000);
+    }
+
+    Rng GeigerGen3::getRnd(void) noexcept{
+        Rng ret { INVALID_RESULT, 0 };
+        if(EntropyPool::size() > 0){
+             mutex_enter_blocking(&GeigerGen3::rndMutex);
+             if(!EntropyPool::pop(ret)) ret = { INVALID_RESULT, 0 };
+             mutex_exit(&GeigerGen3::rndMutex);
+        }
+        return ret;
+    }
+
+    bool GeigerGen3::getToken(uint64_t& token, size_t digits) noexcept{
+        // pool bytes: a token derived from the time or a counter could be guessed by another client
+        token = 0;
+        for(size_t bits{0}; bits < digits * 4; bits += 8){
+            Rng rnd { getRnd() };
+            if(rnd.first > MAX_RESULT) return false;
+            token = ( token << 8 ) | rnd.first;
+        }
+        // 0 marks a free slot
+        token |= 1;
+        return true;
+    }
+
+    size_t  GeigerGen3::getAvailable(void)  noexcept{
+          return EntropyPool::size();
+    }
+
+    long  GeigerGen3::getCount(void)  noexcept{
+          return GeigerGen3::count;
+    }
+
+    size_t  GeigerGen3::takeQueuePeak(void)  noexcept{
+          mutex_enter_blocking(&GeigerGen3::rndMutex);
+          size_t ret { GeigerGen3::queuePeak };
+          GeigerGen3::queuePeak = EntropyPool::size();
+          GeigerGen3::queueMax  = std::max(GeigerGen3::queueMax, ret);
+          mutex_exit(&GeigerGen3::rndMutex);
+          return ret;
+    }
+
+    size_t  GeigerGen3::getQueueMax(void)  noexcept{
+          // the peak since the last history rollup is still in queuePeak
+          return std::max(GeigerGen3::queueMax, static_cast<size_t>(GeigerGen3::queuePeak));
+    }
+
+    void GeigerGen3::init(void)  noexcept {
+        Timebase::initCore();
+        loopStats.calibrate(DetectionLoopStats::BASE_UNDER_THR, DetectionLoopStats::BASE_ABOVE_THR);
+        stdio_init_all(); 
+        BootTimeline::mark(BootTimeline::Phase::STDIO);
+
+        adc_init();
+        adc_gpio_init(gpioPin);
+        adc_select_input(0);
+        BootTimeline::mark(BootTimeline::Phase::ADC);
+
+        mutex_init(&rndMutex);
+        if(size_t recovered { EntropyPool::recover() }; recovered > 0) cerr << "Random number pool: " << recovered << " recovered.\n";
+        MemoryStats::paintCore0();
+
+        PcSampler::init();
+        PcSampler::enableOnCore();
+        Scheduler::init();
+        Reservations::init();
+    }
+
+    GeigerGen3* GeigerGen3::getInstance(unsigned int pin, unsigned int vthr, unsigned int zero) noexcept{
+        if(instance == nullptr) instance = new GeigerGen3(pin, vthr, zero);
+        return instance;
+    }
+
+    void GeigerGen3::detect(void)  noexcept{
+        auto detectionThread = [](){ 
+           Timebase::initCore();
+           PcSampler::enableOnCore();
+           GeigerGen3::cpmStats.start();
+           BootTimeline::mark(BootTimeline::Phase::CORE1);
+           // last sample under the threshold, valid while it's the one just before the current sample
+           uint16_t prev      { 0 };
+           bool     prevValid { false },
+                    // the period ending now was a plain one: no pulse, no pause and no switch of mode in it
+                    steady    { false };
+           for(;;){
+               if(CoreIsolation::apply()) steady = false;
+               if(SupplyMonitor::isRequested()){ SupplyMonitor::park(); prevValid = false; steady = false; }
+               uint16_t result { adc_read() };
+               GeigerGen3::loopStats.start();
+               CoreIsolation::tick(GeigerGen3::loopStats.getBegin(), steady);
+               steady = result <= vthreshold;
+               if(result > vthreshold){ 
+                  // every pulse counts for the interval statistics, gated ones too
+                  AdaptiveExtraction::observe(GeigerGen3::roulette, GeigerGen3::loopStats.getBegin());
+                  // a pulse seen while the supply is disturbed may be noise: flagged or kept out of the pool, its tail is waited anyway
+                  if(SupplyMonitor::accept()){
+                     // the crossing happened in the previous period: the register gets its fraction, if trusted
+                     uint32_t frac { prevValid ? SubsampleTiming::interpolate(prev, result, vthreshold) : SubsampleTiming::NONE };
+                     registry reg  { GeigerGen3::roulette };
+                     if(frac != SubsampleTiming::NONE){
+                        SubsampleTiming::record(frac);
+                        if(SubsampleTiming::isEnabled()) reg = ( ( GeigerGen3::roulette - 1 ) << SubsampleTiming::FRAC_BITS ) | frac;
+                     }
+
+                     // the low bits of the register are packed into bytes, as many as the interval supports;
+                     // a reservation filling takes its share of the bytes ahead of the pool
+                     array<uint8_t, AdaptiveExtraction::MAX_OUT> bytes {};
+                     for(unsigned int i{0}, len{ AdaptiveExtraction::pack(reg, bytes) }; i < len; i++){
+                        if(Reservations::offer(bytes[i])) continue;
+                        mutex_enter_blocking(&GeigerGen3::rndMutex);
+                        EntropyPool::push({bytes[i], reg});
+                        if(EntropyPool::size() > GeigerGen3::queuePeak) GeigerGen3::queuePeak = EntropyPool::size();
+                        mutex_exit(&GeigerGen3::rndMutex);
+                     }
+
+                     RawCapture::push(Timebase::getMicros(), GeigerGen3::roulette, static_cast<uint8_t>(frac));
+
+                     if(GeigerGen3::count++ == 0) BootTimeline::mark(BootTimeline::Phase::FIRST_EVENT);
+                     GeigerGen3::cpmStats.update();
+                  }
+
+                  for(;;){ if(SupplyMonitor::isRequested()) SupplyMonitor::park();
+                        result = adc_read();
+                        // the pulse tail is a dead window anyway: spend it on short jobs instead of sleeping
+                        if(result > zerothreshold ){ if(!Scheduler::runOne(Scheduler::CORE1_SLOT_US)) CoreIsolation::wait(Scheduler::CORE1_SLOT_US); }
+                        else  break;
+                  }
+               }
+               prev      = result;
+               prevValid = true;
+               GeigerGen3::roulette++;
+               GeigerGen3::loopStats.stop();
+           }
+        };
+
+        MemoryStats::paintCore1();
+        multicore_launch_core1(detectionThread);
+    }
+
+    bool GeigerGen3::waitReady(uint32_t timeoutMs) noexcept{
+        uint64_t deadline { Timebase::getMicros() + timeoutMs * 1'000ULL };
+        // core1 must be sampling; the usb console is worth a short wait, it isn't a requirement
+        while(Timebase::getMicros() < deadline){
+            if(BootTimeline::isMarked(BootTimeline::Phase::CORE1) && stdio_usb_connected()) return true;
+            sleep_ms(10);
+        }
+        return BootTimeline::isMarked(BootTimeline::Phase::CORE1);
+    }
+
+    string GeigerGen3::getStats(void) noexcept{
+
+        return string("cpm:").append(to_string(GeigerGen3::cpmStats.getLastMinute()))
+                             .append(":").append(to_string(GeigerGen3::cpmStats.getAverage()))
+                             .append(":loop:").append(to_string(GeigerGen3::loopStats.getMin() / 1'000))
+                             .append(":").append(to_string(GeigerGen3::loopStats.getMax() / 1'000))
+                             .append(":").append(to_string(GeigerGen3::loopStats.getUnder()))
+                             .append(":").append(to_string(GeigerGen3::loopStats.getAbove()))
+                             // the loop fields above keep their microseconds, the timebase resolution follows
+                             .append(":loopns:").append(to_string(GeigerGen3::loopStats.getMin()))
+                             .append(":").append(to_string(GeigerGen3::loopStats.getMax()));
+    }
+
+    struct HistoryRecord{
+        uint32_t  events,
+                  bytes;
+        uint16_t  loopMaxUs,
+                  queuePeak,
+                  errors,
+                  minutes;
+    };
+    static_assert( sizeof(HistoryRecord) == 16 );
+
+    template<size_t LEN>
+    class HistoryRing{
+        public:
+            void            push(const HistoryRecord& record)       noexcept;
+            uint32_t        getTotal(void)                  const   noexcept;
+            uint32_t        getFirst(void)                  const   noexcept;
+            HistoryRecord   at(uint32_t seq)                const   noexcept;
+
+        private:
+            array<HistoryRecord, LEN>                              ring                 {};
+            uint32_t                                               total                { 0 };
+    };
+
+    template<size_t LEN>
+    void HistoryRing<LEN>::push(const HistoryRecord& record) noexcept{
+        ring[total % LEN] = record;
+        total++;
+    }
+
+    template<size_t LEN>
+    uint32_t HistoryRing<LEN>::getTotal(void) const noexcept{
+        return total;
+    }
+
+    template<size_t LEN>
+    uint32_t HistoryRing<LEN>::getFirst(void) const noexcept{
+        return total > LEN ? total - LEN : 0;
+    }
+
+    template<size_t LEN>
+    HistoryRecord HistoryRing<LEN>::at(uint32_t seq) const noexcept{
+        // overwritten while a dump was in flight: an empty record (minutes 0) marks the hole
+        if(seq < getFirst() || seq >= total) return {};
+        return ring[seq % LEN];
+    }
+
+    class StatsHistory{
+        public:
+            enum class Window : unsigned int { MINUTES, HOURS };
+
+            static inline constexpr size_t              MINUTES_LEN          { 1'440 },
+                                                        HOURS_LEN            { 720 },
+                                                        RECORD_SIZE          { sizeof(HistoryRecord) };
+            static inline constexpr uint64_t            MINUTE_US            { 60'000'000 };
+            static inline constexpr uint16_t            HOUR_MINUTES         { 60 };
+            static inline constexpr uint32_t            ROLLUP_COST_US       { 300 };
+
+            static bool            isDue(void)                                      noexcept;
+            static void            rollup(void *arg)                                noexcept;
+            static void            addBytes(uint32_t bytes)                         noexcept;
+            static void            addError(void)                                   noexcept;
+            static bool            schedule(void)                                   noexcept;
+            static uint32_t        getFirst(Window window)                          noexcept;
+            static uint32_t        getTotal(Window window)                          noexcept;
+            static HistoryRecord   at(Window window, uint32_t seq)                  noexcept;
+            static string          getHeader(Window window)                         noexcept;
+
+        private:
+            static inline HistoryRing<MINUTES_LEN>                 minutes;
+            static inline HistoryRing<HOURS_LEN>                   hours;
+            static inline HistoryRecord                            hour                 {};
+            // minute records in the current hour: with stalls they may cover more, or fewer, minutes
+            static inline uint16_t                                 hourSlots            { 0 };
+            static inline uint64_t                                 last                 { 0 };
+            static inline long                                     lastCount            { 0 };
+            static inline bool                                     pending              { false };
+            // written by the lwIP callbacks, taken by the roll-up under the lwIP lock
+            static inline uint32_t                                 bytes                { 0 },
+                                                                   errors               { 0 };
+
+            static uint16_t        saturate(uint64_t value)                         noexcept;
+    };
+
+    uint16_t StatsHistory::saturate(uint64_t value) noexcept{
+        return static_cast<uint16_t>(std::min<uint64_t>(value, numeric_limits<uint16_t>::max()));
+    }
+
+    bool StatsHistory::isDue(void) noexcept{
+        return last == 0 || Timebase::getMicros() - last >= MINUTE_US;
+    }
+
+    bool StatsHistory::schedule(void) noexcept{
+        // the lwIP lock taken by the roll-up is the core0 one: never let core1 steal it
+        if(!pending && isDue()) pending = Scheduler::submit(0, rollup, nullptr, ROLLUP_COST_US, true);
+        return pending;
+    }
+
+    void StatsHistory::rollup(void *arg) noexcept{
+        static_cast<void>(arg);
+        uint64_t now { Timebase::getMicros() };
+        pending = false;
+        if(last == 0){
+            last      = now;
+            lastCount = GeigerGen3::getCount();
+            return;
+        }
+
+        // after a stall the first record takes everything and covers the whole gap, the missed minutes
+        // follow as empty records covering none: averages over minutes covered stay right
+        uint64_t due { ( now - last ) / MINUTE_US };
+        for(uint64_t slot{0}; slot < due; slot++, last += MINUTE_US){
+            HistoryRecord record  {};
+            if(slot == 0){
+                long count     { GeigerGen3::getCount() };
+                record         = { static_cast<uint32_t>(count - lastCount), 0,
+                                   saturate(GeigerGen3::loopStats.takeWindowMax() / 1'000),
+                                   saturate(GeigerGen3::takeQueuePeak()), 0, saturate(due) };
+                lastCount      = count;
+            }
+
+            cyw43_arch_lwip_begin();
+            if(slot == 0){
+                record.bytes  = bytes;
+                record.errors = saturate(errors);
+                bytes         = 0;
+                errors        = 0;
+            }
+            minutes.push(record);
+
+            hour.events    += record.events;
+            hour.bytes     += record.bytes;
+            hour.loopMaxUs  = std::max(hour.loopMaxUs, record.loopMaxUs);
+            hour.queuePeak  = std::max(hour.queuePeak, record.queuePeak);
+            hour.errors     = saturate(hour.errors + record.errors);
+            hour.minutes    = saturate(hour.minutes + record.minutes);
+            if(++hourSlots == HOUR_MINUTES){
+                hours.push(hour);
+                hour      = {};
+                hourSlots = 0;
+            }
+            cyw43_arch_lwip_end();
+        }
+    }
+
+    void StatsHistory::addBytes(uint32_t len) noexcept{
+        bytes += len;
+    }
+
+    void StatsHistory::addError(void) noexcept{
+        errors++;
+    }
+
+    uint32_t StatsHistory::getFirst(Window window) noexcept{
+        return window == Window::MINUTES ? minutes.getFirst() : hours.getFirst();
+    }
+
+    uint32_t StatsHistory::getTotal(Window window) noexcept{
+        return window == Window::MINUTES ? minutes.getTotal() : hours.getTotal();
+    }
+
+    HistoryRecord StatsHistory::at(Window window, uint32_t seq) noexcept{
+        return window == Window::MINUTES ? minutes.at(seq) : hours.at(seq);
+    }
+
+    string StatsHistory::getHeader(Window window) noexcept{
+        bool     byMinute { window == Window::MINUTES };
+        return string(byMinute ? "hmn:" : "hhr:").append(to_string(getTotal(window) - getFirst(window)))
+                                                 .append(":").append(to_string(RECORD_SIZE))
+                                                 .append(":").append(to_string(byMinute ? 60 : 3'600))
+                                                 .append(":").append(to_string(last / 1'000'000))
+                                                 .append("\n");
+    }
+
+    class OutputQueue{
+        public:
+            static inline constexpr size_t              LEN                  { 10'240 },
+                                                        // room for the unflushed send buffer and the longest answer before reading the next command
+                                                        RESERVE              { 6'144 };
+
+            bool      push(const uint8_t* data, size_t len)        noexcept;
+            size_t    peek(const uint8_t*& data)           const   noexcept;
+            void      pop(size_t len)                              noexcept;
+            void      clear(void)                                  noexcept;
+            void      stall(void)                                  noexcept;
+            bool      isEmpty(void)                        const   noexcept;
+            bool      isCongested(void)                    const   noexcept;
+            size_t    getFree(void)                        const   noexcept;
+            string    getStats(void)                       const   noexcept;
+
+        private:
+            array<uint8_t, LEN>                                    ring;
+            size_t                                                 head                 { 0 },
+                                                                   count                { 0 },
+                                                                   peak                 { 0 },
+                                                                   stalls               { 0 };
+    };
+
+    bool OutputQueue::push(const uint8_t* data, size_t len) noexcept{
+        if(len > getFree()) return false;
+        for(size_t i{0}; i < len; ){
+            size_t tail  { ( head + count ) % LEN },
+                   chunk { std::min(len - i, LEN - tail) };
+            copy_n(data + i, chunk, ring.data() + tail);
+            count += chunk;
+            i     += chunk;
+        }
+        peak = std::max(peak, count);
+        return true;
+    }
+
+    size_t OutputQueue::peek(const uint8_t*& data) const noexcept{
+        // contiguous bytes only, the wrapped part comes with the next call
+        data = ring.data() + head;
+        return std::min(count, LEN - head);
+    }
+
+    void OutputQueue::pop(size_t len) noexcept{
+        len    = std::min(len, count);
+        head   = ( head + len ) % LEN;
+        count -= len;
+    }
+
+    void OutputQueue::clear(void) noexcept{
+        head  = 0;
+        count = 0;
+    }
+
+    void OutputQueue::stall(void) noexcept{
+        stalls++;
+    }
+
+    bool OutputQueue::isEmpty(void) const noexcept{
+        return count == 0;
+    }
+
+    bool OutputQueue::isCongested(void) const noexcept{
+        return getFree() < RESERVE;
+    }
+
+    size_t OutputQueue::getFree(void) const noexcept{
+        return LEN - count;
+    }
+
+    string OutputQueue::getStats(void) const noexcept{
+        return string(":out:").append(to_string(count))
+                              .append(":").append(to_string(peak))
+                              .append(":").append(to_string(stalls));
+    }
+
+    // stream sessions outlive the connection and the network restarts of main(): the blocks served and not yet
+    // acknowledged stay in a window, a client coming back with the token gets them again before any new one
+    class StreamSessions{
+        public:
+            static inline constexpr size_t              SESSIONS             { 2 },
+                                                        WINDOW               { 64 },
+                                                        BLOCK_LEN            { 32 },
+                                                        TOKEN_DIGITS         { 12 },
+                                                        SEQ_DIGITS           { 12 };
+            static inline constexpr int                 NONE                 { -1 };
+
+            static int       open(void)                                                    noexcept;
+            static int       resume(uint64_t token, uint64_t acked)                        noexcept;
+            static bool      close(uint64_t token)                                         noexcept;
+            static string    next(int session, uint64_t acked)                             noexcept;
+            static uint64_t  getToken(int session)                                         noexcept;
+            static string    getStats(void)                                                noexcept;
+            static string    toHex(uint64_t value, size_t digits)                          noexcept;
+            static bool      fromHex(const uint8_t* data, size_t digits, uint64_t& value)  noexcept;
+
+        private:
+            struct Block{
+                uint8_t                                            len;
+                array<uint8_t, BLOCK_LEN>                          data;
+            };
+            // sequences start from 1, blocks (acked, head) are kept at sequence % WINDOW
+            struct Session{
+                uint64_t                                           token,
+                                                                   acked,
+                                                                   cursor,
+                                                                   head,
+                                                                   used;
+                array<Block, WINDOW>                               window;
+            };
+
+            static inline array<Session, SESSIONS>                 sessions             {};
+            static inline uint64_t                                 clock                { 0 };
+            static inline uint32_t                                 resumes              { 0 },
+                                                                   replayed             { 0 },
+                                                                   lost                 { 0 },
+                                                                   full                 { 0 };
+    };
+
+    int StreamSessions::open(void) noexcept{
+        // the token binds the session to whoever holds it: without pool bytes for it no session is evicted
+        uint64_t token { 0 };
+        if(!GeigerGen3::getToken(token, TOKEN_DIGITS)) return NONE;
+
+        size_t slot { 0 };
+        for(size_t i{1}; i < SESSIONS; i++)
+            if(sessions[i].used < sessions[slot].used) slot = i;
+
+        Session& session { sessions[slot] };
+        session.token  = token;
+        session.acked  = 0;
+        session.cursor = 1;
+        session.head   = 1;
+        session.used   = ++clock;
+        return static_cast<int>(slot);
+    }
+
+    int StreamSessions::resume(uint64_t token, uint64_t acked) noexcept{
+        for(size_t i{0}; i < SESSIONS; i++){
+            Session& session { sessions[i] };
+            if(session.token == 0 || session.token != token) continue;
+            // blocks up to the previous ack are gone, blocks never generated can't be acknowledged
+            if(acked < session.acked || acked >= session.head) break;
+            if(session.cursor > acked + 1) replayed += static_cast<uint32_t>(session.cursor - acked - 1);
+            session.acked  = acked;
+            session.cursor = acked + 1;
+            session.used   = ++clock;
+            resumes++;
+            return static_cast<int>(i);
+        }
+        lost++;
+        return NONE;
+    }
+
+    bool StreamSessions::close(uint64_t token) noexcept{
+        for(Session& session : sessions)
+            if(session.token != 0 && session.token == token){
+                session.token = 0;
+                session.used  = 0;
+                return true;
+            }
+        return false;
+    }
+
+    string StreamSessions::next(int session, uint64_t acked) noexcept{
+        Session& ses { sessions.at(static_cast<size_t>(session)) };
+        // every block request counts as a use: eviction by "sop" takes the least recently streamed session
+        ses.used = ++clock;
+        // anything ever served may be acknowledged, also blocks of a previous connection not replayed yet
+        if(acked > ses.acked && acked < ses.head){
+            ses.acked  = acked;
+            ses.cursor = std::max(ses.cursor, acked + 1);
+        }
+
+        uint64_t seq { ses.cursor };
+        if(seq == ses.head){
+            if(ses.head - 1 - ses.acked >= WINDOW){
+                full++;
+                return "sbk:full\n";
+            }
+            Block& block { ses.window[seq % WINDOW] };
+            block.len = 0;
+            for(Rng rnd { GeigerGen3::getRnd() }; rnd.first <= GeigerGen3::MAX_RESULT; ){
+                block.data[block.len++] = static_cast<uint8_t>(rnd.first);
+                if(block.len == BLOCK_LEN) break;
+                rnd = GeigerGen3::getRnd();
+            }
+            if(block.len == 0) return "sbk:wait\n";
+            ses.head++;
+        }
+        ses.cursor++;
 
-            explicit GeigerGen3(unsigned int pin, 
-                                unsigned int vhtr,
-                                unsigned int zero)                 noexcept;
-    };
+        const Block& block { ses.window[seq % WINDOW] };
+        string       ret   { string("sbk:").append(toHex(seq, SEQ_DIGITS)).append(":") };
+        for(size_t i{0}; i < block.len; i++) ret.append(toHex(block.data[i], 2));
+        return ret.append("\n");
+    }
 
-    GeigerGen3::GeigerGen3(unsigned int pin, unsigned int  vthr, unsigned int zero)  noexcept {
-        gpioPin       = pin;
-        vthreshold    = vthr;
-        zerothreshold = zero;
+    uint64_t StreamSessions::getToken(int session) noexcept{
+        return sessions.at(static_cast<size_t>(session)).token;
     }
 
-    void  GeigerGen3::abort(const char* msg) noexcept{
-        cerr << "Abort : " << msg << "\n";
-        for(;;) sleep_ms(1000);
+    string StreamSessions::getStats(void) noexcept{
+        return string(":stream:").append(to_string(resumes))
+                                 .append(":").append(to_string(replayed))
+                                 .append(":").append(to_string(lost))
+                                 .append(":").append(to_string(full));
     }
 
-    Rng GeigerGen3::getRnd(void) noexcept{
-        Rng ret { INVALID_RESULT, 0 };
-        if( ! GeigerGen3::rndQueue.empty()){
-             mutex_enter_blocking(&GeigerGen3::rndMutex);
-             ret = GeigerGen3::rndQueue.front();
-             GeigerGen3::rndQueue.pop_front();
-             mutex_exit(&GeigerGen3::rndMutex);
-        }
+    string StreamSessions::toHex(uint64_t value, size_t digits) noexcept{
+        static constexpr char DIGITS[] { "0123456789abcdef" };
+        string ret(digits, '0');
+        for(size_t i{digits}; i > 0 && value != 0; i--, value >>= 4) ret[i - 1] = DIGITS[value & 0xF];
         return ret;
     }
 
-    size_t  GeigerGen3::getAvailable(void)  noexcept{
-          return GeigerGen3::rndQueue.size();
+    bool StreamSessions::fromHex(const uint8_t* data, size_t digits, uint64_t& value) noexcept{
+        value = 0;
+        for(size_t i{0}; i < digits; i++){
+            uint8_t c { data[i] };
+            if(c >= '0' && c <= '9')      value = ( value << 4 ) | static_cast<uint64_t>(c - '0');
+            else if(c >= 'a' && c <= 'f') value = ( value << 4 ) | static_cast<uint64_t>(c - 'a' + 10);
+            else if(c >= 'A' && c <= 'F') value = ( value << 4 ) | static_cast<uint64_t>(c - 'A' + 10);
+            else                          return false;
+        }
+        return true;
     }
 
-    void GeigerGen3::init(void)  noexcept {
-        stdio_init_all(); 
+    // protocol v2, negotiated with "bv2" after the banner: little endian frames with the same 8 bytes header both
+    // ways, answers carry the request id and may complete out of order
+    class Frame{
+        public:
+            enum class Type : uint8_t { END=0, BYTES=1, RANGE=2, STATS=3, CONFIG=4 };
+            enum class Status : uint8_t { OK=0, PARTIAL=1, BAD_REQUEST=2, UNSUPPORTED=3, BUSY=4 };
+            enum class Key : uint8_t { VERSION=0, IDLE_TIMEOUT_S=1, SUPPLY_GATE=2, CORE1_ISOLATION=3, EXTRACT_BITS=4 };
+
+            static inline constexpr u16_t               HEADER_LEN           { 8 },
+                                                        MAX_REQUEST          { 16 },
+                                                        BYTES_REQUEST        { 4 },
+                                                        RANGE_REQUEST        { 8 },
+                                                        CONFIG_REQUEST       { 8 },
+                                                        MAX_BYTES            { 1'024 },
+                                                        MAX_VALUES           { 256 },
+                                                        VERSION              { 2 };
+            // pool requests waiting for events, served in order among themselves
+            static inline constexpr size_t              WAITING              { 8 };
+
+            struct Header{
+                uint16_t                                           id;
+                Type                                               type;
+                Status                                             status;
+                uint32_t                                           len;
+            };
+
+            struct Wait{
+                uint16_t                                           id;
+                Type                                               type;
+                uint16_t                                           count;
+                uint32_t                                           bound;
+                uint64_t                                           deadline;
+            };
+
+            static Header    decode(const uint8_t* data)                                   noexcept;
+            static void      encode(uint8_t* data, const Header& header)                   noexcept;
+            static uint16_t  get16(const uint8_t* data)                                    noexcept;
+            static uint32_t  get32(const uint8_t* data)                                    noexcept;
+            static void      put16(uint8_t* data, uint16_t value)                          noexcept;
+            static void      put32(uint8_t* data, uint32_t value)                          noexcept;
+            static size_t    valueBytes(uint32_t bound)                                    noexcept;
+            static bool      isReady(const Wait& wait)                                     noexcept;
+            static size_t    drawBytes(uint8_t* out, size_t count)                         noexcept;
+            static size_t    drawRange(uint8_t* out, size_t count, uint32_t bound)         noexcept;
+    };
 
-        adc_init();
-        adc_gpio_init(gpioPin);
-        adc_select_input(0);
+    Frame::Header Frame::decode(const uint8_t* data) noexcept{
+        return { get16(data), static_cast<Type>(data[2]), static_cast<Status>(data[3]), get32(data + 4) };
+    }
 
-        mutex_init(&rndMutex);
+    void Frame::encode(uint8_t* data, const Header& header) noexcept{
+        put16(data, header.id);
+        data[2] = static_cast<uint8_t>(header.type);
+        data[3] = static_cast<uint8_t>(header.status);
+        put32(data + 4, header.len);
     }
 
-    GeigerGen3* GeigerGen3::getInstance(unsigned int pin, unsigned int vthr, unsigned int zero){
-        if(instance == nullptr) instance = new GeigerGen3(pin, vthr, zero);
-        return instance;
+    uint16_t Frame::get16(const uint8_t* data) noexcept{
+        return static_cast<uint16_t>(data[0] | ( data[1] << 8 ));
     }
 
-    void GeigerGen3::detect(void)  noexcept{
-        auto detectionThread = [](){ 
-           GeigerGen3::cpmStats.start();
-           for(;;){
-               uint16_t result { adc_read() };
-               GeigerGen3::loopStats.start();
-               if(result > vthreshold){ 
+    uint32_t Frame::get32(const uint8_t* data) noexcept{
+        return static_cast<uint32_t>(get16(data)) | ( static_cast<uint32_t>(get16(data + 2)) << 16 );
+    }
 
-                  mutex_enter_blocking(&GeigerGen3::rndMutex);
-                  if(GeigerGen3::rndQueue.size() > GeigerGen3::MAX_QUEUE_LEN) GeigerGen3::rndQueue.pop_front();
-                  GeigerGen3::rndQueue.push_back({GeigerGen3::roulette % (MAX_RESULT + 1), GeigerGen3::roulette});
-                  mutex_exit(&GeigerGen3::rndMutex);
+    void Frame::put16(uint8_t* data, uint16_t value) noexcept{
+        data[0] = static_cast<uint8_t>(value);
+        data[1] = static_cast<uint8_t>(value >> 8);
+    }
 
-                  GeigerGen3::count++;
-                  GeigerGen3::cpmStats.update();
+    void Frame::put32(uint8_t* data, uint32_t value) noexcept{
+        put16(data,     static_cast<uint16_t>(value));
+        put16(data + 2, static_cast<uint16_t>(value >> 16));
+    }
 
-                  for(;;){ result = adc_read();
-                        if(result > zerothreshold ) sleep_us(10);
-                        else  break;
-                  }
-               }
-               GeigerGen3::roulette++;
-               GeigerGen3::loopStats.stop();
-           }
-        };
+    size_t Frame::valueBytes(uint32_t bound) noexcept{
+        size_t ret { 1 };
+        for(uint32_t max { bound - 1 }; max > 0xFF; max >>= 8) ret++;
+        return ret;
+    }
 
-        multicore_launch_core1(detectionThread);
+    bool Frame::isReady(const Wait& wait) noexcept{
+        size_t needed { wait.type == Type::RANGE ? wait.count * valueBytes(wait.bound) : wait.count };
+        return GeigerGen3::getAvailable() >= needed || Timebase::getMicros() >= wait.deadline;
     }
 
-    string GeigerGen3::getStats(void) noexcept{
+    size_t Frame::drawBytes(uint8_t* out, size_t count) noexcept{
+        size_t ret { 0 };
+        while(ret < count){
+            Rng rnd { GeigerGen3::getRnd() };
+            if(rnd.first > GeigerGen3::MAX_RESULT) break;
+            out[ret++] = static_cast<uint8_t>(rnd.first);
+        }
+        return ret;
+    }
 
-        return string("cpm:").append(to_string(GeigerGen3::cpmStats.getLastMinute()))
-                             .append(":").append(to_string(GeigerGen3::cpmStats.getAverage()))
-                             .append(":loop:").append(to_string(GeigerGen3::loopStats.getMin()))
-                             .append(":").append(to_string(GeigerGen3::loopStats.getMax()))
-                             .append(":").append(to_string(GeigerGen3::loopStats.getUnder()))
-                             .append(":").append(to_string(GeigerGen3::loopStats.getAbove()));
+    size_t Frame::drawRange(uint8_t* out, size_t count, uint32_t bound) noexcept{
+        // the fewest pool bytes covering the bound, rejection above the largest multiple of it: no modulo bias
+        const size_t   bytes { valueBytes(bound) };
+        const uint64_t span  { 1ULL << ( bytes * 8 ) },
+                       limit { span - span % bound };
+        size_t         ret   { 0 };
+        while(ret < count){
+            uint8_t  raw[sizeof(uint32_t)];
+            if(drawBytes(raw, bytes) < bytes) break;
+            uint64_t value { 0 };
+            for(size_t i{0}; i < bytes; i++) value |= static_cast<uint64_t>(raw[i]) << ( i * 8 );
+            if(value >= limit) continue;
+            put32(out + ret * sizeof(uint32_t), static_cast<uint32_t>(value % bound));
+            ret++;
+        }
+        return ret;
     }
 
     using Pbuf=struct pbuf;
@@ -322,38 +2474,263 @@ namespace geigergen3 {
     using Buffer=array<uint8_t,BUF_SIZE> ;
     struct Context {
         TcpPcb    *server_pcb,
-                  *client_pcb;
+                  *client_pcb,
+                  // next client, held in the listener backlog until the slot frees
+                  *waiting_pcb;
         Buffer    bufferSend,
                   bufferRecv;
         u16_t     toSendLen,
                   sentLen,
-                  recvLen;
+                  recvLen,
+                  recvPos;
+        // received data still being parsed: acknowledged to TCP chunk by chunk, as commands are served
+        Pbuf      *recvPb;
+        u16_t     recvOffset;
+        // the data ends in the middle of a command or frame: the next segment is chained to it
+        bool      recvPartial;
+        // answers waiting for room in the TCP send buffer
+        OutputQueue pending;
+        uint64_t  lastActivity,
+                  lastAck;
+        // keepalive probes or retransmissions pending at the last poll: the stack is chasing a silent peer
+        bool      probing;
+        // "end" received: closed as soon as the queued answers are out
+        bool      closing;
+        // history dump in flight: records [streamNext, streamEnd) of streamWindow
+        StatsHistory::Window streamWindow;
+        uint32_t  streamNext,
+                  streamEnd;
+        // stream session bound to this connection by "sop" or "srs"
+        int       session    { StreamSessions::NONE };
+        // protocol v2 negotiated, pool requests waiting for events in [waitHead, waitHead + waitCount)
+        bool      binary;
+        array<Frame::Wait, Frame::WAITING> waiting;
+        size_t    waitHead,
+                  waitCount;
     };
 
+    class LinkQuality{
+        public:
+            enum class Level : unsigned int { GOOD=0, FAIR=1, POOR=2 };
+
+            void      sample(TcpPcb *tpcb)                 noexcept;
+            void      apply(TcpPcb *tpcb)          const   noexcept;
+            u16_t     getCoalesceThr(void)         const   noexcept;
+            u16_t     getSegmentSize(TcpPcb *tpcb) const   noexcept;
+            Level     getLevel(void)               const   noexcept;
+            int32_t   getRssi(void)                const   noexcept;
+            size_t    getRetransmissions(void)     const   noexcept;
+            string    getStats(void)               const   noexcept;
+
+        private:
+            const uint64_t   RSSI_PERIOD   { 5'000'000 };
+            const int32_t    RSSI_GOOD     { -67 },
+                             RSSI_FAIR     { -80 };
+            const s16_t      RTT_SLOW      { 2 };
+            const u16_t      MIN_SEGMENT   { 536 };
+
+            // 0: not known, the last read failed
+            int32_t          rssi          { 0 };
+            uint64_t         lastRssi      { 0 };
+            size_t           rexmit        { 0 };
+            const TcpPcb*    lastPcb       { nullptr };
+            u8_t             lastNrtx      { 0 };
+            bool             lossy         { false },
+                             slow          { false };
+            Level            level         { Level::GOOD };
+    };
+
+    void LinkQuality::sample(TcpPcb *tpcb) noexcept{
+        uint64_t now { Timebase::getMicros() };
+        if(lastRssi == 0 || now - lastRssi >= RSSI_PERIOD){
+            int32_t value { 0 };
+            rssi     = cyw43_wifi_get_rssi(&cyw43_state, &value) == 0 ? value : 0;
+            lastRssi = now;
+        }
+
+        // nrtx counts the retransmissions of the oldest unacked segment and restarts from 0 on its ack:
+        // only its increments are new retransmissions. lwIP keeps the smoothed rtt scaled by 8, in slow timer ticks (500ms)
+        if(tpcb != lastPcb){
+            lastPcb  = tpcb;
+            lastNrtx = 0;
+        }
+        u8_t nrtx { tpcb != nullptr ? tpcb->nrtx : static_cast<u8_t>(0) };
+        if(nrtx > lastNrtx) rexmit += nrtx - lastNrtx;
+        lastNrtx = nrtx;
+        lossy = nrtx > 0;
+        slow  = tpcb != nullptr && ( tpcb->sa >> 3 ) >= RTT_SLOW;
+
+        // an unknown signal level isn't a good one
+        unsigned int grade { rssi == 0 ? 1U : rssi >= RSSI_GOOD ? 0U : rssi >= RSSI_FAIR ? 1U : 2U };
+        if(lossy || slow) grade++;
+        level = static_cast<Level>(std::min(grade, static_cast<unsigned int>(Level::POOR)));
+    }
+
+    void LinkQuality::apply(TcpPcb *tpcb) const noexcept{
+        if(tpcb == nullptr) return;
+        // on a clean link latency wins, otherwise let Nagle merge the small answers in flight
+        if(level == Level::GOOD) tcp_nagle_disable(tpcb);
+        else                     tcp_nagle_enable(tpcb);
+    }
+
+    u16_t LinkQuality::getCoalesceThr(void) const noexcept{
+        switch(level){
+            case Level::GOOD: return MIN_SEGMENT;
+            case Level::FAIR: return TCP_MSS;
+            default:          return BUF_SIZE;
+        }
+    }
+
+    u16_t LinkQuality::getSegmentSize(TcpPcb *tpcb) const noexcept{
+        u16_t mss { tpcb != nullptr && tcp_mss(tpcb) > 0 ? tcp_mss(tpcb) : MIN_SEGMENT };
+        // a lost short segment costs less airtime to repeat
+        return level == Level::POOR ? std::min(mss, MIN_SEGMENT) : mss;
+    }
+
+    LinkQuality::Level LinkQuality::getLevel(void) const noexcept{
+        return level;
+    }
+
+    int32_t LinkQuality::getRssi(void) const noexcept{
+        return rssi;
+    }
+
+    size_t LinkQuality::getRetransmissions(void) const noexcept{
+        return rexmit;
+    }
+
+    string LinkQuality::getStats(void) const noexcept{
+        return string(":link:").append(to_string(rssi))
+                               .append(":").append(to_string(static_cast<unsigned int>(level)))
+                               .append(":").append(to_string(rexmit));
+    }
+
+    enum class Command : unsigned int { REQ, END, STATS, PROF_START, PROF_STOP, PROF_DUMP, BOOT, CLOCK, RAW, HIST_MINUTES, HIST_HOURS,
+                              STREAM_OPEN, STREAM_BLOCK, STREAM_RESUME, STREAM_CLOSE, V2, MEMORY, RESERVE, RESERVE_QUERY,
+                              RESERVE_CLAIM, JITTER, UNKNOWN };
+
+    using CommandName=std::pair<const char*, Command>;
+    static inline constexpr array<CommandName, 21> COMMANDS {{ {"req", Command::REQ},
+                                                              {"sbk", Command::STREAM_BLOCK},
+                                                              {"sop", Command::STREAM_OPEN},
+                                                              {"srs", Command::STREAM_RESUME},
+                                                              {"scl", Command::STREAM_CLOSE},
+                                                              {"raw", Command::RAW},
+                                                              {"hmn", Command::HIST_MINUTES},
+                                                              {"hhr", Command::HIST_HOURS},
+                                                              {"clk", Command::CLOCK},
+                                                              {"end", Command::END},
+                                                              {"sta", Command::STATS},
+                                                              {"pst", Command::PROF_START},
+                                                              {"psp", Command::PROF_STOP},
+                                                              {"pdm", Command::PROF_DUMP},
+                                                              {"bot", Command::BOOT},
+                                                              {"bv2", Command::V2},
+                                                              {"mem", Command::MEMORY},
+                                                              {"rsv", Command::RESERVE},
+                                                              {"rsq", Command::RESERVE_QUERY},
+                                                              {"rcl", Command::RESERVE_CLAIM},
+                                                              {"jit", Command::JITTER} }};
+    static inline constexpr u16_t               COMMAND_LEN { 3 };
+
+    // fixed width hex arguments: token and sequence numbers, a command and its arguments stay a multiple of COMMAND_LEN
+    static inline constexpr u16_t commandArgs(Command cmd) noexcept{
+        switch(cmd){
+            case Command::STREAM_BLOCK:
+                return StreamSessions::SEQ_DIGITS;
+            case Command::STREAM_CLOSE:
+                return StreamSessions::TOKEN_DIGITS;
+            case Command::STREAM_RESUME:
+                return StreamSessions::TOKEN_DIGITS + StreamSessions::SEQ_DIGITS;
+            case Command::RESERVE:
+                return Reservations::BYTES_DIGITS + Reservations::SECONDS_DIGITS;
+            case Command::RESERVE_QUERY:
+            case Command::RESERVE_CLAIM:
+                return Reservations::TOKEN_DIGITS;
+            default:
+                return 0;
+        }
+    }
+    static_assert( StreamSessions::SEQ_DIGITS % COMMAND_LEN == 0 && StreamSessions::TOKEN_DIGITS % COMMAND_LEN == 0 );
+    static_assert( ( Reservations::BYTES_DIGITS + Reservations::SECONDS_DIGITS ) % COMMAND_LEN == 0 && Reservations::TOKEN_DIGITS % COMMAND_LEN == 0 );
+    // a claim is answered at once, after what is still in the send buffer: both must fit the room kept
+    static_assert( BUF_SIZE + Reservations::MAX_ANSWER <= OutputQueue::RESERVE );
+    // so is the profiler dump
+    static_assert( PcSampler::DUMP_MAX <= OutputQueue::RESERVE - BUF_SIZE );
+
     class GeigerGen3NetworkLayer{
         public:
-            explicit GeigerGen3NetworkLayer(u16_t port=6666)                                       noexcept;
+            enum class Reason : unsigned int { END, REMOTE, IDLE, HALF_OPEN, RESET, ERROR, PROTOCOL, BUSY, REASONS };
+
+            static inline constexpr uint32_t            IDLE_TIMEOUT_S       { 120 };
+
+            explicit GeigerGen3NetworkLayer(u16_t port=6666, uint32_t idleTimeoutS=IDLE_TIMEOUT_S) noexcept;
             int      service(void)                                                                 noexcept;
 
+            static int connect(const char* ssid, const char* pwd, uint32_t timeoutMs)              noexcept;
+
         private:
             u16_t                   TCP_PORT;
-            static  inline Context  context;
-
-            static inline err_t clientClose(void *ctx)                                             noexcept;
+            static  inline Context      context;
+            static  inline LinkQuality  linkQuality;
+            static  inline string       statsCache;
+            static  inline uint64_t     statsTime        { 0 };
+            static  inline bool         statsPending     { false };
+            static  inline const uint64_t STATS_MAX_AGE  { 1'000'000 };
+            static  inline const uint32_t STATS_COST_US  { 500 },
+                                          // as short as the supply monitor period, it only bounds idle sleeps
+                                          IDLE_PERIOD_US { SupplyMonitor::PERIOD_US };
+            // lwIP keepalive (ms) and poll (500ms ticks) parameters for the accepted connections
+            static  inline const u32_t    KEEP_IDLE_MS   { 30'000 },
+                                          KEEP_INTVL_MS  { 5'000 },
+                                          KEEP_CNT       { 4 };
+            static  inline const u8_t     POLL_INTERVAL  { 4 };
+            static  inline const uint64_t STALL_TIMEOUT  { 30'000'000 };
+            // the held client keeps one backlog slot: the second lets a further client through to the busy refusal
+            static  inline const u8_t     LISTEN_BACKLOG { 2 };
+            static  inline uint64_t       idleTimeout    { IDLE_TIMEOUT_S * 1'000'000ULL };
+            static  inline array<uint32_t, static_cast<size_t>(Reason::REASONS)>  disconnects  {};
+
+            static inline void  prerenderStats(void *arg)                                          noexcept;
+            static inline string renderStats(void)                                                 noexcept;
+
+            static inline err_t clientClose(void *ctx, bool abort=false)                           noexcept;
+            static inline err_t disconnect(void *ctx, Reason reason, bool abort=false)             noexcept;
+            static inline void  clientReset(void *ctx)                                             noexcept;
+            static inline err_t clientAdopt(void *ctx, TcpPcb *tpcb)                               noexcept;
+            static inline string getDisconnectStats(void)                                          noexcept;
             static inline err_t serverClose(void *ctx)                                             noexcept;
             static inline err_t serverResult(void *ctx, int status)                                noexcept;
             static inline err_t clientResult(void *ctx, int status)                                noexcept;
             static inline err_t result(void *ctx, int status)                                      noexcept;
             static inline err_t serverSentClbk(void *ctx, TcpPcb *tpcb, u16_t len)                 noexcept;
             static inline err_t serverSendData(void *ctx, TcpPcb *tpcb)                            noexcept;
+            static inline err_t serverSendStream(void *ctx, TcpPcb *tpcb)                          noexcept;
+            static inline err_t serverDrain(void *ctx, TcpPcb *tpcb)                               noexcept;
+            static inline bool  isStreaming(const Context *context)                                noexcept;
+            static inline bool  hasInput(const Context *context)                                   noexcept;
+            static inline bool  fillRecv(void *ctx)                                                noexcept;
+            static inline bool  fetchInput(void *ctx, u16_t& pos, u16_t len)                      noexcept;
+            static inline err_t serverProcess(void *ctx)                                           noexcept;
+            static inline err_t queueResponse(void *ctx, const string& msg)                        noexcept;
+            static inline string currentStats(void)                                                noexcept;
+            static inline err_t serverFrame(void *ctx, const Frame::Header& header, const uint8_t* payload) noexcept;
+            static inline uint8_t* frameReserve(void *ctx, size_t len, err_t& err)                 noexcept;
+            static inline err_t frameCommit(void *ctx, const Frame::Header& header)                noexcept;
+            static inline err_t serveWait(void *ctx, const Frame::Wait& wait)                      noexcept;
+            static inline err_t serveWaiting(void *ctx)                                            noexcept;
             static inline err_t serverRecvClbk(void *ctx, TcpPcb *tpcb, Pbuf* pb, err_t err)       noexcept;
             static inline void  serverErrClbk(void *ctx, err_t err)                                noexcept;
+            static inline err_t serverPollClbk(void *ctx, TcpPcb *tpcb)                            noexcept;
+            static inline void  waitingErrClbk(void *ctx, err_t err)                               noexcept;
+            static inline err_t waitingRecvClbk(void *ctx, TcpPcb *tpcb, Pbuf* pb, err_t err)      noexcept;
             static inline err_t serverAccept(void *ctx, TcpPcb *client_pcb, err_t err)             noexcept;
     };
 
-    GeigerGen3NetworkLayer::GeigerGen3NetworkLayer(u16_t port) noexcept
+    GeigerGen3NetworkLayer::GeigerGen3NetworkLayer(u16_t port, uint32_t idleTimeoutS) noexcept
          :   TCP_PORT{port}
     {
+        idleTimeout = idleTimeoutS * 1'000'000ULL;
         cerr << "Connected.\n\nStarting server at " << ip4addr_ntoa(netif_ip4_addr(netif_list))  << " on port " <<  TCP_PORT << '\n';
     }
 
@@ -369,7 +2746,7 @@ namespace geigergen3 {
     return err;
 }
 
-err_t GeigerGen3NetworkLayer::clientClose(void *ctx) noexcept{
+err_t GeigerGen3NetworkLayer::clientClose(void *ctx, bool abort) noexcept{
     Context *context   { static_cast<Context*>(ctx)};
     err_t err          { ERR_OK };
     cerr << "ClientClose\n";
@@ -378,17 +2755,59 @@ err_t GeigerGen3NetworkLayer::clientClose(void *ctx) noexcept{
         tcp_sent(context->client_pcb, nullptr);
         tcp_recv(context->client_pcb, nullptr);
         tcp_err(context->client_pcb,  nullptr);
-        err = tcp_close(context->client_pcb);
+        tcp_poll(context->client_pcb, nullptr, 0);
+        err = abort ? static_cast<err_t>(ERR_VAL) : tcp_close(context->client_pcb);
         if (err != ERR_OK) {
-            cerr << "ClientClose : Error: ClientClose : " <<  err << '\n';
+            if(!abort) cerr << "ClientClose : Error: ClientClose : " <<  err << '\n';
             tcp_abort(context->client_pcb);
             err = ERR_ABRT;
         }
         context->client_pcb = nullptr;
     }
+    clientReset(context);
     return err;
 }
 
+void GeigerGen3NetworkLayer::clientReset(void *ctx) noexcept{
+    Context *context   { static_cast<Context*>(ctx)};
+    if(context->recvPb != nullptr){
+        pbuf_free(context->recvPb);
+        context->recvPb = nullptr;
+    }
+    context->recvLen    = 0;
+    context->recvPos    = 0;
+    context->recvOffset = 0;
+    context->streamNext = 0;
+    context->streamEnd  = 0;
+    context->session    = StreamSessions::NONE;
+    context->recvPartial = false;
+    context->binary     = false;
+    context->waitHead   = 0;
+    context->waitCount  = 0;
+    context->closing    = false;
+    context->probing    = false;
+    context->pending.clear();
+
+    // the slot is free: the client waiting in the backlog gets it now, not at the next service loop
+    if(context->waiting_pcb != nullptr){
+        TcpPcb *next { context->waiting_pcb };
+        context->waiting_pcb = nullptr;
+        clientAdopt(context, next);
+    }
+}
+
+err_t GeigerGen3NetworkLayer::disconnect(void *ctx, Reason reason, bool abort) noexcept{
+    cerr << "Disconnect : reason " << static_cast<unsigned int>(reason) << '\n';
+    disconnects.at(static_cast<size_t>(reason))++;
+    return clientClose(ctx, abort);
+}
+
+string GeigerGen3NetworkLayer::getDisconnectStats(void) noexcept{
+    string ret { ":disc" };
+    for(uint32_t count : disconnects) ret.append(":").append(to_string(count));
+    return ret;
+}
+
 err_t GeigerGen3NetworkLayer::serverResult(void *ctx, int status) noexcept{
     cerr << "ServerResult: ";
     ( status == 0 ) ? cerr << "success\n" : cerr << "failed: " << status << '\n';
@@ -399,8 +2818,9 @@ err_t GeigerGen3NetworkLayer::serverResult(void *ctx, int status) noexcept{
 err_t GeigerGen3NetworkLayer::clientResult(void *ctx, int status) noexcept{
     cerr << "ClientResult: ";
     ( status == 0 ) ? cerr << "success\n" : cerr << "failed: " << status << '\n';
+    if(status != 0) StatsHistory::addError();
     
-    return clientClose(ctx);
+    return disconnect(ctx, status == 0 ? Reason::END : Reason::ERROR);
 }
 
 err_t GeigerGen3NetworkLayer::result(void *ctx, int status) noexcept{
@@ -415,8 +2835,19 @@ err_t GeigerGen3NetworkLayer::serverSentClbk(void *ctx, TcpPcb *tpcb, u16_t len)
     Context *context { static_cast<Context*>(ctx)};
     cerr << "ServerSentClbk : bytes sent: " << len << '\n';
     context->sentLen += len;
+    StatsHistory::addBytes(len);
+    if(context->client_pcb == nullptr) return ERR_OK;
+    context->lastActivity = context->lastAck = Timebase::getMicros();
+
+    err_t ret { serverDrain(context, tpcb) };
+    if(ret == ERR_OK && context->client_pcb != nullptr && isStreaming(context)) ret = serverSendStream(context, tpcb);
+    // room again: resume the commands left waiting behind a dump or a full queue
+    if(ret == ERR_OK && context->client_pcb != nullptr && !isStreaming(context) && !context->pending.isCongested() && hasInput(context))
+        ret = serverProcess(context);
+    if(ret == ERR_OK && context->closing && context->pending.isEmpty() && !isStreaming(context))
+        ret = disconnect(context, Reason::END);
 
-    return ERR_OK;
+    return ret;
 }
 
 err_t GeigerGen3NetworkLayer::serverSendData(void *ctx, TcpPcb *tpcb)  noexcept{
@@ -425,119 +2856,687 @@ err_t GeigerGen3NetworkLayer::serverSendData(void *ctx, TcpPcb *tpcb)  noexcept{
     context->sentLen = 0;
     cerr << "ServerSendData : writing " << context->toSendLen << " bytes to client\n";
     cyw43_arch_lwip_check();
-    if(err_t err { tcp_write(tpcb, context->bufferSend.data(), context->toSendLen, TCP_WRITE_FLAG_COPY) }; err != ERR_OK){
-        cerr << "ServerSendData : Error writing data : " <<  err << '\n';
+    // through the queue, so that answers held back by a full send buffer keep their order
+    if(!context->pending.push(context->bufferSend.data(), context->toSendLen)){
+        cerr << "ServerSendData : Error: output queue overflow\n";
+        context->toSendLen = 0;
         return clientResult(context, -1);
     }
+    context->toSendLen = 0;
+    return serverDrain(context, tpcb);
+}
+
+err_t GeigerGen3NetworkLayer::serverDrain(void *ctx, TcpPcb *tpcb)  noexcept{
+    Context            *context { static_cast<Context*>(ctx)};
+
+    cyw43_arch_lwip_check();
+    const u16_t segment { linkQuality.getSegmentSize(tpcb) };
+    while(!context->pending.isEmpty() && tcp_sndqueuelen(tpcb) < TCP_SND_QUEUELEN){
+        const uint8_t *data  { nullptr };
+        size_t        avail  { context->pending.peek(data) };
+        u16_t         len    { static_cast<u16_t>(std::min<size_t>(std::min<size_t>(segment, tcp_sndbuf(tpcb)), avail)) };
+        if(len == 0) break;
+        u8_t          flags  { static_cast<u8_t>(len < avail ? TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE : TCP_WRITE_FLAG_COPY) };
+        if(err_t err { tcp_write(tpcb, data, len, flags) }; err != ERR_OK){
+            // out of segments or pbufs: the sent callback tries again
+            if(err == ERR_MEM) break;
+            cerr << "ServerDrain : Error writing data : " <<  err << '\n';
+            return clientResult(context, -1);
+        }
+        context->pending.pop(len);
+    }
     tcp_output(tpcb);  
     return ERR_OK;
 }
 
+bool GeigerGen3NetworkLayer::isStreaming(const Context *context)  noexcept{
+    return context->streamNext < context->streamEnd;
+}
+
+err_t GeigerGen3NetworkLayer::serverSendStream(void *ctx, TcpPcb *tpcb)  noexcept{
+    Context            *context { static_cast<Context*>(ctx)};
+    const size_t       RECORD   { StatsHistory::RECORD_SIZE };
+
+    // only what the output queue takes now, the sent callback asks for the rest
+    for(; isStreaming(context) && context->pending.getFree() >= RECORD; context->streamNext++){
+        HistoryRecord record { StatsHistory::at(context->streamWindow, context->streamNext) };
+        context->pending.push(reinterpret_cast<const uint8_t*>(&record), RECORD);
+    }
+    return serverDrain(context, tpcb);
+}
+
+bool GeigerGen3NetworkLayer::hasInput(const Context *context)  noexcept{
+    return context->recvPb != nullptr || context->recvPos < context->recvLen;
+}
+
+bool GeigerGen3NetworkLayer::fillRecv(void *ctx)  noexcept{
+    Context *context { static_cast<Context*>(ctx)};
+    // the previous chunk is served: only now the peer may send more
+    if(context->recvLen > 0) tcp_recved(context->client_pcb, context->recvLen);
+    context->recvLen = 0;
+    context->recvPos = 0;
+    if(context->recvPb == nullptr) return false;
+
+    if(context->recvOffset >= context->recvPb->tot_len){
+        pbuf_free(context->recvPb);
+        context->recvPb = nullptr;
+        return false;
+    }
+    // whole commands only, the buffer may be shorter than the received data
+    u16_t chunk { static_cast<u16_t>(std::min<int>(context->recvPb->tot_len - context->recvOffset, BUF_SIZE / COMMAND_LEN * COMMAND_LEN)) };
+    context->recvLen     =   pbuf_copy_partial(context->recvPb, context->bufferRecv.data(), chunk, context->recvOffset);
+    context->recvOffset  =   static_cast<u16_t>(context->recvOffset + context->recvLen);
+    return context->recvLen > 0;
+}
+
+bool GeigerGen3NetworkLayer::fetchInput(void *ctx, u16_t& pos, u16_t len)  noexcept{
+    Context *context { static_cast<Context*>(ctx)};
+    if(pos + len <= context->recvLen){
+        context->recvPos = static_cast<u16_t>(pos + len);
+        return true;
+    }
+    // cut by the end of the chunk: read again from its start, only what precedes it is acknowledged
+    context->recvOffset = static_cast<u16_t>(context->recvOffset - ( context->recvLen - pos ));
+    context->recvLen    = pos;
+    if(fillRecv(context) && context->recvLen >= len){
+        pos              = 0;
+        context->recvPos = len;
+        return true;
+    }
+    // cut by the end of the received data: the next segment is chained to it
+    context->recvPos     = 0;
+    context->recvPartial = context->recvPb != nullptr;
+    return false;
+}
+
+err_t GeigerGen3NetworkLayer::queueResponse(void *ctx, const string& msg)  noexcept{
+    Context            *context { static_cast<Context*>(ctx)};
+    err_t              err      { ERR_OK };
+
+    if(context->toSendLen + msg.size() > context->bufferSend.size() && context->toSendLen > 0){
+        err = serverSendData(context, context->client_pcb);
+        if(err != ERR_OK || context->client_pcb == nullptr) return err;
+    }
+
+    for(size_t offset{0}; offset < msg.size() && err == ERR_OK && context->client_pcb != nullptr; ){
+        u16_t len { static_cast<u16_t>(std::min(msg.size() - offset, context->bufferSend.size() - context->toSendLen)) };
+        copy_n(msg.data() + offset, len, context->bufferSend.data() + context->toSendLen);
+        context->toSendLen += len;
+        offset             += len;
+
+        if(context->toSendLen >= linkQuality.getCoalesceThr() || context->toSendLen == context->bufferSend.size())
+            err = serverSendData(context, context->client_pcb);
+    }
+    return err;
+}
+
 err_t GeigerGen3NetworkLayer::serverRecvClbk(void *ctx, TcpPcb *tpcb, Pbuf* pb, err_t err)  noexcept{
     Context *context { static_cast<Context*>(ctx)};
     cerr << "ServerRecvClbk\n";
-    if(!pb) return clientResult(context, -1);
+    if(!pb) return disconnect(context, Reason::REMOTE);
     cyw43_arch_lwip_check();
+    context->lastActivity = Timebase::getMicros();
+
+    // commands are still waiting behind a dump or a full queue: lwIP keeps this data and delivers it again
+    if(isStreaming(context) || ( context->recvPb != nullptr && !context->recvPartial )) return ERR_MEM;
+    if(context->recvPb != nullptr){
+        pbuf_cat(context->recvPb, pb);
+        context->recvPartial = false;
+        return serverProcess(context);
+    }
 
-    context->recvLen    =   pbuf_copy_partial(pb, context->bufferRecv.data(), pb->tot_len, 0);
-    cerr << "ServerRecvClbk " <<  pb->tot_len << "/" <<  context->recvLen << " err " << static_cast<int>(err) << '\n';
+    context->recvPb     =   pb;
+    context->recvOffset =   0;
+    context->recvLen    =   0;
+    context->recvPos    =   0;
+    cerr << "ServerRecvClbk " <<  pb->tot_len << " err " << static_cast<int>(err) << '\n';
 
-    tcp_recved(tpcb, pb->tot_len);
-    pbuf_free(pb);
-    
-    for(u16_t i{0}; i<context->recvLen; i=i+3){
+    linkQuality.sample(tpcb);
+    linkQuality.apply(tpcb);
+    context->toSendLen = 0;
+
+    return serverProcess(context);
+}
+
+err_t GeigerGen3NetworkLayer::serverProcess(void *ctx)  noexcept{
+    Context *context { static_cast<Context*>(ctx)};
+    err_t   ret      { ERR_OK };
+    while(ret == ERR_OK && context->client_pcb != nullptr && !isStreaming(context) && !context->closing){
+        if(context->pending.isCongested()){
+            // stop reading: the unacknowledged data closes the receive window
+            context->pending.stall();
+            break;
+        }
+        if(context->recvPos >= context->recvLen && !fillRecv(context)) break;
+        u16_t i { context->recvPos };
+        if(context->binary){
+            if(!fetchInput(context, i, Frame::HEADER_LEN)) break;
+            Frame::Header header { Frame::decode(context->bufferRecv.data() + i) };
+            if(header.len > Frame::MAX_REQUEST){
+                if(context->toSendLen > 0) serverSendData(context, context->client_pcb);
+                ret = disconnect(context, Reason::PROTOCOL);
+                break;
+            }
+            if(!fetchInput(context, i, static_cast<u16_t>(Frame::HEADER_LEN + header.len))) break;
+            ret = serverFrame(context, header, context->bufferRecv.data() + i + Frame::HEADER_LEN);
+            continue;
+        }
+        if(!fetchInput(context, i, COMMAND_LEN)) break;
         cerr << "ServerRecvClbk : Interation : " << ( (3 + i ) /3 )  << " of " << context->recvLen / 3
              << " payload: " <<  context->bufferRecv.at(0 + i) << " - "
              <<  context->bufferRecv.at(1 + i) << " - "
              <<  context->bufferRecv.at(2 + i) << '\n';
     
-        auto ckeckReq = [&]() -> int  {   if(     context->bufferRecv.at(0 + i) == 'r' && 
-                                                  context->bufferRecv.at(1 + i) == 'e' && 
-                                                  context->bufferRecv.at(2 + i) == 'q'  )  return 0;
-                                          else if(context->bufferRecv.at(0 + i) == 'e' && 
-                                                  context->bufferRecv.at(1 + i) == 'n' && 
-                                                  context->bufferRecv.at(2 + i) == 'd'  )  return 1;
-                                          else if(context->bufferRecv.at(0 + i) == 's' && 
-                                                  context->bufferRecv.at(1 + i) == 't' && 
-                                                  context->bufferRecv.at(2 + i) == 'a'  )  return 2;
-                                          else                                             return 3;
-                                       };
-        int par { ckeckReq() };
-        cerr << "ServerRecvClbk: detect type : " << par  <<'\n';
-        err_t err { ERR_OK };
+        auto ckeckReq = [&]() -> Command  {   for(const CommandName& cmd : COMMANDS)
+                                                  if(std::equal(cmd.first, cmd.first + COMMAND_LEN, context->bufferRecv.begin() + i)) return cmd.second;
+                                              return Command::UNKNOWN;
+                                           };
+        Command par { ckeckReq() };
+        cerr << "ServerRecvClbk: detect type : " << static_cast<unsigned int>(par)  <<'\n';
+        if(u16_t args { commandArgs(par) }; args > 0 && !fetchInput(context, i, static_cast<u16_t>(COMMAND_LEN + args))) break;
+        // a claim frees its slot: it is taken only when its answer can be queued, otherwise read again later
+        if(par == Command::RESERVE_CLAIM && context->pending.getFree() < context->toSendLen + Reservations::MAX_ANSWER){
+            context->recvPos = i;
+            context->pending.stall();
+            break;
+        }
+        const uint8_t *arg { context->bufferRecv.data() + i + COMMAND_LEN };
         switch(par){
-            case 0:
+            case Command::REQ:
                 {
                     cerr << "ServerRecvClbk: send for req\n";
                     Rng                rndn     { GeigerGen3::getRnd() };
                     string             msg      { to_string(rndn.first).append(":").append(to_string(rndn.second)).append(":")
                                                                        .append(to_string(GeigerGen3::getAvailable())).append("\n") };
         
-                    context->toSendLen = msg.size() <= context->bufferSend.size() ? msg.size() : context->bufferSend.size();
-                    copy_n(msg.data(),  context->toSendLen, context->bufferSend.data());
-                    err =  serverSendData(context, context->client_pcb);
+                    ret = queueResponse(context, msg);
                 }
             break;
-            case 1:
+            case Command::END:
                     cerr << "ServerRecvClbk: close for end\n";
-                    err = clientClose(context);
+                    context->closing = true;
             break;
-            case 2:
+            case Command::STATS:
                 {
                     cerr << "ServerRecvClbk: statistics\n";
-                    string             stats    { GeigerGen3::getStats() };
-        
-                    context->toSendLen = stats.size() <= context->bufferSend.size() ? stats.size() : context->bufferSend.size();
-                    copy_n(stats.data(),  context->toSendLen, context->bufferSend.data());
-                    err = serverSendData(context, context->client_pcb);
+                    ret = queueResponse(context, currentStats());
+                }
+            break;
+            case Command::PROF_START:
+                    cerr << "ServerRecvClbk: profiler start\n";
+                    PcSampler::start();
+                    ret = queueResponse(context, "pst\n");
+            break;
+            case Command::PROF_STOP:
+                    cerr << "ServerRecvClbk: profiler stop\n";
+                    PcSampler::stop();
+                    ret = queueResponse(context, "psp\n");
+            break;
+            case Command::PROF_DUMP:
+                    cerr << "ServerRecvClbk: profiler dump\n";
+                    ret = queueResponse(context, PcSampler::dump());
+            break;
+            case Command::BOOT:
+                    cerr << "ServerRecvClbk: boot timeline\n";
+                    ret = queueResponse(context, BootTimeline::getStats());
+            break;
+            case Command::RAW:
+                    cerr << "ServerRecvClbk: raw events\n";
+                    ret = queueResponse(context, RawCapture::drain());
+            break;
+            case Command::CLOCK:
+                    cerr << "ServerRecvClbk: clock profile\n";
+                    ret = queueResponse(context, ClockProfile::getStats(GeigerGen3::loopStats));
+            break;
+            case Command::JITTER:
+                    cerr << "ServerRecvClbk: loop jitter\n";
+                    ret = queueResponse(context, CoreIsolation::dump());
+            break;
+            case Command::HIST_MINUTES:
+            case Command::HIST_HOURS:
+                {
+                    cerr << "ServerRecvClbk: history dump\n";
+                    StatsHistory::Window window { par == Command::HIST_MINUTES ? StatsHistory::Window::MINUTES : StatsHistory::Window::HOURS };
+                    ret = queueResponse(context, StatsHistory::getHeader(window));
+                    // the records follow the header as they fit the send buffer, later commands wait
+                    context->streamWindow = window;
+                    context->streamNext   = StatsHistory::getFirst(window);
+                    context->streamEnd    = StatsHistory::getTotal(window);
+                }
+            break;
+            case Command::STREAM_OPEN:
+                {
+                    cerr << "ServerRecvClbk: stream open\n";
+                    int                session  { StreamSessions::open() };
+                    if(session == StreamSessions::NONE){
+                        ret = queueResponse(context, "sop:wait\n");
+                        break;
+                    }
+                    context->session = session;
+                    ret = queueResponse(context, string("sop:").append(StreamSessions::toHex(StreamSessions::getToken(context->session),
+                                                                                                StreamSessions::TOKEN_DIGITS)).append("\n"));
+                }
+            break;
+            case Command::STREAM_BLOCK:
+                {
+                    cerr << "ServerRecvClbk: stream block\n";
+                    uint64_t           acked    { 0 };
+                    if(!StreamSessions::fromHex(arg, StreamSessions::SEQ_DIGITS, acked)){
+                        ret = disconnect(context, Reason::PROTOCOL);
+                        break;
+                    }
+                    ret = queueResponse(context, context->session == StreamSessions::NONE ? string("sbk:none\n")
+                                                                                          : StreamSessions::next(context->session, acked));
+                }
+            break;
+            case Command::STREAM_RESUME:
+                {
+                    cerr << "ServerRecvClbk: stream resume\n";
+                    uint64_t           token    { 0 },
+                                       acked    { 0 };
+                    if(!StreamSessions::fromHex(arg, StreamSessions::TOKEN_DIGITS, token) ||
+                       !StreamSessions::fromHex(arg + StreamSessions::TOKEN_DIGITS, StreamSessions::SEQ_DIGITS, acked)){
+                        ret = disconnect(context, Reason::PROTOCOL);
+                        break;
+                    }
+                    context->session = StreamSessions::resume(token, acked);
+                    ret = queueResponse(context, context->session == StreamSessions::NONE ? string("srs:lost\n")
+                                                                                          : string("srs:").append(StreamSessions::toHex(token, StreamSessions::TOKEN_DIGITS))
+                                                                                                          .append(":").append(StreamSessions::toHex(acked, StreamSessions::SEQ_DIGITS))
+                                                                                                          .append("\n"));
                 }
             break;
+            case Command::STREAM_CLOSE:
+                {
+                    cerr << "ServerRecvClbk: stream close\n";
+                    uint64_t           token    { 0 };
+                    if(!StreamSessions::fromHex(arg, StreamSessions::TOKEN_DIGITS, token)){
+                        ret = disconnect(context, Reason::PROTOCOL);
+                        break;
+                    }
+                    if(context->session != StreamSessions::NONE && StreamSessions::getToken(context->session) == token)
+                        context->session = StreamSessions::NONE;
+                    ret = queueResponse(context, StreamSessions::close(token) ? "scl\n" : "scl:lost\n");
+                }
+            break;
+            case Command::MEMORY:
+                    cerr << "ServerRecvClbk: memory\n";
+                    ret = queueResponse(context, MemoryStats::getStats(GeigerGen3::getAvailable(), GeigerGen3::getQueueMax(), GeigerGen3::MAX_QUEUE_LEN));
+            break;
+            case Command::RESERVE:
+                {
+                    cerr << "ServerRecvClbk: reserve\n";
+                    uint64_t           bytes    { 0 },
+                                       seconds  { 0 };
+                    if(!StreamSessions::fromHex(arg, Reservations::BYTES_DIGITS, bytes) ||
+                       !StreamSessions::fromHex(arg + Reservations::BYTES_DIGITS, Reservations::SECONDS_DIGITS, seconds)){
+                        ret = disconnect(context, Reason::PROTOCOL);
+                        break;
+                    }
+                    if(bytes == 0 || bytes > Reservations::MAX_BYTES || seconds == 0 || seconds > Reservations::MAX_SECONDS){
+                        ret = queueResponse(context, "rsv:bad\n");
+                        break;
+                    }
+                    uint64_t           token    { 0 };
+                    if(!GeigerGen3::getToken(token, Reservations::TOKEN_DIGITS)){
+                        ret = queueResponse(context, "rsv:wait\n");
+                        break;
+                    }
+                    int                slot     { Reservations::open(bytes, static_cast<uint32_t>(seconds), token) };
+                    ret = queueResponse(context, slot == Reservations::NONE ? string("rsv:full\n")
+                                                                            : string("rsv:").append(StreamSessions::toHex(Reservations::getToken(slot),
+                                                                                                                          Reservations::TOKEN_DIGITS)).append("\n"));
+                }
+            break;
+            case Command::RESERVE_QUERY:
+            case Command::RESERVE_CLAIM:
+                {
+                    cerr << "ServerRecvClbk: reservation " << ( par == Command::RESERVE_QUERY ? "query\n" : "claim\n" );
+                    uint64_t           token    { 0 };
+                    if(!StreamSessions::fromHex(arg, Reservations::TOKEN_DIGITS, token)){
+                        ret = disconnect(context, Reason::PROTOCOL);
+                        break;
+                    }
+                    ret = queueResponse(context, par == Command::RESERVE_QUERY ? Reservations::query(token) : Reservations::claim(token));
+                }
+            break;
+            case Command::V2:
+                    cerr << "ServerRecvClbk: protocol v2\n";
+                    ret = queueResponse(context, "bv2\n");
+                    // the following bytes are frames
+                    context->binary = true;
+            break;
             default:
                     cerr << "ServerRecvClbk: error\n";
-                    err = clientClose(context); 
+                    if(context->toSendLen > 0) serverSendData(context, context->client_pcb);
+                    ret = disconnect(context, Reason::PROTOCOL); 
         } 
     } 
 
+    if(ret == ERR_OK && context->client_pcb != nullptr && context->toSendLen > 0)
+        ret = serverSendData(context, context->client_pcb);
+    if(ret == ERR_OK && context->client_pcb != nullptr && isStreaming(context))
+        ret = serverSendStream(context, context->client_pcb);
+    if(ret == ERR_OK && context->client_pcb != nullptr && context->closing && context->pending.isEmpty() && !isStreaming(context))
+        ret = disconnect(context, Reason::END);
+
     cerr << "ServerRecvClbk : end \n";
-    return err;
+    return ret;
+}
+
+string GeigerGen3NetworkLayer::currentStats(void)  noexcept{
+    bool               fresh    { statsTime > 0 && Timebase::getMicros() - statsTime < STATS_MAX_AGE };
+    return fresh ? statsCache : renderStats();
+}
+
+err_t GeigerGen3NetworkLayer::serverFrame(void *ctx, const Frame::Header& header, const uint8_t* payload)  noexcept{
+    Context            *context { static_cast<Context*>(ctx)};
+    err_t              ret      { ERR_OK };
+    Frame::Header      answer   { header.id, header.type, Frame::Status::OK, 0 };
+    cerr << "ServerFrame: id " << header.id << " type " << static_cast<unsigned int>(header.type) << '\n';
+    switch(header.type){
+        case Frame::Type::END:
+            context->closing = true;
+        return ERR_OK;
+        case Frame::Type::BYTES:
+        case Frame::Type::RANGE:
+            {
+                bool               range    { header.type == Frame::Type::RANGE };
+                if(header.len != ( range ? Frame::RANGE_REQUEST : Frame::BYTES_REQUEST )){
+                    answer.status = Frame::Status::BAD_REQUEST;
+                    break;
+                }
+                Frame::Wait        wait     { header.id, header.type, Frame::get16(payload), range ? Frame::get32(payload + 4) : 0,
+                                              Timebase::getMicros() + Frame::get16(payload + 2) * 1'000ULL };
+                if(wait.count == 0 || wait.count > ( range ? Frame::MAX_VALUES : Frame::MAX_BYTES ) || ( range && wait.bound < 2 )){
+                    answer.status = Frame::Status::BAD_REQUEST;
+                    break;
+                }
+                // short of events or behind other waiting requests: answered later, the next frames go on meanwhile
+                if(context->waitCount > 0 || !Frame::isReady(wait)){
+                    if(context->waitCount == Frame::WAITING){
+                        answer.status = Frame::Status::BUSY;
+                        break;
+                    }
+                    context->waiting[( context->waitHead + context->waitCount++ ) % Frame::WAITING] = wait;
+                    return ERR_OK;
+                }
+                return serveWait(context, wait);
+            }
+        case Frame::Type::STATS:
+            {
+                string             stats    { currentStats() };
+                answer.len = static_cast<uint32_t>(std::min<size_t>(stats.size(), BUF_SIZE - Frame::HEADER_LEN));
+                uint8_t            *data    { frameReserve(context, answer.len, ret) };
+                if(data == nullptr) return ret;
+                copy_n(stats.data(), answer.len, data);
+            }
+        break;
+        case Frame::Type::CONFIG:
+            {
+                if(header.len != Frame::CONFIG_REQUEST){
+                    answer.status = Frame::Status::BAD_REQUEST;
+                    break;
+                }
+                bool               set      { payload[1] != 0 };
+                uint32_t           value    { Frame::get32(payload + 4) };
+                switch(static_cast<Frame::Key>(payload[0])){
+                    case Frame::Key::VERSION:
+                        if(set) answer.status = Frame::Status::BAD_REQUEST;
+                        value = Frame::VERSION;
+                    break;
+                    case Frame::Key::IDLE_TIMEOUT_S:
+                        if(set) idleTimeout = value * 1'000'000ULL;
+                        value = static_cast<uint32_t>(idleTimeout / 1'000'000);
+                    break;
+                    case Frame::Key::SUPPLY_GATE:
+                        if(set && value > static_cast<uint32_t>(SupplyMonitor::Mode::REJECT)) answer.status = Frame::Status::BAD_REQUEST;
+                        else if(set)                                                           SupplyMonitor::init(static_cast<SupplyMonitor::Mode>(value));
+                        value = static_cast<uint32_t>(SupplyMonitor::getMode());
+                    break;
+                    case Frame::Key::CORE1_ISOLATION:
+                        if(set && value > static_cast<uint32_t>(CoreIsolation::Mode::ISOLATED)) answer.status = Frame::Status::BAD_REQUEST;
+                        else if(set)                                                             CoreIsolation::request(static_cast<CoreIsolation::Mode>(value));
+                        value = static_cast<uint32_t>(CoreIsolation::getRequested());
+                    break;
+                    case Frame::Key::EXTRACT_BITS:
+                        if(set && !AdaptiveExtraction::setLimit(value)) answer.status = Frame::Status::BAD_REQUEST;
+                        value = AdaptiveExtraction::getLimit();
+                    break;
+                    default:
+                        answer.status = Frame::Status::UNSUPPORTED;
+                }
+                if(answer.status != Frame::Status::OK) break;
+                answer.len = sizeof(uint32_t);
+                uint8_t            *data    { frameReserve(context, answer.len, ret) };
+                if(data == nullptr) return ret;
+                Frame::put32(data, value);
+            }
+        break;
+        default:
+            answer.status = Frame::Status::UNSUPPORTED;
+    }
+    if(answer.len == 0 && frameReserve(context, 0, ret) == nullptr) return ret;
+    return frameCommit(context, answer);
+}
+
+uint8_t* GeigerGen3NetworkLayer::frameReserve(void *ctx, size_t len, err_t& err)  noexcept{
+    Context            *context { static_cast<Context*>(ctx)};
+    err = ERR_OK;
+    // answers are encoded in place, in the send buffer: make room first
+    if(context->toSendLen + Frame::HEADER_LEN + len > context->bufferSend.size() && context->toSendLen > 0){
+        err = serverSendData(context, context->client_pcb);
+        if(err != ERR_OK || context->client_pcb == nullptr) return nullptr;
+    }
+    return context->bufferSend.data() + context->toSendLen + Frame::HEADER_LEN;
+}
+
+err_t GeigerGen3NetworkLayer::frameCommit(void *ctx, const Frame::Header& header)  noexcept{
+    Context            *context { static_cast<Context*>(ctx)};
+    Frame::encode(context->bufferSend.data() + context->toSendLen, header);
+    context->toSendLen = static_cast<u16_t>(context->toSendLen + Frame::HEADER_LEN + header.len);
+    if(context->toSendLen >= linkQuality.getCoalesceThr()) return serverSendData(context, context->client_pcb);
+    return ERR_OK;
+}
+
+err_t GeigerGen3NetworkLayer::serveWait(void *ctx, const Frame::Wait& wait)  noexcept{
+    Context            *context { static_cast<Context*>(ctx)};
+    err_t              ret      { ERR_OK };
+    bool               range    { wait.type == Frame::Type::RANGE };
+    uint8_t            *data    { frameReserve(context, range ? wait.count * sizeof(uint32_t) : wait.count, ret) };
+    if(data == nullptr) return ret;
+    size_t             count    { range ? Frame::drawRange(data, wait.count, wait.bound) : Frame::drawBytes(data, wait.count) };
+    return frameCommit(context, { wait.id, wait.type, count < wait.count ? Frame::Status::PARTIAL : Frame::Status::OK,
+                                  static_cast<uint32_t>(range ? count * sizeof(uint32_t) : count) });
+}
+
+err_t GeigerGen3NetworkLayer::serveWaiting(void *ctx)  noexcept{
+    Context            *context { static_cast<Context*>(ctx)};
+    err_t              ret      { ERR_OK };
+    // oldest first, the pool is shared in request order; a full output queue holds them back as it does with commands
+    while(ret == ERR_OK && context->client_pcb != nullptr && context->waitCount > 0 && !context->pending.isCongested() &&
+          Frame::isReady(context->waiting[context->waitHead])){
+        Frame::Wait        wait     { context->waiting[context->waitHead] };
+        context->waitHead = ( context->waitHead + 1 ) % Frame::WAITING;
+        context->waitCount--;
+        ret = serveWait(context, wait);
+    }
+    if(ret == ERR_OK && context->client_pcb != nullptr && context->toSendLen > 0)
+        ret = serverSendData(context, context->client_pcb);
+    return ret;
 }
 
 void GeigerGen3NetworkLayer::serverErrClbk(void *ctx, err_t err)  noexcept{
-    cerr << "ServerErrClbk\n";
-    if(err != ERR_ABRT) {
-        cerr << "ServerErrClbk : " << err << '\n';
-        serverResult(ctx, err);
+    Context *context { static_cast<Context*>(ctx)};
+    cerr << "ServerErrClbk : " << err << '\n';
+    StatsHistory::addError();
+    // lwIP already freed the pcb: forget it, don't close it. The aborts decided here are counted with their own
+    // reason and detach this callback first, so an abort seen here comes from the stack: a silent peer given up
+    // by keepalive or retransmissions, or a connection dropped for memory
+    Reason   reason  { err == ERR_RST ? Reason::RESET : err == ERR_ABRT && context->probing ? Reason::HALF_OPEN : Reason::ERROR };
+    disconnects.at(static_cast<size_t>(reason))++;
+    context->client_pcb = nullptr;
+    clientReset(context);
+}
+
+err_t GeigerGen3NetworkLayer::serverPollClbk(void *ctx, TcpPcb *tpcb)  noexcept{
+    Context  *context    { static_cast<Context*>(ctx)};
+    uint64_t now         { Timebase::getMicros() };
+    bool     outstanding { !context->pending.isEmpty() || tcp_sndbuf(tpcb) < TCP_SND_BUF };
+    context->probing = tpcb->keep_cnt_sent > 0 || tpcb->nrtx > 0;
+
+    // data in flight and nothing acknowledged for long: keepalive can't see this one, the peer is gone
+    if(outstanding && now - context->lastAck >= STALL_TIMEOUT) return disconnect(context, Reason::HALF_OPEN, true);
+    if(idleTimeout > 0 && now - context->lastActivity >= idleTimeout) return disconnect(context, Reason::IDLE);
+
+    // a write refused with nothing in flight gets no sent callback: retry from here
+    err_t ret { serverDrain(context, tpcb) };
+    if(ret == ERR_OK && context->client_pcb != nullptr && isStreaming(context)) ret = serverSendStream(context, tpcb);
+    if(ret == ERR_OK && context->client_pcb != nullptr && !isStreaming(context) && !context->pending.isCongested() && hasInput(context))
+        ret = serverProcess(context);
+    return ret;
+}
+
+err_t GeigerGen3NetworkLayer::clientAdopt(void *ctx, TcpPcb *tpcb)  noexcept{
+    Context *context { static_cast<Context*>(ctx)};
+    cerr << "ClientAdopt: Client connected\n";
+    tcp_backlog_accepted(tpcb);
+
+    context->client_pcb   = tpcb;
+    context->lastActivity = context->lastAck = Timebase::getMicros();
+    tcp_arg(tpcb, context);
+    tcp_sent(tpcb, serverSentClbk);
+    tcp_recv(tpcb, serverRecvClbk);
+    tcp_err(tpcb, serverErrClbk);
+    tcp_poll(tpcb, serverPollClbk, POLL_INTERVAL);
+
+    ip_set_option(tpcb, SOF_KEEPALIVE);
+    tpcb->keep_idle  = KEEP_IDLE_MS;
+    tpcb->keep_intvl = KEEP_INTVL_MS;
+    tpcb->keep_cnt   = KEEP_CNT;
+
+    string             msg      { "ready\n" };
+    context->toSendLen = msg.size() <= context->bufferSend.size() ? msg.size() : context->bufferSend.size();
+    copy_n(msg.data(),  context->toSendLen, context->bufferSend.data());
+    return serverSendData(context, context->client_pcb);
+}
+
+void GeigerGen3NetworkLayer::waitingErrClbk(void *ctx, err_t err)  noexcept{
+    Context *context { static_cast<Context*>(ctx)};
+    cerr << "WaitingErrClbk : " << err << '\n';
+    disconnects.at(static_cast<size_t>(Reason::RESET))++;
+    context->waiting_pcb = nullptr;
+}
+
+err_t GeigerGen3NetworkLayer::waitingRecvClbk(void *ctx, TcpPcb *tpcb, Pbuf* pb, err_t err)  noexcept{
+    Context *context { static_cast<Context*>(ctx)};
+    static_cast<void>(err);
+    // commands sent before the slot frees stay with lwIP, they are delivered once adopted
+    if(pb != nullptr) return ERR_MEM;
+
+    cerr << "WaitingRecvClbk : gave up\n";
+    disconnects.at(static_cast<size_t>(Reason::REMOTE))++;
+    context->waiting_pcb = nullptr;
+    tcp_arg(tpcb, nullptr);
+    tcp_recv(tpcb, nullptr);
+    tcp_err(tpcb, nullptr);
+    tcp_backlog_accepted(tpcb);
+    if(tcp_close(tpcb) != ERR_OK){
+        tcp_abort(tpcb);
+        return ERR_ABRT;
     }
+    return ERR_OK;
 }
   
 err_t GeigerGen3NetworkLayer::serverAccept(void *ctx, TcpPcb *client_pcb, err_t err)  noexcept{
     Context *context { static_cast<Context*>(ctx)};
-    cerr << "ServerErrClbk\n";
+    cerr << "ServerAccept\n";
     if(err != ERR_OK || client_pcb == nullptr) {
-        cerr << "ServerErrClbk: Error: accept\n";
-        clientResult(context, err);
+        cerr << "ServerAccept: Error: accept\n";
+        StatsHistory::addError();
         return ERR_VAL;
     }
-    cerr << "ServerErrClbk: Client connected\n";
 
-    context->client_pcb = client_pcb;
-    tcp_arg(client_pcb, context);
-    tcp_sent(client_pcb, serverSentClbk);
-    tcp_recv(client_pcb, serverRecvClbk);
-    tcp_err(client_pcb, serverErrClbk);
+    if(context->client_pcb != nullptr){
+        if(context->waiting_pcb != nullptr){
+            cerr << "ServerAccept: busy\n";
+            disconnects.at(static_cast<size_t>(Reason::BUSY))++;
+            tcp_abort(client_pcb);
+            return ERR_ABRT;
+        }
+        // connected but not served: the backlog slot stays taken until adopted
+        tcp_backlog_delayed(client_pcb);
+        context->waiting_pcb = client_pcb;
+        tcp_arg(client_pcb, context);
+        tcp_recv(client_pcb, waitingRecvClbk);
+        tcp_err(client_pcb, waitingErrClbk);
+        return ERR_OK;
+    }
+    return clientAdopt(context, client_pcb);
+}
+
+int GeigerGen3NetworkLayer::connect(const char* ssid, const char* pwd, uint32_t timeoutMs) noexcept{
+    if(int err { cyw43_arch_wifi_connect_async(ssid, pwd, CYW43_AUTH_WPA2_MIXED_PSK) }; err != 0){
+        cerr << "Connect : Error: " << err << '\n';
+        return err;
+    }
 
-    string             msg      { "ready\n" };
-    context->toSendLen = msg.size() <= context->bufferSend.size() ? msg.size() : context->bufferSend.size();
-    copy_n(msg.data(),  context->toSendLen, context->bufferSend.data());
-    return serverSendData(context, context->client_pcb);
+    // poll the link instead of blocking on it, so every phase is timed and failures return early
+    uint64_t deadline { Timebase::getMicros() + timeoutMs * 1'000ULL };
+    while(Timebase::getMicros() < deadline){
+        int status { cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA) };
+        switch(status){
+            case CYW43_LINK_NOIP:
+                BootTimeline::mark(BootTimeline::Phase::ASSOCIATION);
+            break;
+            case CYW43_LINK_UP:
+                BootTimeline::mark(BootTimeline::Phase::ASSOCIATION);
+                BootTimeline::mark(BootTimeline::Phase::DHCP);
+                return 0;
+            case CYW43_LINK_FAIL:
+            case CYW43_LINK_NONET:
+            case CYW43_LINK_BADAUTH:
+                cerr << "Connect : Error: link status " << status << '\n';
+                return status;
+            default:
+            break;
+        }
+        sleep_ms(10);
+    }
+    return PICO_ERROR_TIMEOUT;
+}
+
+string GeigerGen3NetworkLayer::renderStats(void) noexcept{
+    return GeigerGen3::getStats().append(linkQuality.getStats()).append(Scheduler::getStats()).append(context.pending.getStats())
+                                 .append(getDisconnectStats()).append(SupplyMonitor::getStats())
+                                 .append(StreamSessions::getStats()).append(EntropyPool::getStats())
+                                 .append(SubsampleTiming::getStats()).append(Reservations::getStats())
+                                 .append(CoreIsolation::getStats()).append(AdaptiveExtraction::getStats());
+}
+
+void GeigerGen3NetworkLayer::prerenderStats(void *arg) noexcept{
+    static_cast<void>(arg);
+    // the heap high-water mark is sampled at the same pace
+    MemoryStats::sample();
+    string rendered { renderStats() };
+
+    // the receive callback reads the cache from the background irq
+    cyw43_arch_lwip_begin();
+    statsCache.swap(rendered);
+    statsTime    = Timebase::getMicros();
+    cyw43_arch_lwip_end();
+    statsPending = false;
 }
 
 int GeigerGen3NetworkLayer::service(void) noexcept{
     cerr << "Service\n";
+    // the background irq may already be running lwIP
+    cyw43_arch_lwip_begin();
     TcpPcb *pcb { tcp_new_ip_type(IPADDR_TYPE_ANY) };
     if(!pcb){
         cerr << "Service : Error: pcb creation\n";
         serverResult(&context, -1);
+        cyw43_arch_lwip_end();
         return 1;
     }
     ip_set_option(pcb, SOF_REUSEADDR); 
@@ -545,21 +3544,38 @@ int GeigerGen3NetworkLayer::service(void) noexcept{
     if(err_t err { tcp_bind(pcb, nullptr, TCP_PORT) }; err != ERR_OK){
         cerr << "Service : Error: bind to port : " <<  TCP_PORT << '\n';
         serverResult(&context, -1);
+        cyw43_arch_lwip_end();
         return 1;
     }
 
-    context.server_pcb = tcp_listen_with_backlog(pcb, 1);
+    context.server_pcb = tcp_listen_with_backlog(pcb, LISTEN_BACKLOG);
     if(!context.server_pcb) {
         cerr <<  "Service : Error: listen\n";
         if(pcb) tcp_close(pcb);
         serverResult(&context, -1);
+        cyw43_arch_lwip_end();
         return 1;
     }
     tcp_arg(context.server_pcb, &context);
+    tcp_accept(context.server_pcb, serverAccept);
+    cyw43_arch_lwip_end();
+    BootTimeline::mark(BootTimeline::Phase::LISTEN);
 
     for(;;){
-        tcp_accept(context.server_pcb, serverAccept);
-        sleep_ms(50);
+        // the statistics answer is rendered here, in idle time, rather than in the receive callback
+        if(!statsPending && Timebase::getMicros() - statsTime >= STATS_MAX_AGE / 2)
+            statsPending = Scheduler::submit(0, prerenderStats, nullptr, STATS_COST_US, true);
+        StatsHistory::schedule();
+        SupplyMonitor::schedule();
+        SubsampleTiming::schedule();
+        Reservations::schedule(GeigerGen3::cpmStats.getLastMinute() * AdaptiveExtraction::getBits() / 8);
+        // protocol v2 requests waiting for events complete here, as the pool fills
+        if(context.waitCount > 0){
+            cyw43_arch_lwip_begin();
+            serveWaiting(&context);
+            cyw43_arch_lwip_end();
+        }
+        Scheduler::runFor(IDLE_PERIOD_US);
     }
 }
 
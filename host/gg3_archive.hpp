@@ -0,0 +1,443 @@
+// -----------------------------------------------------------------
+// nuclear rng - generation 3
+// Copyright (C) 2023,2024  Gabriele Bonacini
+//
+// This program is distributed under dual license:
+// - Creative Commons Attribution-NonCommercial 4.0 International (CC BY-NC 4.0) License
+// for non commercial use, the license has the following terms:
+// * Attribution — You must give appropriate credit, provide a link to the license,
+// and indicate if changes were made. You may do so in any reasonable manner,
+// but not in any way that suggests the licensor endorses you or your use.
+// * NonCommercial — You must not use the material for commercial purposes.
+// A copy of the license it's available to the following address:
+// http://creativecommons.org/licenses/by-nc/4.0/
+// - For commercial use a specific license is available contacting the author.
+// -----------------------------------------------------------------
+
+// Raw event archive.
+//
+// Layout (little endian):
+//   FileHeader
+//   Block * n   : BlockHeader + payload of ( count - 1 ) varint pairs
+//   IndexEntry * n
+//   Footer
+//
+// In a block the first event is stored in the header, then each event is a
+// varint time delta followed by a zigzag varint residual of the roulette
+// delta against the one predicted by the block counter rate: the roulette
+// advances with the loop, so the residual is just the loop jitter.
+
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <array>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+
+namespace geigergen3 {
+
+    using std::array,
+          std::vector,
+          std::string,
+          std::runtime_error;
+
+    struct Event{
+        uint64_t  time;
+        uint32_t  roulette;
+    };
+
+    class Crc32{
+        public:
+            static uint32_t compute(const uint8_t* data, size_t len, uint32_t crc=0)     noexcept;
+
+        private:
+            static array<uint32_t, 256> makeTable(void)                                  noexcept;
+    };
+
+    array<uint32_t, 256> Crc32::makeTable(void) noexcept{
+        array<uint32_t, 256> table {};
+        for(uint32_t i{0}; i < table.size(); i++){
+            uint32_t value { i };
+            for(int bit{0}; bit < 8; bit++) value = ( value & 1 ) ? ( value >> 1 ) ^ 0xEDB88320U : value >> 1;
+            table[i] = value;
+        }
+        return table;
+    }
+
+    uint32_t Crc32::compute(const uint8_t* data, size_t len, uint32_t crc) noexcept{
+        static const array<uint32_t, 256> table { makeTable() };
+        crc = ~crc;
+        for(size_t i{0}; i < len; i++) crc = table[( crc ^ data[i] ) & 0xFF] ^ ( crc >> 8 );
+        return ~crc;
+    }
+
+    class Archive{
+        public:
+            static inline constexpr uint32_t  VERSION        { 1 },
+                                              BLOCK_EVENTS   { 4096 },
+                                              BLOCK_MAGIC    { 0x4B4C4247 },   // "GBLK"
+                                              FOOTER_MAGIC   { 0x58444947 };   // "GIDX"
+            static inline constexpr char      MAGIC[8]       { 'G', 'G', '3', 'A', 'R', 'C', 'H', '\0' };
+
+            struct FileHeader{
+                char      magic[8];
+                uint32_t  version,
+                          blockEvents;
+            };
+
+            struct BlockHeader{
+                uint32_t  magic,
+                          count;
+                uint64_t  firstIndex,
+                          firstTime;
+                uint32_t  firstRoulette,
+                          rateQ16,
+                          payloadLen,
+                          crc;
+            };
+
+            struct IndexEntry{
+                uint64_t  firstIndex,
+                          firstTime,
+                          offset;
+            };
+
+            struct Footer{
+                uint64_t  indexOffset,
+                          blocks,
+                          events;
+                uint32_t  crc,
+                          magic;
+            };
+
+            static void     putVarint(vector<uint8_t>& out, uint64_t value)                  noexcept;
+            static bool     getVarint(const uint8_t*& pos, const uint8_t* end, uint64_t& value) noexcept;
+            static uint64_t zigzag(int64_t value)                                             noexcept;
+            static int64_t  unzigzag(uint64_t value)                                          noexcept;
+            static uint32_t predict(uint64_t dt, uint32_t rateQ16)                            noexcept;
+    };
+
+    void Archive::putVarint(vector<uint8_t>& out, uint64_t value) noexcept{
+        while(value >= 0x80){
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    bool Archive::getVarint(const uint8_t*& pos, const uint8_t* end, uint64_t& value) noexcept{
+        value = 0;
+        for(unsigned int shift{0}; pos < end && shift < 64; shift += 7){
+            uint8_t byte { *pos++ };
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if(( byte & 0x80 ) == 0) return true;
+        }
+        return false;
+    }
+
+    uint64_t Archive::zigzag(int64_t value) noexcept{
+        return ( static_cast<uint64_t>(value) << 1 ) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    int64_t Archive::unzigzag(uint64_t value) noexcept{
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    uint32_t Archive::predict(uint64_t dt, uint32_t rateQ16) noexcept{
+        return static_cast<uint32_t>(( static_cast<unsigned __int128>(dt) * rateQ16 ) >> 16);
+    }
+
+    class ArchiveWriter{
+        public:
+            explicit ArchiveWriter(const string& path);
+            ~ArchiveWriter(void);
+
+            void      append(const Event& event);
+            void      close(void);
+            uint64_t  getEvents(void)  const  noexcept;
+
+        private:
+            FILE*                           file      { nullptr };
+            vector<Event>                   pending;
+            vector<Archive::IndexEntry>     index;
+            vector<uint8_t>                 payload;
+            uint64_t                        events    { 0 },
+                                            offset    { 0 };
+
+            void      flushBlock(void);
+            void      write(const void* data, size_t len);
+    };
+
+    ArchiveWriter::ArchiveWriter(const string& path)
+        : file{ fopen(path.c_str(), "wb") }
+    {
+        if(file == nullptr) throw runtime_error("ArchiveWriter: can't create " + path);
+        Archive::FileHeader header {};
+        std::copy_n(Archive::MAGIC, sizeof(header.magic), header.magic);
+        header.version     = Archive::VERSION;
+        header.blockEvents = Archive::BLOCK_EVENTS;
+        write(&header, sizeof(header));
+        pending.reserve(Archive::BLOCK_EVENTS);
+    }
+
+    ArchiveWriter::~ArchiveWriter(void){
+        try{ close(); }catch(...){}
+    }
+
+    void ArchiveWriter::write(const void* data, size_t len){
+        if(fwrite(data, 1, len, file) != len) throw runtime_error("ArchiveWriter: write error");
+        offset += len;
+    }
+
+    void ArchiveWriter::append(const Event& event){
+        if(file == nullptr) throw runtime_error("ArchiveWriter: archive closed");
+        if(!pending.empty() && event.time < pending.back().time) throw runtime_error("ArchiveWriter: time goes backward");
+        pending.push_back(event);
+        if(pending.size() == Archive::BLOCK_EVENTS) flushBlock();
+    }
+
+    void ArchiveWriter::flushBlock(void){
+        if(pending.empty()) return;
+
+        const Event& first { pending.front() },
+                     last  { pending.back() };
+        uint64_t     span  { last.time - first.time },
+                     turns { 0 };
+        // a block can last longer than a counter wrap at low activity: sum the modular steps
+        for(size_t i{1}; i < pending.size(); i++) turns += static_cast<uint32_t>(pending[i].roulette - pending[i - 1].roulette);
+        uint32_t     rate  { span > 0 ? static_cast<uint32_t>(std::min<unsigned __int128>(
+                                            ( static_cast<unsigned __int128>(turns) << 16 ) / span, UINT32_MAX)) : 0 };
+
+        payload.clear();
+        for(size_t i{1}; i < pending.size(); i++){
+            uint64_t dt   { pending[i].time - pending[i - 1].time };
+            uint32_t dr   { pending[i].roulette - pending[i - 1].roulette };
+            Archive::putVarint(payload, dt);
+            Archive::putVarint(payload, Archive::zigzag(static_cast<int64_t>(dr) - Archive::predict(dt, rate)));
+        }
+
+        Archive::BlockHeader header { Archive::BLOCK_MAGIC, static_cast<uint32_t>(pending.size()), events, first.time,
+                                      first.roulette, rate, static_cast<uint32_t>(payload.size()),
+                                      Crc32::compute(payload.data(), payload.size()) };
+        index.push_back({ events, first.time, offset });
+        write(&header, sizeof(header));
+        write(payload.data(), payload.size());
+
+        events += pending.size();
+        pending.clear();
+    }
+
+    void ArchiveWriter::close(void){
+        if(file == nullptr) return;
+        flushBlock();
+
+        Archive::Footer footer { offset, index.size(), events,
+                                 Crc32::compute(reinterpret_cast<const uint8_t*>(index.data()), index.size() * sizeof(Archive::IndexEntry)),
+                                 Archive::FOOTER_MAGIC };
+        write(index.data(), index.size() * sizeof(Archive::IndexEntry));
+        write(&footer, sizeof(footer));
+
+        int ret { fclose(file) };
+        file = nullptr;
+        if(ret != 0) throw runtime_error("ArchiveWriter: close error");
+    }
+
+    uint64_t ArchiveWriter::getEvents(void) const noexcept{
+        return events + pending.size();
+    }
+
+    class ArchiveReader{
+        public:
+            explicit ArchiveReader(const string& path);
+            ~ArchiveReader(void);
+
+            ArchiveReader(const ArchiveReader&)             = delete;
+            ArchiveReader& operator=(const ArchiveReader&)  = delete;
+
+            uint64_t  getEvents(void)                                   const  noexcept;
+            size_t    getBlocks(void)                                   const  noexcept;
+            uint64_t  getFirstTime(void)                                const  noexcept;
+            uint64_t  getLastTime(void)                                 const;
+            size_t    findBlockByIndex(uint64_t eventIndex)             const  noexcept;
+            size_t    findBlockByTime(uint64_t time)                    const  noexcept;
+            uint64_t  findIndexByTime(uint64_t time)                    const;
+            void      decodeBlock(size_t block, vector<Event>& out)     const;
+            Event     at(uint64_t eventIndex)                           const;
+            size_t    getFileSize(void)                                 const  noexcept;
+
+            template<typename F>
+            void      forEach(uint64_t from, uint64_t to, F func)       const;
+
+        private:
+            int                              fd       { -1 };
+            const uint8_t*                   base     { nullptr };
+            size_t                           len      { 0 };
+            // copied out of the mapping: entries in the file have no alignment guarantee
+            vector<Archive::IndexEntry>      index;
+            Archive::Footer                  footer   {};
+            uint32_t                         blockEvents { 0 };
+
+            void      release(void)                                            noexcept;
+    };
+
+    ArchiveReader::ArchiveReader(const string& path)
+        : fd{ open(path.c_str(), O_RDONLY) }
+    {
+        if(fd < 0) throw runtime_error("ArchiveReader: can't open " + path);
+
+        struct stat st {};
+        if(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Archive::FileHeader) + sizeof(Archive::Footer)){
+            ::close(fd);
+            throw runtime_error("ArchiveReader: truncated archive " + path);
+        }
+        len = static_cast<size_t>(st.st_size);
+
+        void* map { mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0) };
+        if(map == MAP_FAILED){
+            ::close(fd);
+            throw runtime_error("ArchiveReader: can't map " + path);
+        }
+        base = static_cast<const uint8_t*>(map);
+        madvise(map, len, MADV_RANDOM);
+
+        Archive::FileHeader header {};
+        std::memcpy(&header, base, sizeof(header));
+        std::memcpy(&footer, base + len - sizeof(footer), sizeof(footer));
+        // sizes checked one by one, a corrupted footer must not overflow the sum
+        size_t room { len - sizeof(footer) };
+        if(std::memcmp(header.magic, Archive::MAGIC, sizeof(header.magic)) != 0 || header.version != Archive::VERSION ||
+           header.blockEvents == 0 || footer.magic != Archive::FOOTER_MAGIC ||
+           footer.indexOffset < sizeof(header) || footer.indexOffset > room ||
+           footer.blocks != ( room - footer.indexOffset ) / sizeof(Archive::IndexEntry) ||
+           footer.indexOffset + footer.blocks * sizeof(Archive::IndexEntry) != room){
+            release();
+            throw runtime_error("ArchiveReader: not a valid archive " + path);
+        }
+        blockEvents = header.blockEvents;
+
+        if(Crc32::compute(base + footer.indexOffset, footer.blocks * sizeof(Archive::IndexEntry)) != footer.crc){
+            release();
+            throw runtime_error("ArchiveReader: corrupted index " + path);
+        }
+        index.resize(footer.blocks);
+        std::memcpy(index.data(), base + footer.indexOffset, footer.blocks * sizeof(Archive::IndexEntry));
+    }
+
+    ArchiveReader::~ArchiveReader(void){
+        release();
+    }
+
+    void ArchiveReader::release(void) noexcept{
+        if(base != nullptr) munmap(const_cast<uint8_t*>(base), len);
+        if(fd >= 0) ::close(fd);
+        base = nullptr;
+        fd   = -1;
+    }
+
+    uint64_t ArchiveReader::getEvents(void) const noexcept{
+        return footer.events;
+    }
+
+    size_t ArchiveReader::getBlocks(void) const noexcept{
+        return footer.blocks;
+    }
+
+    size_t ArchiveReader::getFileSize(void) const noexcept{
+        return len;
+    }
+
+    uint64_t ArchiveReader::getFirstTime(void) const noexcept{
+        return footer.blocks > 0 ? index[0].firstTime : 0;
+    }
+
+    uint64_t ArchiveReader::getLastTime(void) const{
+        if(footer.blocks == 0) return 0;
+        vector<Event> events;
+        decodeBlock(footer.blocks - 1, events);
+        return events.back().time;
+    }
+
+    size_t ArchiveReader::findBlockByIndex(uint64_t eventIndex) const noexcept{
+        auto pos { std::upper_bound(index.begin(), index.end(), eventIndex,
+                                    [](uint64_t value, const Archive::IndexEntry& entry){ return value < entry.firstIndex; }) };
+        return pos == index.begin() ? 0 : static_cast<size_t>(pos - index.begin() - 1);
+    }
+
+    size_t ArchiveReader::findBlockByTime(uint64_t time) const noexcept{
+        auto pos { std::upper_bound(index.begin(), index.end(), time,
+                                    [](uint64_t value, const Archive::IndexEntry& entry){ return value < entry.firstTime; }) };
+        return pos == index.begin() ? 0 : static_cast<size_t>(pos - index.begin() - 1);
+    }
+
+    uint64_t ArchiveReader::findIndexByTime(uint64_t time) const{
+        if(footer.blocks == 0) return 0;
+        size_t        block { findBlockByTime(time) };
+        vector<Event> events;
+        decodeBlock(block, events);
+        auto pos { std::lower_bound(events.begin(), events.end(), time,
+                                    [](const Event& event, uint64_t value){ return event.time < value; }) };
+        return index[block].firstIndex + static_cast<uint64_t>(pos - events.begin());
+    }
+
+    void ArchiveReader::decodeBlock(size_t block, vector<Event>& out) const{
+        if(block >= footer.blocks) throw runtime_error("ArchiveReader: block out of range");
+
+        Archive::BlockHeader header {};
+        uint64_t offset { index[block].offset };
+        if(offset < sizeof(Archive::FileHeader) || offset > footer.indexOffset || footer.indexOffset - offset < sizeof(header))
+            throw runtime_error("ArchiveReader: bad block offset");
+        std::memcpy(&header, base + offset, sizeof(header));
+
+        // the crc covers the payload only: the header is checked against the index before anything is decoded
+        const uint8_t *pos { base + offset + sizeof(header) };
+        if(header.magic != Archive::BLOCK_MAGIC || header.count == 0 || header.count > blockEvents ||
+           header.firstIndex != index[block].firstIndex || header.firstTime != index[block].firstTime ||
+           header.payloadLen > footer.indexOffset - offset - sizeof(header) ||
+           Crc32::compute(pos, header.payloadLen) != header.crc)
+            throw runtime_error("ArchiveReader: corrupted block " + std::to_string(block));
+        const uint8_t *end { pos + header.payloadLen };
+
+        out.resize(header.count);
+        out[0] = { header.firstTime, header.firstRoulette };
+        for(uint32_t i{1}; i < header.count; i++){
+            uint64_t dt       { 0 },
+                     residual { 0 };
+            if(!Archive::getVarint(pos, end, dt) || !Archive::getVarint(pos, end, residual))
+                throw runtime_error("ArchiveReader: truncated block " + std::to_string(block));
+            uint32_t dr { static_cast<uint32_t>(Archive::predict(dt, header.rateQ16) + Archive::unzigzag(residual)) };
+            out[i] = { out[i - 1].time + dt, out[i - 1].roulette + dr };
+        }
+    }
+
+    Event ArchiveReader::at(uint64_t eventIndex) const{
+        if(eventIndex >= footer.events) throw runtime_error("ArchiveReader: event out of range");
+        size_t        block { findBlockByIndex(eventIndex) };
+        vector<Event> events;
+        decodeBlock(block, events);
+        return events.at(eventIndex - index[block].firstIndex);
+    }
+
+    template<typename F>
+    void ArchiveReader::forEach(uint64_t from, uint64_t to, F func) const{
+        to = std::min(to, footer.events);
+        if(from >= to) return;
+        vector<Event> events;
+        for(size_t block { findBlockByIndex(from) }; block < footer.blocks && index[block].firstIndex < to; block++){
+            decodeBlock(block, events);
+            for(size_t i{0}; i < events.size(); i++){
+                uint64_t current { index[block].firstIndex + i };
+                if(current >= from && current < to) func(current, events[i]);
+            }
+        }
+    }
+
+} // End namespace
@@ -0,0 +1,134 @@
+// -----------------------------------------------------------------
+// nuclear rng - generation 3
+// Copyright (C) 2023,2024  Gabriele Bonacini
+//
+// This program is distributed under dual license:
+// - Creative Commons Attribution-NonCommercial 4.0 International (CC BY-NC 4.0) License
+// for non commercial use, the license has the following terms:
+// * Attribution — You must give appropriate credit, provide a link to the license,
+// and indicate if changes were made. You may do so in any reasonable manner,
+// but not in any way that suggests the licensor endorses you or your use.
+// * NonCommercial — You must not use the material for commercial purposes.
+// A copy of the license it's available to the following address:
+// http://creativecommons.org/licenses/by-nc/4.0/
+// - For commercial use a specific license is available contacting the author.
+// -----------------------------------------------------------------
+
+// Capture raw events into an archive.
+//
+//   gg3_capture <host> <port> <archive> [seconds]   poll the appliance "raw" export
+//   gg3_capture - <archive>                         convert "time:roulette" lines from stdin
+//   gg3_capture -i <archive>                        print archive summary
+
+#include "gg3_archive.hpp"
+#include "gg3_client.hpp"
+
+#include <csignal>
+#include <iostream>
+#include <chrono>
+#include <thread>
+
+using geigergen3::ArchiveWriter,
+      geigergen3::ArchiveReader,
+      geigergen3::ApplianceClient,
+      geigergen3::Event,
+      std::cerr,
+      std::cout,
+      std::string;
+
+namespace {
+
+    volatile std::sig_atomic_t  stopRequested { 0 };
+
+    void onSignal(int) noexcept{
+        stopRequested = 1;
+    }
+
+    bool parseEvent(const string& line, Event& event) noexcept{
+        size_t sep { line.find_first_of(":,") };
+        if(sep == string::npos) return false;
+        try{
+            event.time     = std::stoull(line.substr(0, sep));
+            event.roulette = static_cast<uint32_t>(std::stoul(line.substr(sep + 1)));
+        }catch(...){
+            return false;
+        }
+        return true;
+    }
+
+    void convert(ArchiveWriter& writer){
+        string line;
+        Event  event {};
+        while(!stopRequested && std::getline(std::cin, line))
+            if(parseEvent(line, event)) writer.append(event);
+    }
+
+    void capture(ApplianceClient& client, ArchiveWriter& writer, unsigned long seconds){
+        const auto    POLL     { std::chrono::milliseconds(500) };
+        const auto    deadline { std::chrono::steady_clock::now() + std::chrono::seconds(seconds) };
+        unsigned long lost     { 0 };
+
+        while(!stopRequested && ( seconds == 0 || std::chrono::steady_clock::now() < deadline )){
+            client.send("raw");
+            string        header { client.readLine() };
+            unsigned long count  { 0 },
+                          gone   { 0 };
+            if(sscanf(header.c_str(), "raw:%lu:%lu", &count, &gone) != 2)
+                throw std::runtime_error("gg3_capture: unexpected answer: " + header);
+
+            for(unsigned long i{0}; i < count; i++){
+                Event event {};
+                if(parseEvent(client.readLine(), event)) writer.append(event);
+            }
+            if(gone != lost){
+                cerr << "gg3_capture: appliance dropped " << gone - lost << " events\n";
+                lost = gone;
+            }
+            if(count < geigergen3::RAW_DRAIN_LEN) std::this_thread::sleep_for(POLL);
+        }
+    }
+
+    void info(const string& path){
+        ArchiveReader reader { path };
+        uint64_t      first  { reader.getFirstTime() },
+                      last   { reader.getLastTime() };
+        cout << "events : " << reader.getEvents()   << '\n'
+             << "blocks : " << reader.getBlocks()   << '\n'
+             << "bytes  : " << reader.getFileSize() << '\n'
+             << "time   : " << first << " - " << last << " us\n";
+        if(reader.getEvents() > 0)
+            cout << "bytes/event : " << static_cast<double>(reader.getFileSize()) / static_cast<double>(reader.getEvents()) << '\n';
+    }
+
+} // End namespace
+
+int main(int argc, char** argv){
+    try{
+        std::signal(SIGINT,  onSignal);
+        std::signal(SIGTERM, onSignal);
+
+        if(argc == 3 && string(argv[1]) == "-i"){
+            info(argv[2]);
+        }else if(argc == 3 && string(argv[1]) == "-"){
+            ArchiveWriter writer { argv[2] };
+            convert(writer);
+            writer.close();
+            cerr << "gg3_capture: " << writer.getEvents() << " events\n";
+        }else if(argc == 4 || argc == 5){
+            ApplianceClient client  { argv[1], argv[2] };
+            ArchiveWriter   writer  { argv[3] };
+            capture(client, writer, argc == 5 ? std::stoul(argv[4]) : 0);
+            writer.close();
+            cerr << "gg3_capture: " << writer.getEvents() << " events\n";
+        }else{
+            cerr << "Usage: " << argv[0] << " <host> <port> <archive> [seconds]\n"
+                 << "       " << argv[0] << " - <archive>\n"
+                 << "       " << argv[0] << " -i <archive>\n";
+            return 1;
+        }
+    }catch(const std::exception& ex){
+        cerr << ex.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
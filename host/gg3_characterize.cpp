@@ -0,0 +1,355 @@
+// -----------------------------------------------------------------
+// nuclear rng - generation 3
+// Copyright (C) 2023,2024  Gabriele Bonacini
+//
+// This program is distributed under dual license:
+// - Creative Commons Attribution-NonCommercial 4.0 International (CC BY-NC 4.0) License
+// for non commercial use, the license has the following terms:
+// * Attribution — You must give appropriate credit, provide a link to the license,
+// and indicate if changes were made. You may do so in any reasonable manner,
+// but not in any way that suggests the licensor endorses you or your use.
+// * NonCommercial — You must not use the material for commercial purposes.
+// A copy of the license it's available to the following address:
+// http://creativecommons.org/licenses/by-nc/4.0/
+// - For commercial use a specific license is available contacting the author.
+// -----------------------------------------------------------------
+
+// Source characterization from a raw event archive:
+//  - exponential fit of the inter-arrival times above a cutoff and KS distance;
+//  - dead time from the deficit of intervals below the cutoff;
+//  - rate drift over time windows;
+//  - FFT autocorrelation of intervals and of the extracted values, averaged over segments.
+//
+//   gg3_characterize [-t threads] [-w window_s] [-l lags] [-c cutoff_us] <archive>
+
+#include "gg3_archive.hpp"
+
+#include <unistd.h>
+
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include <array>
+#include <map>
+#include <algorithm>
+#include <numeric>
+
+using geigergen3::ArchiveReader,
+      geigergen3::Event,
+      std::cerr,
+      std::cout,
+      std::vector,
+      std::array,
+      std::string;
+
+namespace {
+
+    using Complex=std::complex<double>;
+
+    constexpr size_t     SEGMENT_BLOCKS  { 16 },
+                         KS_BINS         { 4096 },
+                         VALUES          { 256 };
+
+    struct Options{
+        unsigned int   threads   { std::max(1U, std::thread::hardware_concurrency()) };
+        double         window    { 3600.0 };
+        size_t         lags      { 32 };
+        double         cutoff    { 0.0 };
+        string         path;
+    };
+
+    struct Partial{
+        uint64_t                   intervals    { 0 },
+                                   minInterval  { UINT64_MAX },
+                                   tail         { 0 },
+                                   shortOnes    { 0 };
+        double                     sum          { 0.0 },
+                                   tailSum      { 0.0 };
+        vector<uint64_t>           ks;
+        array<uint64_t, VALUES>    values       {};
+        std::map<int64_t, uint64_t> windows;
+        vector<double>             acIntervals,
+                                   acValues;
+        uint64_t                   segments     { 0 };
+    };
+
+    void fft(vector<Complex>& data, bool inverse) noexcept{
+        const size_t n { data.size() };
+        for(size_t i{1}, j{0}; i < n; i++){
+            size_t bit { n >> 1 };
+            for(; j & bit; bit >>= 1) j ^= bit;
+            j ^= bit;
+            if(i < j) std::swap(data[i], data[j]);
+        }
+        for(size_t len{2}; len <= n; len <<= 1){
+            double  angle { 2 * M_PI / static_cast<double>(len) * ( inverse ? 1 : -1 ) };
+            Complex step  { std::cos(angle), std::sin(angle) };
+            for(size_t i{0}; i < n; i += len){
+                Complex w { 1.0 };
+                for(size_t k{0}; k < len / 2; k++){
+                    Complex u { data[i + k] },
+                            v { data[i + k + len / 2] * w };
+                    data[i + k]           = u + v;
+                    data[i + k + len / 2] = u - v;
+                    w *= step;
+                }
+            }
+        }
+        if(inverse) for(Complex& value : data) value /= static_cast<double>(n);
+    }
+
+    // normalized autocorrelation through Wiener-Khinchin, zero padded to avoid circular wrap
+    void autocorrelation(const vector<double>& series, size_t lags, vector<double>& acc) noexcept{
+        if(series.size() <= lags) return;
+        double mean { std::accumulate(series.begin(), series.end(), 0.0) / static_cast<double>(series.size()) };
+        size_t size { 1 };
+        while(size < series.size() * 2) size <<= 1;
+
+        vector<Complex> data(size);
+        for(size_t i{0}; i < series.size(); i++) data[i] = series[i] - mean;
+        fft(data, false);
+        for(Complex& value : data) value = std::norm(value);
+        fft(data, true);
+
+        if(data[0].real() <= 0.0) return;
+        for(size_t lag{1}; lag <= lags; lag++)
+            acc[lag - 1] += data[lag].real() / data[0].real() * static_cast<double>(series.size()) / static_cast<double>(series.size() - lag);
+    }
+
+    template<typename F>
+    void parallel(const ArchiveReader& reader, unsigned int threads, F func){
+        const size_t   blocks { reader.getBlocks() },
+                       step   { ( ( blocks / SEGMENT_BLOCKS + threads ) / threads ) * SEGMENT_BLOCKS };
+        vector<std::thread> workers;
+        for(size_t first{0}; first < blocks; first += step)
+            workers.emplace_back(func, first, std::min(blocks, first + step));
+        for(std::thread& worker : workers) worker.join();
+    }
+
+    // pass 1: everything that doesn't depend on the fitted rate
+    void firstPass(const ArchiveReader& reader, const Options& opts, size_t from, size_t to,
+                   Partial& part, vector<std::pair<Event, Event>>& edges){
+        vector<Event>  events;
+        vector<double> intervals,
+                       values;
+        int64_t        window  { -1 };
+        uint64_t       inWindow{ 0 };
+        part.acIntervals.assign(opts.lags, 0.0);
+        part.acValues.assign(opts.lags, 0.0);
+
+        for(size_t block{from}; block < to; block++){
+            reader.decodeBlock(block, events);
+            edges[block] = { events.front(), events.back() };
+
+            for(size_t i{0}; i < events.size(); i++){
+                part.values[events[i].roulette % VALUES]++;
+                if(int64_t current { static_cast<int64_t>(static_cast<double>(events[i].time) / 1e6 / opts.window) }; current != window){
+                    if(inWindow > 0) part.windows[window] += inWindow;
+                    window   = current;
+                    inWindow = 0;
+                }
+                inWindow++;
+                values.push_back(static_cast<double>(events[i].roulette % VALUES));
+                if(i == 0) continue;
+
+                uint64_t dt { events[i].time - events[i - 1].time };
+                part.intervals++;
+                part.sum += static_cast<double>(dt);
+                part.minInterval = std::min(part.minInterval, dt);
+                intervals.push_back(static_cast<double>(dt));
+            }
+
+            if(( block + 1 - from ) % SEGMENT_BLOCKS == 0 || block + 1 == to){
+                autocorrelation(intervals, opts.lags, part.acIntervals);
+                autocorrelation(values,    opts.lags, part.acValues);
+                part.segments++;
+                intervals.clear();
+                values.clear();
+            }
+        }
+        if(inWindow > 0) part.windows[window] += inWindow;
+    }
+
+    // pass 2: tail fit above the cutoff and the short interval count below it
+    void secondPass(const ArchiveReader& reader, double cutoff, double rate, size_t from, size_t to, Partial& part){
+        vector<Event> events;
+        part.ks.assign(KS_BINS, 0);
+        for(size_t block{from}; block < to; block++){
+            reader.decodeBlock(block, events);
+            for(size_t i{1}; i < events.size(); i++){
+                double dt { static_cast<double>(events[i].time - events[i - 1].time) };
+                if(dt < cutoff){
+                    part.shortOnes++;
+                    continue;
+                }
+                part.tail++;
+                part.tailSum += dt - cutoff;
+                if(rate > 0.0){
+                    double cdf { 1.0 - std::exp(-rate * ( dt - cutoff )) };
+                    part.ks[std::min(KS_BINS - 1, static_cast<size_t>(cdf * KS_BINS))]++;
+                }
+            }
+        }
+    }
+
+    void parseOptions(int argc, char** argv, Options& opts){
+        for(int opt; ( opt = getopt(argc, argv, "t:w:l:c:") ) != -1; ){
+            switch(opt){
+                case 't': opts.threads = std::max(1, std::stoi(optarg));                   break;
+                case 'w': opts.window  = std::stod(optarg);                                break;
+                case 'l': opts.lags    = static_cast<size_t>(std::max(1, std::stoi(optarg))); break;
+                case 'c': opts.cutoff  = std::stod(optarg);                                break;
+                default:  throw std::invalid_argument("bad option");
+            }
+        }
+        if(optind != argc - 1) throw std::invalid_argument("archive missing");
+        opts.path = argv[optind];
+    }
+
+} // End namespace
+
+int main(int argc, char** argv){
+    Options opts;
+    try{
+        parseOptions(argc, argv, opts);
+    }catch(const std::exception&){
+        cerr << "Usage: " << argv[0] << " [-t threads] [-w window_s] [-l lags] [-c cutoff_us] <archive>\n";
+        return 1;
+    }
+
+    try{
+        ArchiveReader reader { opts.path };
+        if(reader.getEvents() < 2){
+            cerr << "gg3_characterize: not enough events\n";
+            return 1;
+        }
+
+        vector<std::pair<Event, Event>> edges(reader.getBlocks());
+        vector<Partial>                 parts(reader.getBlocks());
+        parallel(reader, opts.threads, [&](size_t from, size_t to){ firstPass(reader, opts, from, to, parts[from], edges); });
+
+        Partial total;
+        total.acIntervals.assign(opts.lags, 0.0);
+        total.acValues.assign(opts.lags, 0.0);
+        vector<double> boundary;
+        for(size_t block{1}; block < edges.size(); block++)
+            boundary.push_back(static_cast<double>(edges[block].first.time - edges[block - 1].second.time));
+        for(double dt : boundary){
+            total.intervals++;
+            total.sum += dt;
+            total.minInterval = std::min(total.minInterval, static_cast<uint64_t>(dt));
+        }
+        for(const Partial& part : parts){
+            total.intervals  += part.intervals;
+            total.sum        += part.sum;
+            total.minInterval = std::min(total.minInterval, part.minInterval);
+            total.segments   += part.segments;
+            for(size_t i{0}; i < VALUES; i++) total.values[i] += part.values[i];
+            for(const auto& [window, count] : part.windows) total.windows[window] += count;
+            for(size_t lag{0}; lag < opts.lags && part.segments > 0; lag++){
+                total.acIntervals[lag] += part.acIntervals[lag];
+                total.acValues[lag]    += part.acValues[lag];
+            }
+        }
+
+        const double mean   { total.sum / static_cast<double>(total.intervals) },
+                     cutoff { opts.cutoff > 0.0 ? opts.cutoff : mean * 0.05 };
+
+        // the tail above the cutoff is still exponential with the same rate: fit it by maximum likelihood
+        vector<Partial> tails(reader.getBlocks());
+        parallel(reader, opts.threads, [&](size_t from, size_t to){ secondPass(reader, cutoff, 0.0, from, to, tails[from]); });
+        uint64_t tail     { 0 },
+                 shortOnes{ 0 };
+        double   tailSum  { 0.0 };
+        for(double dt : boundary){
+            if(dt < cutoff){
+                shortOnes++;
+            }else{
+                tail++;
+                tailSum += dt - cutoff;
+            }
+        }
+        for(const Partial& part : tails){ tail += part.tail; tailSum += part.tailSum; shortOnes += part.shortOnes; }
+        const double rate { tail > 0 && tailSum > 0.0 ? static_cast<double>(tail) / tailSum : 0.0 };
+
+        parallel(reader, opts.threads, [&](size_t from, size_t to){ tails[from] = Partial{}; secondPass(reader, cutoff, rate, from, to, tails[from]); });
+        vector<uint64_t> ks(KS_BINS, 0);
+        for(const Partial& part : tails) for(size_t i{0}; i < part.ks.size(); i++) ks[i] += part.ks[i];
+        double   ksDist { 0.0 };
+        uint64_t cumul  { 0 };
+        for(size_t i{0}; i < KS_BINS && tail > 0; i++){
+            cumul += ks[i];
+            ksDist = std::max(ksDist, std::fabs(static_cast<double>(cumul) / static_cast<double>(tail) - static_cast<double>(i + 1) / KS_BINS));
+        }
+        const double ksLimit { tail > 0 ? 1.36 / std::sqrt(static_cast<double>(tail)) + 1.0 / KS_BINS : 1.0 };
+
+        // without dead time the short intervals would be a (1 - exp(-rate * cutoff)) share
+        const double n        { static_cast<double>(total.intervals) },
+                     expected { n * ( 1.0 - std::exp(-rate * cutoff) ) },
+                     deficit  { std::max(0.0, expected - static_cast<double>(shortOnes)) },
+                     deadTime { rate > 0.0 && deficit < n ? -std::log(1.0 - deficit / n) / rate : 0.0 };
+
+        // drift: least squares on the per window rate, complete windows only
+        vector<std::pair<double, double>> windows;
+        for(const auto& [window, count] : total.windows)
+            if(window != total.windows.begin()->first && window != total.windows.rbegin()->first)
+                windows.push_back({ static_cast<double>(window) * opts.window, static_cast<double>(count) * 60.0 / opts.window });
+        double slope { 0.0 },
+               avg   { 0.0 };
+        if(windows.size() >= 2){
+            double sx { 0 }, sy { 0 }, sxx { 0 }, sxy { 0 }, m { static_cast<double>(windows.size()) };
+            for(const auto& [x, y] : windows){ sx += x; sy += y; sxx += x * x; sxy += x * y; }
+            avg   = sy / m;
+            slope = ( m * sxy - sx * sy ) / ( m * sxx - sx * sx );
+        }
+        const double driftDay { avg > 0.0 ? slope * 86400.0 / avg * 100.0 : 0.0 };
+
+        double chi { 0.0 };
+        const double perValue { static_cast<double>(reader.getEvents()) / VALUES };
+        for(uint64_t count : total.values) chi += ( static_cast<double>(count) - perValue ) * ( static_cast<double>(count) - perValue ) / perValue;
+
+        const double acLimit { 3.0 / std::sqrt(static_cast<double>(reader.getEvents())) };
+        size_t       acBadIntervals { 0 },
+                     acBadValues    { 0 };
+
+        cout << std::fixed << std::setprecision(6)
+             << "events              : " << reader.getEvents()                     << '\n'
+             << "mean interval (us)  : " << mean                                   << '\n'
+             << "min interval (us)   : " << total.minInterval                      << '\n'
+             << "cutoff (us)         : " << cutoff                                 << '\n'
+             << "fitted rate (cpm)   : " << rate * 60e6                            << '\n'
+             << "ks distance         : " << ksDist << " (limit " << ksLimit << ")" << '\n'
+             << "short intervals     : " << shortOnes << " (expected " << expected << ")\n"
+             << "dead time (us)      : " << deadTime                               << '\n'
+             << "windows             : " << windows.size() << " of " << opts.window << " s\n"
+             << "average rate (cpm)  : " << avg                                    << '\n'
+             << "rate drift (%/day)  : " << driftDay                               << '\n'
+             << "value chi2 (255 df) : " << chi                                    << '\n'
+             << "autocorrelation     : lag interval value (limit " << acLimit << ")\n";
+        for(size_t lag{0}; lag < opts.lags; lag++){
+            double ri { total.segments > 0 ? total.acIntervals[lag] / static_cast<double>(total.segments) : 0.0 },
+                   rv { total.segments > 0 ? total.acValues[lag]    / static_cast<double>(total.segments) : 0.0 };
+            if(std::fabs(ri) > acLimit) acBadIntervals++;
+            if(std::fabs(rv) > acLimit) acBadValues++;
+            cout << "  " << std::setw(4) << lag + 1 << "  " << std::setw(10) << ri << "  " << std::setw(10) << rv << '\n';
+        }
+
+        if(ksDist > ksLimit)
+            cout << "retune: intervals aren't exponential above the cutoff, check VTHRESHOLD/ZERO_THRESHOLD (noise or double counting)\n";
+        if(std::fabs(driftDay) > 5.0)
+            cout << "retune: rate drifts more than 5%/day, thresholds should follow source and sensor temperature\n";
+        if(deadTime > 0.0 && deadTime > mean * 0.01)
+            cout << "retune: dead time above 1% of the mean interval, shorten the pulse tail wait\n";
+        if(acBadIntervals > opts.lags / 10 + 1)
+            cout << "retune: intervals are correlated, check supply noise and detection thresholds\n";
+        if(acBadValues > opts.lags / 10 + 1 || chi > 255.0 + 5.0 * std::sqrt(2.0 * 255.0))
+            cout << "retune: extracted values are biased or correlated, reduce the bits taken from the register\n";
+    }catch(const std::exception& ex){
+        cerr << ex.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,162 @@
+// -----------------------------------------------------------------
+// nuclear rng - generation 3
+// Copyright (C) 2023,2024  Gabriele Bonacini
+//
+// This program is distributed under dual license:
+// - Creative Commons Attribution-NonCommercial 4.0 International (CC BY-NC 4.0) License
+// for non commercial use, the license has the following terms:
+// * Attribution — You must give appropriate credit, provide a link to the license,
+// and indicate if changes were made. You may do so in any reasonable manner,
+// but not in any way that suggests the licensor endorses you or your use.
+// * NonCommercial — You must not use the material for commercial purposes.
+// A copy of the license it's available to the following address:
+// http://creativecommons.org/licenses/by-nc/4.0/
+// - For commercial use a specific license is available contacting the author.
+// -----------------------------------------------------------------
+
+#pragma once
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+namespace geigergen3 {
+
+    using std::string,
+          std::vector,
+          std::runtime_error;
+
+    // events returned by one "raw" request at most (RawCapture::DRAIN_LEN in the firmware)
+    static inline constexpr unsigned long RAW_DRAIN_LEN { 64 };
+
+    class ApplianceClient{
+        public:
+            // timeoutMs, when set, bounds connect, send and each receive
+            ApplianceClient(const string& host, const string& port, unsigned long timeoutMs = 0);
+            ~ApplianceClient(void);
+
+            ApplianceClient(const ApplianceClient&)             = delete;
+            ApplianceClient& operator=(const ApplianceClient&)  = delete;
+
+            void      send(const string& cmd);
+            string    readLine(void);
+            string    readBytes(size_t len);
+            size_t    fill(uint8_t* out, size_t len);
+            int       getFd(void)                                 const  noexcept;
+            void      shutdown(void)                              const  noexcept;
+
+        private:
+            int       fd      { -1 };
+            string    pending;
+    };
+
+    ApplianceClient::ApplianceClient(const string& host, const string& port, unsigned long timeoutMs){
+        addrinfo hints {},
+                 *res  { nullptr };
+        hints.ai_family   = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if(int err { getaddrinfo(host.c_str(), port.c_str(), &hints, &res) }; err != 0)
+            throw runtime_error("ApplianceClient: " + host + ": " + gai_strerror(err));
+
+        for(addrinfo* ai { res }; ai != nullptr && fd < 0; ai = ai->ai_next){
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if(fd >= 0 && timeoutMs > 0){
+                timeval tmo { static_cast<time_t>(timeoutMs / 1'000), static_cast<suseconds_t>(timeoutMs % 1'000 * 1'000) };
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tmo, sizeof(tmo));
+            }
+            if(fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0){
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(res);
+        if(fd < 0) throw runtime_error("ApplianceClient: can't connect to " + host + ":" + port);
+
+        int one { 1 };
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if(readLine() != "ready") throw runtime_error("ApplianceClient: unexpected banner");
+    }
+
+    ApplianceClient::~ApplianceClient(void){
+        if(fd >= 0){
+            ::send(fd, "end", 3, MSG_NOSIGNAL);
+            ::close(fd);
+        }
+    }
+
+    void ApplianceClient::send(const string& cmd){
+        for(size_t sent{0}; sent < cmd.size(); ){
+            ssize_t len { ::send(fd, cmd.data() + sent, cmd.size() - sent, MSG_NOSIGNAL) };
+            if(len <= 0) throw runtime_error("ApplianceClient: send error");
+            sent += static_cast<size_t>(len);
+        }
+    }
+
+    string ApplianceClient::readLine(void){
+        for(;;){
+            if(size_t pos { pending.find('\n') }; pos != string::npos){
+                string line { pending.substr(0, pos) };
+                pending.erase(0, pos + 1);
+                return line;
+            }
+            char    buff[4096];
+            ssize_t len { ::recv(fd, buff, sizeof(buff), 0) };
+            if(len <= 0) throw runtime_error("ApplianceClient: connection closed");
+            pending.append(buff, static_cast<size_t>(len));
+        }
+    }
+
+    string ApplianceClient::readBytes(size_t len){
+        while(pending.size() < len){
+            char    buff[4096];
+            ssize_t got { ::recv(fd, buff, sizeof(buff), 0) };
+            if(got <= 0) throw runtime_error("ApplianceClient: connection closed");
+            pending.append(buff, static_cast<size_t>(got));
+        }
+        string data { pending.substr(0, len) };
+        pending.erase(0, len);
+        return data;
+    }
+
+    size_t ApplianceClient::fill(uint8_t* out, size_t len){
+        const size_t MAX_RESULT { 255 };
+        size_t       got        { 0 };
+        while(got == 0 && len > 0){
+            size_t batch { std::min<size_t>(len, RAW_DRAIN_LEN) };
+            string cmds;
+            for(size_t i{0}; i < batch; i++) cmds.append("req");
+            send(cmds);
+
+            // <random_number>:<generator_number>:<available_numbers>, MAX_RESULT + 1 when the pool is empty
+            for(size_t i{0}; i < batch; i++){
+                string line { readLine() };
+                size_t value { std::stoul(line.substr(0, line.find(':'))) };
+                if(value <= MAX_RESULT) out[got++] = static_cast<uint8_t>(value);
+            }
+            if(got == 0) usleep(200'000);
+        }
+        return got;
+    }
+
+    int ApplianceClient::getFd(void) const noexcept{
+        return fd;
+    }
+
+    // wakes up a thread blocked on the connection, from another one: its pending and next calls fail
+    void ApplianceClient::shutdown(void) const noexcept{
+        if(fd >= 0) ::shutdown(fd, SHUT_RDWR);
+    }
+
+} // End namespace
@@ -0,0 +1,383 @@
+// -----------------------------------------------------------------
+// nuclear rng - generation 3
+// Copyright (C) 2023,2024  Gabriele Bonacini
+//
+// This program is distributed under dual license:
+// - Creative Commons Attribution-NonCommercial 4.0 International (CC BY-NC 4.0) License
+// for non commercial use, the license has the following terms:
+// * Attribution — You must give appropriate credit, provide a link to the license,
+// and indicate if changes were made. You may do so in any reasonable manner,
+// but not in any way that suggests the licensor endorses you or your use.
+// * NonCommercial — You must not use the material for commercial purposes.
+// A copy of the license it's available to the following address:
+// http://creativecommons.org/licenses/by-nc/4.0/
+// - For commercial use a specific license is available contacting the author.
+// -----------------------------------------------------------------
+
+// Entropy Gathering Daemon on a Unix socket, backed by one persistent connection to the appliance.
+//
+//   gg3_egd <host> <port> <socket> [-b <buffer>] [-m <metrics_file>] [-i <seconds>]
+//
+// Commands (EGD): 0x00 bits available, 0x01 N non-blocking read, 0x02 N blocking read,
+// 0x03 MSB LSB N data write (accepted and dropped), 0x04 pid. Blocking readers are queued
+// and served in turn, a chunk each; non-blocking reads get nothing while somebody is queued.
+// SIGUSR1 dumps the metrics on stderr.
+
+#include "gg3_prefetch.hpp"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <algorithm>
+
+using geigergen3::Prefetcher,
+      std::cerr,
+      std::string,
+      std::vector,
+      std::deque,
+      std::map;
+
+namespace {
+
+    using Clock=std::chrono::steady_clock;
+
+    enum Command : uint8_t { AVAILABLE = 0x00, READ = 0x01, READ_BLOCKING = 0x02, WRITE = 0x03, PID = 0x04 };
+
+    const size_t                CHUNK           { 64 },
+                                MAX_PENDING     { 64 * 1024 },
+                                DEFAULT_BUFFER  { 64 * 1024 };
+
+    volatile std::sig_atomic_t  stopRequested   { 0 },
+                                dumpRequested   { 0 };
+
+    void onSignal(int sig) noexcept{
+        if(sig == SIGUSR1) dumpRequested = 1;
+        else               stopRequested = 1;
+    }
+
+    struct Client{
+        int                 fd          { -1 };
+        unsigned long       id          { 0 };
+        long                pid         { -1 };
+        string              in,
+                            out;
+        size_t              wanted      { 0 };
+        Clock::time_point   since       {};
+        uint64_t            bytes       { 0 },
+                            requests    { 0 },
+                            waits       { 0 },
+                            waitUs      { 0 },
+                            maxWaitUs   { 0 },
+                            dropped     { 0 };
+    };
+
+    struct Totals{
+        uint64_t            clients     { 0 },
+                            bytes       { 0 },
+                            requests    { 0 },
+                            waits       { 0 },
+                            waitUs      { 0 };
+    };
+
+    class EgdServer{
+        public:
+            EgdServer(Prefetcher& prefetcher, const string& path);
+            ~EgdServer(void);
+
+            void      service(const string& metricsFile, unsigned long intervalS);
+
+        private:
+            Prefetcher&                    prefetcher;
+            const string                   path;
+            int                            listenFd    { -1 };
+            unsigned long                  nextId      { 0 };
+            map<int, Client>               clients;
+            deque<int>                     waiters;
+            Totals                         totals;
+
+            void      accept(void)                             noexcept;
+            void      drop(Client& client)                     noexcept;
+            bool      receive(Client& client)                  noexcept;
+            bool      transmit(Client& client)                 noexcept;
+            bool      parse(Client& client)                    noexcept;
+            void      serveWaiters(void)                       noexcept;
+            string    metrics(void)                    const;
+    };
+
+    EgdServer::EgdServer(Prefetcher& pref, const string& pth)
+        : prefetcher{pref}, path{pth}
+    {
+        sockaddr_un addr {};
+        if(path.size() >= sizeof(addr.sun_path)) throw std::runtime_error("gg3_egd: socket path too long");
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(listenFd < 0) throw std::runtime_error("gg3_egd: socket: " + string(strerror(errno)));
+        unlink(path.c_str());
+        if(bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listenFd, SOMAXCONN) != 0){
+            close(listenFd);
+            throw std::runtime_error("gg3_egd: " + path + ": " + string(strerror(errno)));
+        }
+    }
+
+    EgdServer::~EgdServer(void){
+        for(auto& [fd, client] : clients) close(fd);
+        close(listenFd);
+        unlink(path.c_str());
+    }
+
+    void EgdServer::accept(void) noexcept{
+        for(int fd { accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC) }; fd >= 0;
+                fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)){
+            Client&   client  { clients[fd] };
+            ucred     cred    {};
+            socklen_t len     { sizeof(cred) };
+            client.fd = fd;
+            client.id = nextId++;
+            if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0) client.pid = cred.pid;
+            totals.clients++;
+        }
+    }
+
+    void EgdServer::drop(Client& client) noexcept{
+        waiters.erase(std::remove(waiters.begin(), waiters.end(), client.fd), waiters.end());
+        close(client.fd);
+        client.fd = -1;
+    }
+
+    bool EgdServer::receive(Client& client) noexcept{
+        char buff[512];
+        for(;;){
+            ssize_t len { recv(client.fd, buff, sizeof(buff), 0) };
+            if(len > 0){
+                client.in.append(buff, static_cast<size_t>(len));
+                if(client.in.size() > MAX_PENDING) return false;
+                continue;
+            }
+            return len < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR );
+        }
+    }
+
+    bool EgdServer::transmit(Client& client) noexcept{
+        while(!client.out.empty()){
+            ssize_t len { send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL) };
+            if(len < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            client.out.erase(0, static_cast<size_t>(len));
+        }
+        return true;
+    }
+
+    // one request at a time, as a client waits for each answer: the next is parsed when a blocking read is over
+    bool EgdServer::parse(Client& client) noexcept{
+        while(client.wanted == 0 && !client.in.empty()){
+            const uint8_t* req { reinterpret_cast<const uint8_t*>(client.in.data()) };
+            size_t         len { client.in.size() },
+                           used{ 0 };
+            switch(req[0]){
+                case AVAILABLE:
+                    {
+                        uint32_t bits { static_cast<uint32_t>(std::min<size_t>(prefetcher.getAvailable() * 8, UINT32_MAX)) };
+                        client.out.push_back(static_cast<char>(bits >> 24));
+                        client.out.push_back(static_cast<char>(bits >> 16));
+                        client.out.push_back(static_cast<char>(bits >> 8));
+                        client.out.push_back(static_cast<char>(bits));
+                        used = 1;
+                    }
+                break;
+                case READ:
+                    {
+                        if(len < 2) return true;
+                        uint8_t data[255];
+                        size_t  got  { waiters.empty() ? prefetcher.take(data, req[1]) : 0 };
+                        client.out.push_back(static_cast<char>(got));
+                        client.out.append(reinterpret_cast<char*>(data), got);
+                        client.bytes += got;
+                        totals.bytes += got;
+                        used = 2;
+                    }
+                break;
+                case READ_BLOCKING:
+                    if(len < 2) return true;
+                    used = 2;
+                    if(req[1] > 0){
+                        client.wanted = req[1];
+                        client.since  = Clock::now();
+                        waiters.push_back(client.fd);
+                    }
+                break;
+                case WRITE:
+                    if(len < 4 || len < 4U + req[3]) return true;
+                    client.dropped += req[3];
+                    used = 4U + req[3];
+                break;
+                case PID:
+                    {
+                        string pid { std::to_string(getpid()) };
+                        client.out.push_back(static_cast<char>(pid.size()));
+                        client.out.append(pid);
+                        used = 1;
+                    }
+                break;
+                default:
+                    return false;
+            }
+            client.in.erase(0, used);
+            client.requests++;
+            totals.requests++;
+        }
+        return true;
+    }
+
+    // round robin, a chunk per turn: a large request doesn't hold up the small ones queued behind it
+    void EgdServer::serveWaiters(void) noexcept{
+        while(!waiters.empty()){
+            Client&  client { clients[waiters.front()] };
+            uint8_t  data[CHUNK];
+            size_t   got    { prefetcher.take(data, std::min(CHUNK, client.wanted)) };
+            if(got == 0) return;
+
+            waiters.pop_front();
+            client.out.append(reinterpret_cast<char*>(data), got);
+            client.bytes  += got;
+            totals.bytes  += got;
+            client.wanted -= got;
+            if(client.wanted > 0){
+                waiters.push_back(client.fd);
+                continue;
+            }
+            uint64_t waitUs { static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - client.since).count()) };
+            client.waits++;
+            client.waitUs    += waitUs;
+            client.maxWaitUs  = std::max(client.maxWaitUs, waitUs);
+            totals.waits++;
+            totals.waitUs    += waitUs;
+            if(!parse(client)) drop(client);
+        }
+    }
+
+    // Prometheus text format
+    string EgdServer::metrics(void) const{
+        std::ostringstream out;
+        out << "gg3_egd_buffer_bytes "      << prefetcher.getAvailable()  << '\n'
+            << "gg3_egd_buffer_capacity "   << prefetcher.getCapacity()   << '\n'
+            << "gg3_egd_fetched_bytes "     << prefetcher.getFetched()    << '\n'
+            << "gg3_egd_reconnects "        << prefetcher.getReconnects() << '\n'
+            << "gg3_egd_connected "         << ( prefetcher.isConnected() ? 1 : 0 ) << '\n'
+            << "gg3_egd_clients "           << clients.size()   << '\n'
+            << "gg3_egd_clients_total "     << totals.clients   << '\n'
+            << "gg3_egd_waiters "           << waiters.size()   << '\n'
+            << "gg3_egd_served_bytes "      << totals.bytes     << '\n'
+            << "gg3_egd_requests "          << totals.requests  << '\n'
+            << "gg3_egd_waits "             << totals.waits     << '\n'
+            << "gg3_egd_wait_us "           << totals.waitUs    << '\n';
+        for(const auto& [fd, client] : clients){
+            string labels { "{client=\"" + std::to_string(client.id) + "\",pid=\"" + std::to_string(client.pid) + "\"} " };
+            out << "gg3_egd_client_bytes"       << labels << client.bytes     << '\n'
+                << "gg3_egd_client_requests"    << labels << client.requests  << '\n'
+                << "gg3_egd_client_waits"       << labels << client.waits     << '\n'
+                << "gg3_egd_client_wait_us"     << labels << client.waitUs    << '\n'
+                << "gg3_egd_client_max_wait_us" << labels << client.maxWaitUs << '\n'
+                << "gg3_egd_client_dropped"     << labels << client.dropped   << '\n';
+        }
+        return out.str();
+    }
+
+    void EgdServer::service(const string& metricsFile, unsigned long intervalS){
+        auto         nextMetrics { Clock::now() + std::chrono::seconds(intervalS) };
+        vector<int>  order;
+        while(stopRequested == 0){
+            vector<pollfd> fds { { listenFd, POLLIN, 0 }, { prefetcher.getEventFd(), POLLIN, 0 } };
+            order.clear();
+            for(const auto& [fd, client] : clients){
+                fds.push_back({ fd, static_cast<short>(POLLIN | ( client.out.empty() ? 0 : POLLOUT )), 0 });
+                order.push_back(fd);
+            }
+            if(poll(fds.data(), fds.size(), 1'000) < 0 && errno != EINTR)
+                throw std::runtime_error("gg3_egd: poll: " + string(strerror(errno)));
+
+            if(fds[0].revents & POLLIN) accept();
+            if(fds[1].revents & POLLIN) prefetcher.clearEvent();
+            // queued readers first: they asked before anything read in this round
+            serveWaiters();
+
+            for(size_t i{0}; i < order.size(); i++){
+                Client& client { clients[order[i]] };
+                short   events { fds[i + 2].revents };
+                if(client.fd < 0) continue;
+                bool    alive  { ( events & ( POLLERR | POLLNVAL ) ) == 0 };
+                if(alive && ( events & ( POLLIN | POLLHUP ) )) alive = receive(client) && parse(client);
+                if(alive) alive = transmit(client);
+                if(!alive && client.fd >= 0) drop(client);
+            }
+            for(auto it { clients.begin() }; it != clients.end(); )
+                it = it->second.fd < 0 ? clients.erase(it) : std::next(it);
+
+            if(dumpRequested != 0){
+                dumpRequested = 0;
+                cerr << metrics();
+            }
+            if(!metricsFile.empty() && Clock::now() >= nextMetrics){
+                nextMetrics = Clock::now() + std::chrono::seconds(intervalS);
+                string        tmp  { metricsFile + ".tmp" };
+                std::ofstream file { tmp, std::ios::trunc };
+                file << metrics();
+                file.close();
+                if(!file || rename(tmp.c_str(), metricsFile.c_str()) != 0) cerr << "gg3_egd: can't write " << metricsFile << '\n';
+            }
+        }
+    }
+
+} // End namespace
+
+int main(int argc, char** argv){
+    size_t         buffer      { DEFAULT_BUFFER };
+    string         metricsFile;
+    unsigned long  intervalS   { 10 };
+    try{
+        for(int opt{0}; ( opt = getopt(argc, argv, "b:m:i:") ) != -1; ){
+            switch(opt){
+                case 'b': buffer      = std::stoul(optarg);                    break;
+                case 'm': metricsFile = optarg;                                break;
+                case 'i': intervalS   = std::max(1UL, std::stoul(optarg));     break;
+                default:  optind      = argc + 1;
+            }
+        }
+    }catch(const std::exception& ex){
+        cerr << "gg3_egd: " << ex.what() << '\n';
+        return 1;
+    }
+    if(argc - optind != 3){
+        cerr << "Usage: " << argv[0] << " <host> <port> <socket> [-b <buffer>] [-m <metrics_file>] [-i <seconds>]\n";
+        return 1;
+    }
+
+    try{
+        std::signal(SIGINT,  onSignal);
+        std::signal(SIGTERM, onSignal);
+        std::signal(SIGUSR1, onSignal);
+        std::signal(SIGPIPE, SIG_IGN);
+
+        Prefetcher prefetcher { argv[optind], argv[optind + 1], buffer };
+        EgdServer  server     { prefetcher, argv[optind + 2] };
+        server.service(metricsFile, intervalS);
+    }catch(const std::exception& ex){
+        cerr << ex.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,315 @@
+// -----------------------------------------------------------------
+// nuclear rng - generation 3
+// Copyright (C) 2023,2024  Gabriele Bonacini
+//
+// This program is distributed under dual license:
+// - Creative Commons Attribution-NonCommercial 4.0 International (CC BY-NC 4.0) License
+// for non commercial use, the license has the following terms:
+// * Attribution — You must give appropriate credit, provide a link to the license,
+// and indicate if changes were made. You may do so in any reasonable manner,
+// but not in any way that suggests the licensor endorses you or your use.
+// * NonCommercial — You must not use the material for commercial purposes.
+// A copy of the license it's available to the following address:
+// http://creativecommons.org/licenses/by-nc/4.0/
+// - For commercial use a specific license is available contacting the author.
+// -----------------------------------------------------------------
+
+// Load generator for the appliance or gg3_netsim: answers per second, empty answers and latency per request.
+//
+//   gg3_load <host> <port> [-p <pattern>] [-c <clients>] [-d <seconds>] [-b <batch>] [-w <wait_ms>] [-q <sample_ms>] [-j]
+//
+// Patterns: single (one "req" at a time), pipelined (batches of "req", the default), bulk (protocol v2
+// byte frames of <batch> bytes, up to 1024), stream (a stream session, one "sbk" at a time).
+// The pool length is sampled with "mem" every <sample_ms> on the text patterns; -j prints a JSON report.
+
+#include "gg3_client.hpp"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+
+using geigergen3::ApplianceClient,
+      std::cerr,
+      std::cout,
+      std::string,
+      std::vector;
+
+namespace {
+
+    using Clock=std::chrono::steady_clock;
+
+    enum class Pattern { SINGLE, PIPELINED, BULK, STREAM };
+
+    struct Options{
+        Pattern           pattern   { Pattern::PIPELINED };
+        unsigned long     seconds   { 10 },
+                          batch     { 16 },
+                          waitMs    { 0 },
+                          sampleMs  { 250 };
+    };
+
+    struct Result{
+        vector<uint64_t>  latencies,
+                          connects;
+        vector<double>    queue;
+        unsigned long     requests  { 0 },
+                          bytes     { 0 },
+                          empty     { 0 },
+                          failures  { 0 },
+                          capacity  { 0 };
+    };
+
+    const unsigned long   MAX_RESULT     { 255 },
+                          MAX_BULK       { 1024 },
+                          HEADER_LEN     { 8 };
+    const unsigned char   FRAME_BYTES    { 1 },
+                          STATUS_OK      { 0 },
+                          STATUS_PARTIAL { 1 };
+
+    uint64_t elapsedUs(Clock::time_point begin) noexcept{
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - begin).count());
+    }
+
+    // "queue:<len>:<max>:<capacity>" closes the "mem" answer
+    void sampleQueue(ApplianceClient& appliance, Result& result){
+        appliance.send("mem");
+        string line { appliance.readLine() };
+        size_t pos  { line.rfind("queue:") };
+        if(pos == string::npos) return;
+        string fields { line.substr(pos + 6) };
+        result.queue.push_back(std::stod(fields.substr(0, fields.find(':'))));
+        result.capacity = std::stoul(fields.substr(fields.rfind(':') + 1));
+    }
+
+    string hex12(unsigned long value){
+        char buff[16];
+        snprintf(buff, sizeof(buff), "%012lx", value);
+        return buff;
+    }
+
+    string bytesFrame(unsigned short id, unsigned long count, unsigned long waitMs){
+        string frame(HEADER_LEN + 4, '\0');
+        frame[0]  = static_cast<char>(id & 0xff);
+        frame[1]  = static_cast<char>(id >> 8);
+        frame[2]  = static_cast<char>(FRAME_BYTES);
+        frame[4]  = 4;
+        frame[8]  = static_cast<char>(count & 0xff);
+        frame[9]  = static_cast<char>(count >> 8);
+        frame[10] = static_cast<char>(waitMs & 0xff);
+        frame[11] = static_cast<char>(waitMs >> 8);
+        return frame;
+    }
+
+    void client(const string& host, const string& port, const Options& options, Result& result){
+        try{
+            auto            connect   { Clock::now() };
+            ApplianceClient appliance { host, port };
+            result.connects.push_back(elapsedUs(connect));
+
+            auto            deadline  { Clock::now() + std::chrono::seconds(options.seconds) },
+                            sample    { Clock::now() };
+            string          token;
+            unsigned long   acked     { 0 };
+            unsigned short  id        { 0 };
+
+            if(options.pattern == Pattern::STREAM){
+                // the token comes from the pool: right after boot it may have to wait for it
+                string line;
+                do{
+                    if(!line.empty()) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    appliance.send("sop");
+                    line = appliance.readLine();
+                }while(line == "sop:wait" && Clock::now() < deadline);
+                if(line.compare(0, 4, "sop:") != 0 || line == "sop:wait") throw std::runtime_error("unexpected answer: " + line);
+                token = line.substr(4);
+            }else if(options.pattern == Pattern::BULK){
+                sampleQueue(appliance, result);
+                appliance.send("bv2");
+                if(appliance.readLine() != "bv2") throw std::runtime_error("protocol v2 not available");
+            }
+
+            while(Clock::now() < deadline){
+                if(options.pattern != Pattern::BULK && Clock::now() >= sample){
+                    sampleQueue(appliance, result);
+                    sample = Clock::now() + std::chrono::milliseconds(options.sampleMs);
+                }
+                auto begin { Clock::now() };
+                switch(options.pattern){
+                    case Pattern::SINGLE:
+                    case Pattern::PIPELINED:
+                        {
+                            unsigned long batch { options.pattern == Pattern::SINGLE ? 1 : options.batch };
+                            string        cmds;
+                            for(unsigned long i{0}; i < batch; i++) cmds.append("req");
+                            appliance.send(cmds);
+                            for(unsigned long i{0}; i < batch; i++){
+                                string line { appliance.readLine() };
+                                result.latencies.push_back(elapsedUs(begin));
+                                result.requests++;
+                                if(std::stoul(line.substr(0, line.find(':'))) > MAX_RESULT) result.empty++;
+                                else                                                         result.bytes++;
+                            }
+                        }
+                    break;
+                    case Pattern::BULK:
+                        {
+                            appliance.send(bytesFrame(id++, options.batch, options.waitMs));
+                            string        header  { appliance.readBytes(HEADER_LEN) };
+                            unsigned long len     { 0 };
+                            for(size_t i{HEADER_LEN}; i > 4; i--) len = len << 8 | static_cast<unsigned char>(header[i - 1]);
+                            unsigned char status  { static_cast<unsigned char>(header[3]) };
+                            appliance.readBytes(len);
+                            result.latencies.push_back(elapsedUs(begin));
+                            result.requests++;
+                            if(status != STATUS_OK && status != STATUS_PARTIAL) throw std::runtime_error("frame status " + std::to_string(status));
+                            if(len < options.batch) result.empty++;
+                            result.bytes += len;
+                        }
+                    break;
+                    case Pattern::STREAM:
+                        {
+                            appliance.send("sbk" + hex12(acked));
+                            string line { appliance.readLine() };
+                            result.latencies.push_back(elapsedUs(begin));
+                            result.requests++;
+                            size_t sep  { line.find(':', 4) };
+                            if(line.compare(0, 4, "sbk:") != 0 || sep == string::npos){
+                                if(line != "sbk:wait") throw std::runtime_error("unexpected answer: " + line);
+                                result.empty++;
+                                break;
+                            }
+                            acked         = std::stoul(line.substr(4, sep - 4), nullptr, 16);
+                            result.bytes += ( line.size() - sep - 1 ) / 2;
+                        }
+                    break;
+                }
+            }
+            if(options.pattern == Pattern::STREAM){
+                appliance.send("scl" + token);
+                appliance.readLine();
+            }
+        }catch(const std::exception& ex){
+            cerr << "gg3_load: " << ex.what() << '\n';
+            result.failures++;
+        }
+    }
+
+    uint64_t percentile(const vector<uint64_t>& sorted, double pct) noexcept{
+        if(sorted.empty()) return 0;
+        return sorted[std::min(sorted.size() - 1, static_cast<size_t>(pct / 100.0 * static_cast<double>(sorted.size())))];
+    }
+
+    string latencyJson(const vector<uint64_t>& sorted){
+        return "{\"p50\": "  + std::to_string(percentile(sorted, 50.0))
+             + ", \"p99\": "  + std::to_string(percentile(sorted, 99.0))
+             + ", \"p999\": " + std::to_string(percentile(sorted, 99.9))
+             + ", \"max\": "  + std::to_string(sorted.empty() ? 0 : sorted.back()) + "}";
+    }
+
+    const char* patternName(Pattern pattern) noexcept{
+        switch(pattern){
+            case Pattern::SINGLE:    return "single";
+            case Pattern::BULK:      return "bulk";
+            case Pattern::STREAM:    return "stream";
+            default:                 return "pipelined";
+        }
+    }
+
+} // End namespace
+
+int main(int argc, char** argv){
+    Options       options;
+    unsigned long clients { 1 };
+    bool          json    { false };
+    try{
+        for(int opt{0}; ( opt = getopt(argc, argv, "p:c:d:b:w:q:j") ) != -1; ){
+            switch(opt){
+                case 'p':
+                    {
+                        string name { optarg };
+                        if(name == "single")         options.pattern = Pattern::SINGLE;
+                        else if(name == "pipelined") options.pattern = Pattern::PIPELINED;
+                        else if(name == "bulk")      options.pattern = Pattern::BULK;
+                        else if(name == "stream")    options.pattern = Pattern::STREAM;
+                        else                         optind          = argc + 1;
+                    }
+                break;
+                case 'c': clients          = std::stoul(optarg);                    break;
+                case 'd': options.seconds  = std::stoul(optarg);                    break;
+                case 'b': options.batch    = std::max(1UL, std::stoul(optarg));     break;
+                case 'w': options.waitMs   = std::min(65'535UL, std::stoul(optarg)); break;
+                case 'q': options.sampleMs = std::max(1UL, std::stoul(optarg));     break;
+                case 'j': json             = true;                                  break;
+                default:  optind           = argc + 1;
+            }
+        }
+    }catch(const std::exception& ex){
+        cerr << "gg3_load: " << ex.what() << '\n';
+        return 1;
+    }
+    if(argc - optind != 2){
+        cerr << "Usage: " << argv[0] << " <host> <port> [-p single|pipelined|bulk|stream] [-c <clients>] [-d <seconds>] [-b <batch>] [-w <wait_ms>] [-q <sample_ms>] [-j]\n";
+        return 1;
+    }
+    if(options.pattern == Pattern::BULK) options.batch = std::min(options.batch, MAX_BULK);
+
+    vector<Result>      results(clients);
+    vector<std::thread> threads;
+    auto                begin   { Clock::now() };
+    for(unsigned long i{0}; i < clients; i++)
+        threads.emplace_back(client, string(argv[optind]), string(argv[optind + 1]), std::cref(options), std::ref(results[i]));
+    for(std::thread& thread : threads) thread.join();
+    double              elapsed { std::chrono::duration<double>(Clock::now() - begin).count() };
+
+    Result total;
+    for(const Result& result : results){
+        total.latencies.insert(total.latencies.end(), result.latencies.begin(), result.latencies.end());
+        total.connects.insert(total.connects.end(), result.connects.begin(), result.connects.end());
+        total.queue.insert(total.queue.end(), result.queue.begin(), result.queue.end());
+        total.requests += result.requests;
+        total.bytes    += result.bytes;
+        total.empty    += result.empty;
+        total.failures += result.failures;
+        total.capacity  = std::max(total.capacity, result.capacity);
+    }
+    std::sort(total.latencies.begin(), total.latencies.end());
+    std::sort(total.connects.begin(), total.connects.end());
+
+    double emptyRate { total.requests == 0 ? 0.0 : static_cast<double>(total.empty) / static_cast<double>(total.requests) },
+           queueMean { total.queue.empty() ? 0.0 : std::accumulate(total.queue.begin(), total.queue.end(), 0.0) / static_cast<double>(total.queue.size()) },
+           queueMin  { total.queue.empty() ? 0.0 : *std::min_element(total.queue.begin(), total.queue.end()) },
+           queueMax  { total.queue.empty() ? 0.0 : *std::max_element(total.queue.begin(), total.queue.end()) };
+
+    if(json){
+        cout << "{\"pattern\": \"" << patternName(options.pattern) << "\", \"clients\": " << clients
+             << ", \"batch\": " << options.batch << ", \"seconds\": " << elapsed
+             << ", \"requests\": " << total.requests << ", \"requests_per_s\": " << static_cast<double>(total.requests) / elapsed
+             << ", \"bytes\": " << total.bytes << ", \"bytes_per_s\": " << static_cast<double>(total.bytes) / elapsed
+             << ", \"empty\": " << total.empty << ", \"empty_rate\": " << emptyRate
+             << ", \"failures\": " << total.failures
+             << ", \"latency_us\": " << latencyJson(total.latencies)
+             << ", \"connect_us\": " << latencyJson(total.connects)
+             << ", \"queue\": {\"samples\": " << total.queue.size() << ", \"mean\": " << queueMean
+             << ", \"min\": " << queueMin << ", \"max\": " << queueMax << ", \"capacity\": " << total.capacity << "}}\n";
+    }else{
+        cout << "requests     : " << total.requests << " (" << static_cast<double>(total.requests) / elapsed << "/s)\n"
+             << "bytes        : " << total.bytes << " (" << static_cast<double>(total.bytes) / elapsed << "/s)\n"
+             << "empty        : " << total.empty << " (" << emptyRate * 100.0 << "%)\n"
+             << "failures     : " << total.failures << '\n'
+             << "latency (us) : p50 " << percentile(total.latencies, 50.0)
+             << " p99 "  << percentile(total.latencies, 99.0)
+             << " p999 " << percentile(total.latencies, 99.9)
+             << " max "  << ( total.latencies.empty() ? 0 : total.latencies.back() ) << '\n'
+             << "connect (us) : p50 " << percentile(total.connects, 50.0)
+             << " max "  << ( total.connects.empty() ? 0 : total.connects.back() ) << '\n'
+             << "queue        : mean " << queueMean << " min " << queueMin << " max " << queueMax
+             << " of " << total.capacity << " (" << total.queue.size() << " samples)\n";
+    }
+    return total.failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,188 @@
+// -----------------------------------------------------------------
+// nuclear rng - generation 3
+// Copyright (C) 2023,2024  Gabriele Bonacini
+//
+// This program is distributed under dual license:
+// - Creative Commons Attribution-NonCommercial 4.0 International (CC BY-NC 4.0) License
+// for non commercial use, the license has the following terms:
+// * Attribution — You must give appropriate credit, provide a link to the license,
+// and indicate if changes were made. You may do so in any reasonable manner,
+// but not in any way that suggests the licensor endorses you or your use.
+// * NonCommercial — You must not use the material for commercial purposes.
+// A copy of the license it's available to the following address:
+// http://creativecommons.org/licenses/by-nc/4.0/
+// - For commercial use a specific license is available contacting the author.
+// -----------------------------------------------------------------
+
+// The firmware network layer on a workstation: geiger_gen3.hpp built against the lwIP sources
+// with the project lwipopts.h, the Pico SDK replaced by the shims in sim/, packets through a TAP device.
+//
+//   gg3_netsim [-i <tap>] [-a <address>] [-n <netmask>] [-g <gateway>] [-c <cpm>] [-p <port>] [-t <idle_s>]
+//
+// The TAP device is created beforehand, e.g.:
+//   ip tuntap add gg3tap mode tap user $USER && ip addr add 192.168.77.1/24 dev gg3tap && ip link set gg3tap up
+
+#include "lwip/init.h"
+#include "lwip/netif.h"
+#include "lwip/etharp.h"
+#include "lwip/timeouts.h"
+#include "netif/ethernet.h"
+
+#include "geiger_gen3.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <stdexcept>
+
+using geigergen3::GeigerGen3,
+      geigergen3::GeigerGen3NetworkLayer,
+      geigergen3::SupplyMonitor,
+      std::cerr,
+      std::string;
+
+extern "C" {
+
+    u32_t sys_now(void){
+        return static_cast<u32_t>(gg3sim::nowNs() / 1'000'000);
+    }
+
+    // every lwIP entry point already runs under the cyw43 lock stand-in, as on the device
+    sys_prot_t sys_arch_protect(void){
+        gg3sim::lwipLock.lock();
+        return 0;
+    }
+
+    void sys_arch_unprotect(sys_prot_t){
+        gg3sim::lwipLock.unlock();
+    }
+
+}
+
+namespace {
+
+    const  size_t   FRAME_LEN   { 1'518 };
+    const  u8_t     HWADDR[]    { 0x02, 0x47, 0x47, 0x33, 0x00, 0x01 };
+
+    int             tapFd       { -1 };
+    netif           tapNetif    {};
+
+    int openTap(const string& name){
+        int fd { open("/dev/net/tun", O_RDWR | O_NONBLOCK) };
+        if(fd < 0) throw std::runtime_error("gg3_netsim: /dev/net/tun: " + string(strerror(errno)));
+
+        ifreq ifr {};
+        ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+        strncpy(ifr.ifr_name, name.c_str(), IFNAMSIZ - 1);
+        if(ioctl(fd, TUNSETIFF, &ifr) < 0){
+            close(fd);
+            throw std::runtime_error("gg3_netsim: " + name + ": " + string(strerror(errno)));
+        }
+        return fd;
+    }
+
+    err_t tapOutput(netif*, pbuf* pb){
+        u8_t  frame[FRAME_LEN];
+        u16_t len { pbuf_copy_partial(pb, frame, sizeof(frame), 0) };
+        return write(tapFd, frame, len) == len ? ERR_OK : ERR_IF;
+    }
+
+    err_t tapInit(netif* nif){
+        nif->name[0]    = 'g';
+        nif->name[1]    = 't';
+        nif->output     = etharp_output;
+        nif->linkoutput = tapOutput;
+        nif->mtu        = 1'500;
+        nif->hwaddr_len = ETH_HWADDR_LEN;
+        memcpy(nif->hwaddr, HWADDR, ETH_HWADDR_LEN);
+        nif->flags      = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_ETHERNET;
+        return ERR_OK;
+    }
+
+    // the cyw43 background irq: frames in and lwIP timers, both under the lock
+    void background(void){
+        u8_t   frame[FRAME_LEN];
+        pollfd pfd { tapFd, POLLIN, 0 };
+        for(;;){
+            poll(&pfd, 1, 1);
+            std::lock_guard<std::recursive_mutex> guard { gg3sim::lwipLock };
+            for(ssize_t len { read(tapFd, frame, sizeof(frame)) }; len > 0; len = read(tapFd, frame, sizeof(frame))){
+                pbuf *pb { pbuf_alloc(PBUF_RAW, static_cast<u16_t>(len), PBUF_POOL) };
+                if(pb == nullptr) break;
+                pbuf_take(pb, frame, static_cast<u16_t>(len));
+                if(tapNetif.input(pb, &tapNetif) != ERR_OK) pbuf_free(pb);
+            }
+            sys_check_timeouts();
+        }
+    }
+
+    void addInterface(const string& address, const string& netmask, const string& gateway){
+        ip4_addr_t addr {},
+                   mask {},
+                   gw   {};
+        if(!ip4addr_aton(address.c_str(), &addr) || !ip4addr_aton(netmask.c_str(), &mask) || !ip4addr_aton(gateway.c_str(), &gw))
+            throw std::runtime_error("gg3_netsim: invalid address");
+
+        std::lock_guard<std::recursive_mutex> guard { gg3sim::lwipLock };
+        lwip_init();
+        netif_add(&tapNetif, &addr, &mask, &gw, nullptr, tapInit, ethernet_input);
+        netif_set_default(&tapNetif);
+        netif_set_up(&tapNetif);
+        netif_set_link_up(&tapNetif);
+    }
+
+} // End namespace
+
+int main(int argc, char** argv){
+    const unsigned int  INPUT_PIN      { 31    },
+                        VTHRESHOLD     { 2500  },
+                        ZERO_THRESHOLD { 100   },
+                        READY_TIME     { 250 };
+    string              tap            { "gg3tap" },
+                        address        { "192.168.77.2" },
+                        netmask        { "255.255.255.0" },
+                        gateway        { "192.168.77.1" };
+    u16_t               port           { 6666 };
+    uint32_t            idleTimeoutS   { GeigerGen3NetworkLayer::IDLE_TIMEOUT_S };
+
+    try{
+        for(int opt{0}; ( opt = getopt(argc, argv, "i:a:n:g:c:p:t:") ) != -1; ){
+            switch(opt){
+                case 'i': tap          = optarg;                                        break;
+                case 'a': address      = optarg;                                        break;
+                case 'n': netmask      = optarg;                                        break;
+                case 'g': gateway      = optarg;                                        break;
+                case 'c': gg3sim::cpm  = std::stod(optarg);                             break;
+                case 'p': port         = static_cast<u16_t>(std::stoul(optarg));        break;
+                case 't': idleTimeoutS = static_cast<uint32_t>(std::stoul(optarg));     break;
+                default:
+                    cerr << "Usage: " << argv[0] << " [-i <tap>] [-a <address>] [-n <netmask>] [-g <gateway>] [-c <cpm>] [-p <port>] [-t <idle_s>]\n";
+                    return 1;
+            }
+        }
+
+        tapFd = openTap(tap);
+        addInterface(address, netmask, gateway);
+    }catch(const std::exception& ex){
+        cerr << ex.what() << '\n';
+        return 1;
+    }
+
+    GeigerGen3* gg3 { GeigerGen3::getInstance(INPUT_PIN, VTHRESHOLD, ZERO_THRESHOLD) };
+    gg3->init();
+    SupplyMonitor::init(SupplyMonitor::Mode::REJECT);
+    gg3->detect();
+    if(!GeigerGen3::waitReady(READY_TIME)) cerr << "Warning: detection not running yet.\n";
+
+    std::thread(background).detach();
+
+    GeigerGen3NetworkLayer networkLayer { port, idleTimeoutS };
+    return networkLayer.service();
+}
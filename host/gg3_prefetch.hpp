@@ -0,0 +1,200 @@
+// -----------------------------------------------------------------
+// nuclear rng - generation 3
+// Copyright (C) 2023,2024  Gabriele Bonacini
+//
+// This program is distributed under dual license:
+// - Creative Commons Attribution-NonCommercial 4.0 International (CC BY-NC 4.0) License
+// for non commercial use, the license has the following terms:
+// * Attribution — You must give appropriate credit, provide a link to the license,
+// and indicate if changes were made. You may do so in any reasonable manner,
+// but not in any way that suggests the licensor endorses you or your use.
+// * NonCommercial — You must not use the material for commercial purposes.
+// A copy of the license it's available to the following address:
+// http://creativecommons.org/licenses/by-nc/4.0/
+// - For commercial use a specific license is available contacting the author.
+// -----------------------------------------------------------------
+
+#pragma once
+
+#include "gg3_client.hpp"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <iostream>
+
+namespace geigergen3 {
+
+    // Appliance bytes for the local daemons: one persistent connection, reopened with backoff when it drops,
+    // keeps a ring topped up. Readers take bytes without blocking and wait on the event fd, which is
+    // signalled whenever new bytes land, so it fits a poll() loop.
+    class Prefetcher{
+        public:
+            static inline constexpr size_t              BATCH                { RAW_DRAIN_LEN };
+            static inline constexpr unsigned long       MIN_BACKOFF_MS       { 500 },
+                                                        MAX_BACKOFF_MS       { 30'000 },
+                                                        TIMEOUT_MS           { 5'000 };
+
+            Prefetcher(const string& host, const string& port, size_t capacity);
+            ~Prefetcher(void);
+
+            Prefetcher(const Prefetcher&)             = delete;
+            Prefetcher& operator=(const Prefetcher&)  = delete;
+
+            size_t    take(uint8_t* out, size_t len)              noexcept;
+            size_t    getAvailable(void)                  const   noexcept;
+            size_t    getCapacity(void)                   const   noexcept;
+            int       getEventFd(void)                    const   noexcept;
+            void      clearEvent(void)                    const   noexcept;
+            bool      isConnected(void)                   const   noexcept;
+            uint64_t  getFetched(void)                    const   noexcept;
+            uint64_t  getReconnects(void)                 const   noexcept;
+
+        private:
+            const string               host,
+                                       port;
+            vector<uint8_t>            ring;
+            size_t                     head       { 0 },
+                                       count      { 0 };
+            mutable std::mutex         lock;
+            std::condition_variable    room;
+            int                        eventFd    { -1 };
+            std::atomic<bool>          running    { true },
+                                       connected  { false };
+            std::atomic<uint64_t>      fetched    { 0 },
+                                       reconnects { 0 };
+            const ApplianceClient*     appliance  { nullptr };
+            std::thread                worker;
+
+            void      run(void)                                   noexcept;
+            bool      attach(const ApplianceClient* client)       noexcept;
+            void      store(const uint8_t* data, size_t len)      noexcept;
+    };
+
+    Prefetcher::Prefetcher(const string& hst, const string& prt, size_t capacity)
+        : host{hst}, port{prt}, ring(std::max(capacity, BATCH))
+    {
+        eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(eventFd < 0) throw runtime_error("Prefetcher: eventfd");
+        worker  = std::thread(&Prefetcher::run, this);
+    }
+
+    // a worker blocked in a request is woken up shutting the connection down; while connecting it's
+    // bounded by TIMEOUT_MS
+    Prefetcher::~Prefetcher(void){
+        {
+            std::lock_guard<std::mutex> guard { lock };
+            running = false;
+            if(appliance != nullptr) appliance->shutdown();
+        }
+        room.notify_all();
+        worker.join();
+        ::close(eventFd);
+    }
+
+    // publishes the connection in use to the destructor, false when it's already stopping
+    bool Prefetcher::attach(const ApplianceClient* client) noexcept{
+        std::lock_guard<std::mutex> guard { lock };
+        appliance = client;
+        return running;
+    }
+
+    void Prefetcher::run(void) noexcept{
+        unsigned long backoff { MIN_BACKOFF_MS };
+        while(running){
+            try{
+                ApplianceClient client { host, port, TIMEOUT_MS };
+                if(!attach(&client)) break;
+                connected = true;
+                backoff   = MIN_BACKOFF_MS;
+                try{
+                    while(running){
+                        size_t space { 0 };
+                        {
+                            // below half full again before asking: requests go out in full batches
+                            std::unique_lock<std::mutex> guard { lock };
+                            room.wait(guard, [this]{ return !running || count <= ring.size() / 2; });
+                            space = ring.size() - count;
+                        }
+                        if(!running) break;
+                        uint8_t batch[BATCH];
+                        size_t  got   { client.fill(batch, std::min(space, BATCH)) };
+                        store(batch, got);
+                    }
+                }catch(...){
+                    attach(nullptr);
+                    throw;
+                }
+                attach(nullptr);
+            }catch(const std::exception& ex){
+                if(running) std::cerr << "Prefetcher: " << ex.what() << '\n';
+            }
+            if(connected.exchange(false)) reconnects++;
+            std::unique_lock<std::mutex> guard { lock };
+            if(room.wait_for(guard, std::chrono::milliseconds(backoff), [this]{ return !running; })) break;
+            backoff = std::min(backoff * 2, MAX_BACKOFF_MS);
+        }
+    }
+
+    void Prefetcher::store(const uint8_t* data, size_t len) noexcept{
+        {
+            std::lock_guard<std::mutex> guard { lock };
+            len = std::min(len, ring.size() - count);
+            for(size_t i{0}; i < len; i++) ring[( head + count + i ) % ring.size()] = data[i];
+            count += len;
+        }
+        fetched += len;
+        uint64_t one { 1 };
+        if(write(eventFd, &one, sizeof(one)) < 0){ /* already signalled */ }
+    }
+
+    size_t Prefetcher::take(uint8_t* out, size_t len) noexcept{
+        std::lock_guard<std::mutex> guard { lock };
+        len = std::min(len, count);
+        for(size_t i{0}; i < len; i++) out[i] = ring[( head + i ) % ring.size()];
+        head   = ( head + len ) % ring.size();
+        count -= len;
+        if(count <= ring.size() / 2) room.notify_one();
+        return len;
+    }
+
+    size_t Prefetcher::getAvailable(void) const noexcept{
+        std::lock_guard<std::mutex> guard { lock };
+        return count;
+    }
+
+    size_t Prefetcher::getCapacity(void) const noexcept{
+        return ring.size();
+    }
+
+    int Prefetcher::getEventFd(void) const noexcept{
+        return eventFd;
+    }
+
+    void Prefetcher::clearEvent(void) const noexcept{
+        uint64_t value { 0 };
+        if(read(eventFd, &value, sizeof(value)) < 0){ /* nothing pending */ }
+    }
+
+    bool Prefetcher::isConnected(void) const noexcept{
+        return connected;
+    }
+
+    uint64_t Prefetcher::getFetched(void) const noexcept{
+        return fetched;
+    }
+
+    uint64_t Prefetcher::getReconnects(void) const noexcept{
+        return reconnects;
+    }
+
+} // End namespace
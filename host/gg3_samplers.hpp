@@ -0,0 +1,411 @@
+// -----------------------------------------------------------------
+// nuclear rng - generation 3
+// Copyright (C) 2023,2024  Gabriele Bonacini
+//
+// This program is distributed under dual license:
+// - Creative Commons Attribution-NonCommercial 4.0 International (CC BY-NC 4.0) License
+// for non commercial use, the license has the following terms:
+// * Attribution — You must give appropriate credit, provide a link to the license,
+// and indicate if changes were made. You may do so in any reasonable manner,
+// but not in any way that suggests the licensor endorses you or your use.
+// * NonCommercial — You must not use the material for commercial purposes.
+// A copy of the license it's available to the following address:
+// http://creativecommons.org/licenses/by-nc/4.0/
+// - For commercial use a specific license is available contacting the author.
+// -----------------------------------------------------------------
+
+// Non-uniform variates from appliance bits.
+//
+// BitPool hands out exactly the bits a sampler asks for and meters them.
+// Normal and exponential variates use a 32 bit word on the ziggurat fast path
+// (layer index, sign for the normal, 24 bit mantissa, no bit shared), discrete
+// distributions use Vose alias tables whose coin is compared lazily, bit by
+// bit, against the threshold: two bits on average.
+// With AVX2 the fast path of the batch generators runs four lanes at a time.
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <array>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace geigergen3 {
+
+    using std::array,
+          std::vector;
+
+    // Source: size_t fill(uint8_t* out, size_t len), at least one byte per call
+    template<typename Source>
+    class BitPool{
+        public:
+            explicit BitPool(Source& src, size_t chunk=4096);
+
+            uint32_t  bits(unsigned int count);
+            uint32_t  bit(void);
+            uint64_t  getConsumed(void)                     const  noexcept;
+            uint64_t  getBytesRead(void)                    const  noexcept;
+
+        private:
+            Source&          source;
+            vector<uint8_t>  buffer;
+            size_t           pos       { 0 },
+                             len       { 0 };
+            uint64_t         acc       { 0 },
+                             consumed  { 0 },
+                             bytesRead { 0 };
+            unsigned int     avail     { 0 };
+
+            uint8_t   nextByte(void);
+    };
+
+    template<typename Source>
+    BitPool<Source>::BitPool(Source& src, size_t chunk)
+        : source{src}, buffer(chunk)
+    {}
+
+    template<typename Source>
+    uint8_t BitPool<Source>::nextByte(void){
+        if(pos == len){
+            len = source.fill(buffer.data(), buffer.size());
+            pos = 0;
+            if(len == 0) throw std::runtime_error("BitPool: source exhausted");
+            bytesRead += len;
+        }
+        return buffer[pos++];
+    }
+
+    template<typename Source>
+    uint32_t BitPool<Source>::bits(unsigned int count){
+        while(avail < count){
+            acc   |= static_cast<uint64_t>(nextByte()) << avail;
+            avail += 8;
+        }
+        uint32_t ret { static_cast<uint32_t>(acc & ( ( 1ULL << count ) - 1 )) };
+        acc      >>= count;
+        avail     -= count;
+        consumed  += count;
+        return ret;
+    }
+
+    template<typename Source>
+    uint32_t BitPool<Source>::bit(void){
+        return bits(1);
+    }
+
+    template<typename Source>
+    uint64_t BitPool<Source>::getConsumed(void) const noexcept{
+        return consumed;
+    }
+
+    template<typename Source>
+    uint64_t BitPool<Source>::getBytesRead(void) const noexcept{
+        return bytesRead;
+    }
+
+    class Ziggurat{
+        public:
+            static const Ziggurat& normal(void)                       noexcept;
+            static const Ziggurat& exponential(void)                  noexcept;
+
+            unsigned int          layers;
+            double                r;
+            // boundaries x[0] (base strip pseudo width) > x[1] = r > ... > x[layers] = 0, density at each
+            vector<double>        x,
+                                  f;
+
+        private:
+            Ziggurat(unsigned int n, double tail, double area, double (*density)(double), double (*inverse)(double)) noexcept;
+    };
+
+    Ziggurat::Ziggurat(unsigned int n, double tail, double area, double (*density)(double), double (*inverse)(double)) noexcept
+        : layers{n}, r{tail}, x(n + 1), f(n + 1)
+    {
+        x[0] = area / density(r);
+        x[1] = r;
+        for(unsigned int i{1}; i < n - 1; i++) x[i + 1] = inverse(area / x[i] + density(x[i]));
+        x[n] = 0.0;
+        for(unsigned int i{0}; i <= n; i++) f[i] = density(x[i]);
+    }
+
+    const Ziggurat& Ziggurat::normal(void) noexcept{
+        static const Ziggurat table { 128, 3.442619855899, 9.91256303526217e-3,
+                                      [](double v){ return std::exp(-0.5 * v * v); },
+                                      [](double y){ return std::sqrt(-2.0 * std::log(y)); } };
+        return table;
+    }
+
+    const Ziggurat& Ziggurat::exponential(void) noexcept{
+        static const Ziggurat table { 256, 7.69711747013104972, 3.949659822581572e-3,
+                                      [](double v){ return std::exp(-v); },
+                                      [](double y){ return -std::log(y); } };
+        return table;
+    }
+
+    class AliasTable{
+        public:
+            explicit AliasTable(const vector<double>& weights, long offset=0);
+
+            static AliasTable poisson(double lambda);
+
+            size_t    size(void)                              const  noexcept;
+
+            template<typename Pool>
+            long      sample(Pool& pool)                      const;
+
+        private:
+            static inline constexpr uint64_t  ONE { 1ULL << 32 };
+
+            vector<uint64_t>  threshold;
+            vector<uint32_t>  alias;
+            long              base;
+            unsigned int      indexBits { 0 };
+    };
+
+    AliasTable::AliasTable(const vector<double>& weights, long offset)
+        : threshold(weights.size()), alias(weights.size()), base{offset}
+    {
+        const size_t n   { weights.size() };
+        double       sum { 0.0 };
+        for(double weight : weights){
+            if(!( weight >= 0.0 )) throw std::invalid_argument("AliasTable: negative weight");
+            sum += weight;
+        }
+        if(n == 0 || sum <= 0.0) throw std::invalid_argument("AliasTable: empty distribution");
+        while(( 1ULL << indexBits ) < n) indexBits++;
+
+        vector<double> scaled(n);
+        vector<size_t> small,
+                       large;
+        for(size_t i{0}; i < n; i++){
+            scaled[i] = weights[i] * static_cast<double>(n) / sum;
+            ( scaled[i] < 1.0 ? small : large ).push_back(i);
+        }
+        while(!small.empty() && !large.empty()){
+            size_t less { small.back() },
+                   more { large.back() };
+            small.pop_back();
+            threshold[less] = static_cast<uint64_t>(std::llround(scaled[less] * static_cast<double>(ONE)));
+            alias[less]     = static_cast<uint32_t>(more);
+            scaled[more]    = scaled[more] + scaled[less] - 1.0;
+            if(scaled[more] < 1.0){
+                large.pop_back();
+                small.push_back(more);
+            }
+        }
+        for(size_t i : large){ threshold[i] = ONE; alias[i] = static_cast<uint32_t>(i); }
+        for(size_t i : small){ threshold[i] = ONE; alias[i] = static_cast<uint32_t>(i); }
+    }
+
+    AliasTable AliasTable::poisson(double lambda){
+        if(!( lambda > 0.0 ) || lambda > 1e7) throw std::invalid_argument("AliasTable: lambda out of range");
+        // beyond 12 standard deviations the mass is far below the 2^-32 coin resolution
+        long           first  { std::max(0L, static_cast<long>(std::floor(lambda - 12.0 * std::sqrt(lambda) - 10.0))) },
+                       last   { static_cast<long>(std::ceil(lambda + 12.0 * std::sqrt(lambda) + 10.0)) };
+        vector<double> weights;
+        for(long k{first}; k <= last; k++)
+            weights.push_back(std::exp(-lambda + static_cast<double>(k) * std::log(lambda) - std::lgamma(static_cast<double>(k) + 1.0)));
+        return AliasTable{ weights, first };
+    }
+
+    size_t AliasTable::size(void) const noexcept{
+        return threshold.size();
+    }
+
+    template<typename Pool>
+    long AliasTable::sample(Pool& pool) const{
+        size_t idx { 0 };
+        if(indexBits > 0)
+            do{ idx = pool.bits(indexBits); }while(idx >= threshold.size());
+
+        uint64_t limit { threshold[idx] };
+        if(limit == ONE) return base + static_cast<long>(idx);
+
+        // U < limit / 2^32, deciding at the first bit where U and limit differ
+        for(int bitPos{31}; bitPos >= 0; bitPos--){
+            uint32_t expected { static_cast<uint32_t>(( limit >> bitPos ) & 1) },
+                     drawn    { pool.bit() };
+            if(drawn != expected) return base + static_cast<long>(drawn < expected ? idx : alias[idx]);
+        }
+        return base + static_cast<long>(alias[idx]);
+    }
+
+#ifdef __AVX2__
+    inline __m256d gather(const double* base, __m128i idx) noexcept{
+        return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), base, idx, _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+    }
+#endif
+
+    template<typename Source>
+    class VariateSampler{
+        public:
+            explicit VariateSampler(Source& src);
+
+            double    normal(void);
+            double    exponential(void);
+            double    uniform(void);
+            long      discrete(const AliasTable& table);
+            void      normal(double* out, size_t count);
+            void      exponential(double* out, size_t count);
+
+            uint64_t  getVariates(void)                      const  noexcept;
+            uint64_t  getBitsConsumed(void)                  const  noexcept;
+            double    getBitsPerVariate(void)                const  noexcept;
+
+        private:
+            static inline constexpr double  MANTISSA { 1.0 / 16777216.0 };
+
+            BitPool<Source>   pool;
+            const Ziggurat&   norm     { Ziggurat::normal() };
+            const Ziggurat&   expo     { Ziggurat::exponential() };
+            uint64_t          variates { 0 };
+
+            double    normalFrom(uint32_t word);
+            double    exponentialFrom(uint32_t word);
+    };
+
+    template<typename Source>
+    VariateSampler<Source>::VariateSampler(Source& src)
+        : pool{src}
+    {}
+
+    template<typename Source>
+    double VariateSampler<Source>::uniform(void){
+        return ( static_cast<double>(pool.bits(32)) + 0.5 ) / 4294967296.0;
+    }
+
+    // word layout: bits 0-6 layer, bit 7 sign, bits 8-31 mantissa
+    template<typename Source>
+    double VariateSampler<Source>::normalFrom(uint32_t word){
+        for(;;){
+            unsigned int i    { word & 0x7F };
+            bool         neg  { ( word & 0x80 ) != 0 };
+            double       z    { static_cast<double>(word >> 8) * MANTISSA * norm.x[i] };
+
+            if(z < norm.x[i + 1]) return neg ? -z : z;
+            if(i == 0){
+                double a { 0.0 },
+                       b { 0.0 };
+                do{
+                    a = -std::log(uniform()) / norm.r;
+                    b = -std::log(uniform());
+                }while(b + b < a * a);
+                return neg ? -( norm.r + a ) : norm.r + a;
+            }
+            if(norm.f[i] + uniform() * ( norm.f[i + 1] - norm.f[i] ) < std::exp(-0.5 * z * z)) return neg ? -z : z;
+            word = pool.bits(32);
+        }
+    }
+
+    // word layout: bits 0-7 layer, bits 8-31 mantissa
+    template<typename Source>
+    double VariateSampler<Source>::exponentialFrom(uint32_t word){
+        double shift { 0.0 };
+        for(;;){
+            unsigned int i { word & 0xFF };
+            double       z { static_cast<double>(word >> 8) * MANTISSA * expo.x[i] };
+
+            if(z < expo.x[i + 1]) return shift + z;
+            if(i == 0){
+                // memoryless tail: start again beyond r
+                shift += expo.r;
+            }else if(expo.f[i] + uniform() * ( expo.f[i + 1] - expo.f[i] ) < std::exp(-z)){
+                return shift + z;
+            }
+            word = pool.bits(32);
+        }
+    }
+
+    template<typename Source>
+    double VariateSampler<Source>::normal(void){
+        variates++;
+        return normalFrom(pool.bits(32));
+    }
+
+    template<typename Source>
+    double VariateSampler<Source>::exponential(void){
+        variates++;
+        return exponentialFrom(pool.bits(32));
+    }
+
+    template<typename Source>
+    long VariateSampler<Source>::discrete(const AliasTable& table){
+        variates++;
+        return table.sample(pool);
+    }
+
+    template<typename Source>
+    void VariateSampler<Source>::normal(double* out, size_t count){
+        size_t done { 0 };
+#ifdef __AVX2__
+        const __m256d  scale  { _mm256_set1_pd(MANTISSA) };
+        const __m128i  layer  { _mm_set1_epi32(0x7F) },
+                       sign   { _mm_set1_epi32(0x80) };
+        for(; done + 4 <= count; done += 4){
+            alignas(16) uint32_t words[4] { pool.bits(32), pool.bits(32), pool.bits(32), pool.bits(32) };
+            __m128i  w     { _mm_load_si128(reinterpret_cast<const __m128i*>(words)) },
+                     idx   { _mm_and_si128(w, layer) };
+            __m256d  u     { _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_srli_epi32(w, 8)), scale) },
+                     outer { gather(norm.x.data(),     idx) },
+                     inner { gather(norm.x.data() + 1, idx) },
+                     z     { _mm256_mul_pd(u, outer) };
+            int      accepted { _mm256_movemask_pd(_mm256_cmp_pd(z, inner, _CMP_LT_OQ)) };
+            // move bit 7 of each word to the sign bit of its double
+            __m256i  neg   { _mm256_slli_epi64(_mm256_cvtepu32_epi64(_mm_and_si128(w, sign)), 56) };
+            _mm256_storeu_pd(out + done, _mm256_xor_pd(z, _mm256_castsi256_pd(neg)));
+
+            for(int lane{0}; lane < 4; lane++)
+                if(( accepted & ( 1 << lane ) ) == 0) out[done + static_cast<size_t>(lane)] = normalFrom(words[lane]);
+        }
+#endif
+        for(; done < count; done++) out[done] = normalFrom(pool.bits(32));
+        variates += count;
+    }
+
+    template<typename Source>
+    void VariateSampler<Source>::exponential(double* out, size_t count){
+        size_t done { 0 };
+#ifdef __AVX2__
+        const __m256d  scale  { _mm256_set1_pd(MANTISSA) };
+        const __m128i  layer  { _mm_set1_epi32(0xFF) };
+        for(; done + 4 <= count; done += 4){
+            alignas(16) uint32_t words[4] { pool.bits(32), pool.bits(32), pool.bits(32), pool.bits(32) };
+            __m128i  w     { _mm_load_si128(reinterpret_cast<const __m128i*>(words)) },
+                     idx   { _mm_and_si128(w, layer) };
+            __m256d  u     { _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_srli_epi32(w, 8)), scale) },
+                     outer { gather(expo.x.data(),     idx) },
+                     inner { gather(expo.x.data() + 1, idx) },
+                     z     { _mm256_mul_pd(u, outer) };
+            _mm256_storeu_pd(out + done, z);
+
+            int accepted { _mm256_movemask_pd(_mm256_cmp_pd(z, inner, _CMP_LT_OQ)) };
+            for(int lane{0}; lane < 4; lane++)
+                if(( accepted & ( 1 << lane ) ) == 0) out[done + static_cast<size_t>(lane)] = exponentialFrom(words[lane]);
+        }
+#endif
+        for(; done < count; done++) out[done] = exponentialFrom(pool.bits(32));
+        variates += count;
+    }
+
+    template<typename Source>
+    uint64_t VariateSampler<Source>::getVariates(void) const noexcept{
+        return variates;
+    }
+
+    template<typename Source>
+    uint64_t VariateSampler<Source>::getBitsConsumed(void) const noexcept{
+        return pool.getConsumed();
+    }
+
+    template<typename Source>
+    double VariateSampler<Source>::getBitsPerVariate(void) const noexcept{
+        return variates > 0 ? static_cast<double>(pool.getConsumed()) / static_cast<double>(variates) : 0.0;
+    }
+
+} // End namespace
@@ -0,0 +1,210 @@
+#!/usr/local/bin/python3
+
+# -----------------------------------------------------------------
+# nuclear rng - generation 3
+# Copyright (C) 2023,2024  Gabriele Bonacini
+#
+# This program is distributed under dual license:
+# - Creative Commons Attribution-NonCommercial 4.0 International (CC BY-NC 4.0) License
+# for non commercial use, the license has the following terms:
+# * Attribution — You must give appropriate credit, provide a link to the license,
+# and indicate if changes were made. You may do so in any reasonable manner,
+# but not in any way that suggests the licensor endorses you or your use.
+# * NonCommercial — You must not use the material for commercial purposes.
+# A copy of the license it's available to the following address:
+# http://creativecommons.org/licenses/by-nc/4.0/
+# - For commercial use a specific license is available contacting the author.
+# -----------------------------------------------------------------
+
+# Throughput and latency sweep: gg3_netsim at each activity level, gg3_load for every request
+# pattern and client count, a JSON report with optional plots, capacity figures and regression check.
+#
+# Usage:
+#   gg3_sweep.py [--cpm 10,100,1000,10000,100000] [--patterns single,pipelined,bulk,stream]
+#                [--clients 1,2] [--duration 10] [--warmup 5] [--out report.json] [--plots dir]
+#                [--compare baseline.json] [--demand bytes_per_s]
+#   gg3_sweep.py --host 192.168.178.28 ...      measure a real appliance, at its own activity
+
+import argparse
+import datetime
+import json
+import math
+import os
+import platform
+import socket
+import subprocess
+import sys
+import time
+
+HOST_DIR = os.path.dirname(os.path.abspath(__file__))
+
+def wait_ready(host, port, timeout):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            with socket.create_connection((host, port), timeout=1) as sock:
+                if sock.recv(16).startswith(b"ready"):
+                    sock.send(b"end")
+                    return True
+        except OSError:
+            pass
+        time.sleep(0.2)
+    return False
+
+def start_netsim(args, cpm):
+    cmd = [args.netsim, "-i", args.tap, "-a", args.address, "-p", str(args.port), "-c", str(cpm)]
+    sim = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    if not wait_ready(args.address, args.port, 10):
+        sim.kill()
+        sys.exit("gg3_sweep: gg3_netsim not answering on %s:%d" % (args.address, args.port))
+    # the pool starts empty: let it fill at the activity level under test
+    time.sleep(args.warmup)
+    return sim
+
+def run_load(args, host, pattern, clients):
+    batch = args.bulk if pattern == "bulk" else args.batch
+    cmd = [args.load, host, str(args.port), "-p", pattern, "-c", str(clients), "-d", str(args.duration),
+           "-b", str(batch), "-w", str(args.wait), "-j"]
+    out = subprocess.run(cmd, capture_output=True, text=True)
+    if not out.stdout.strip():
+        sys.exit("gg3_sweep: gg3_load failed: %s" % out.stderr.strip())
+    return json.loads(out.stdout)
+
+def sweep(args):
+    runs = []
+    levels = [None] if args.host else args.cpm
+    for cpm in levels:
+        for pattern in args.patterns:
+            for clients in args.clients:
+                # a fresh server per run, nothing left over from the previous one
+                sim = None if args.host else start_netsim(args, cpm)
+                try:
+                    result = run_load(args, args.host or args.address, pattern, clients)
+                finally:
+                    if sim:
+                        sim.terminate()
+                        sim.wait()
+                result["cpm"] = cpm
+                runs.append(result)
+                print("cpm %-8s %-9s clients %-3d %10.1f B/s  empty %5.1f%%  p50/p99/p999 %d/%d/%d us" %
+                      (cpm if cpm is not None else "device", pattern, clients, result["bytes_per_s"],
+                       100.0 * result["empty_rate"], result["latency_us"]["p50"],
+                       result["latency_us"]["p99"], result["latency_us"]["p999"]), file=sys.stderr)
+    return runs
+
+def capacity(runs):
+    best = {}
+    for run in runs:
+        key = (run["pattern"], str(run["cpm"]))
+        best[key] = max(best.get(key, 0.0), run["bytes_per_s"])
+    table = {}
+    for (pattern, cpm), rate in best.items():
+        table.setdefault(pattern, {})[cpm] = rate
+    return table
+
+def plan(table, demand):
+    print("appliances for %.1f B/s:" % demand)
+    for pattern in sorted(table):
+        for cpm, rate in sorted(table[pattern].items(), key=lambda item: float(item[0]) if item[0] != "None" else 0):
+            needed = math.ceil(demand / rate) if rate > 0 else "-"
+            print("  %-9s cpm %-8s %10.1f B/s each  %s" % (pattern, cpm, rate, needed))
+
+def compare(runs, baseline, tolerance):
+    base = {(run["cpm"], run["pattern"], run["clients"]): run for run in baseline["runs"]}
+    regressions = 0
+    for run in runs:
+        old = base.get((run["cpm"], run["pattern"], run["clients"]))
+        if not old:
+            continue
+        rate = run["bytes_per_s"] / old["bytes_per_s"] - 1.0 if old["bytes_per_s"] else 0.0
+        p99 = run["latency_us"]["p99"] / old["latency_us"]["p99"] - 1.0 if old["latency_us"]["p99"] else 0.0
+        worse = rate < -tolerance or p99 > tolerance
+        regressions += worse
+        print("%s cpm %-8s %-9s clients %-3d throughput %+6.1f%%  p99 %+6.1f%%" %
+              ("REGRESSION" if worse else "ok        ", run["cpm"], run["pattern"], run["clients"],
+               100.0 * rate, 100.0 * p99))
+    return regressions
+
+def plot(runs, directory):
+    try:
+        import matplotlib
+        matplotlib.use("Agg")
+        import matplotlib.pyplot as plt
+    except ImportError:
+        print("gg3_sweep: matplotlib not available, no plots", file=sys.stderr)
+        return
+    os.makedirs(directory, exist_ok=True)
+    charts = [("bytes_per_s", "bytes/s", lambda run: run["bytes_per_s"]),
+              ("p99_us", "p99 latency (us)", lambda run: run["latency_us"]["p99"]),
+              ("empty_rate", "empty answers", lambda run: run["empty_rate"])]
+    series = {}
+    for run in runs:
+        if run["cpm"] is not None:
+            series.setdefault((run["pattern"], run["clients"]), []).append(run)
+    for name, label, value in charts:
+        fig, axis = plt.subplots()
+        for (pattern, clients), points in sorted(series.items()):
+            points.sort(key=lambda run: run["cpm"])
+            axis.plot([run["cpm"] for run in points], [value(run) for run in points],
+                      marker="o", label="%s x%d" % (pattern, clients))
+        axis.set_xscale("log")
+        axis.set_xlabel("cpm")
+        axis.set_ylabel(label)
+        axis.grid(True, which="both", alpha=0.3)
+        axis.legend(fontsize="small")
+        fig.savefig(os.path.join(directory, name + ".png"), dpi=120)
+        plt.close(fig)
+
+def main():
+    parser = argparse.ArgumentParser(description="Sweep throughput and latency across activity levels")
+    csv = lambda kind: lambda text: [kind(item) for item in text.split(",") if item]
+    parser.add_argument("--cpm", type=csv(float), default=[10, 100, 1000, 10000, 100000])
+    parser.add_argument("--patterns", type=csv(str), default=["single", "pipelined", "bulk", "stream"])
+    parser.add_argument("--clients", type=csv(int), default=[1, 2])
+    parser.add_argument("--duration", type=int, default=10)
+    parser.add_argument("--warmup", type=float, default=5.0)
+    parser.add_argument("--batch", type=int, default=16, help="req per pipelined batch")
+    parser.add_argument("--bulk", type=int, default=1024, help="bytes per bulk frame")
+    parser.add_argument("--wait", type=int, default=100, help="bulk frame wait, ms")
+    parser.add_argument("--host", help="an appliance instead of gg3_netsim")
+    parser.add_argument("--address", default="192.168.77.2")
+    parser.add_argument("--port", type=int, default=6666)
+    parser.add_argument("--tap", default="gg3tap")
+    parser.add_argument("--netsim", default=os.path.join(HOST_DIR, "gg3_netsim"))
+    parser.add_argument("--load", default=os.path.join(HOST_DIR, "gg3_load"))
+    parser.add_argument("--out", default="report.json")
+    parser.add_argument("--plots")
+    parser.add_argument("--compare")
+    parser.add_argument("--tolerance", type=float, default=0.1)
+    parser.add_argument("--demand", type=float)
+    args = parser.parse_args()
+    args.cpm = [int(cpm) if cpm == int(cpm) else cpm for cpm in args.cpm]
+
+    runs = sweep(args)
+    try:
+        revision = subprocess.run(["git", "-C", HOST_DIR, "describe", "--always", "--dirty"],
+                                  capture_output=True, text=True).stdout.strip()
+    except OSError:
+        revision = ""
+    report = {"date": datetime.datetime.now().isoformat(timespec="seconds"),
+              "machine": platform.node(),
+              "revision": revision,
+              "target": args.host or "gg3_netsim",
+              "duration": args.duration,
+              "warmup": args.warmup,
+              "runs": runs,
+              "capacity": capacity(runs)}
+    with open(args.out, "w") as out:
+        json.dump(report, out, indent=2)
+
+    if args.plots:
+        plot(runs, args.plots)
+    if args.demand:
+        plan(report["capacity"], args.demand)
+    if args.compare:
+        with open(args.compare) as baseline:
+            if compare(runs, json.load(baseline), args.tolerance):
+                sys.exit(1)
+
+if __name__ == "__main__":
+    main()
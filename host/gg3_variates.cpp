@@ -0,0 +1,98 @@
+// -----------------------------------------------------------------
+// nuclear rng - generation 3
+// Copyright (C) 2023,2024  Gabriele Bonacini
+//
+// This program is distributed under dual license:
+// - Creative Commons Attribution-NonCommercial 4.0 International (CC BY-NC 4.0) License
+// for non commercial use, the license has the following terms:
+// * Attribution — You must give appropriate credit, provide a link to the license,
+// and indicate if changes were made. You may do so in any reasonable manner,
+// but not in any way that suggests the licensor endorses you or your use.
+// * NonCommercial — You must not use the material for commercial purposes.
+// A copy of the license it's available to the following address:
+// http://creativecommons.org/licenses/by-nc/4.0/
+// - For commercial use a specific license is available contacting the author.
+// -----------------------------------------------------------------
+
+// Print variates generated from appliance bits, metering the bits spent.
+//
+//   gg3_variates <host> <port> <normal|exponential|poisson:lambda|discrete:w0,w1,...> <count>
+//   gg3_variates - <distribution> <count>          bytes from stdin
+
+#include "gg3_client.hpp"
+#include "gg3_samplers.hpp"
+
+#include <unistd.h>
+
+#include <iostream>
+#include <sstream>
+#include <memory>
+
+using geigergen3::ApplianceClient,
+      geigergen3::VariateSampler,
+      geigergen3::AliasTable,
+      std::cerr,
+      std::cout,
+      std::string,
+      std::vector;
+
+namespace {
+
+    class StreamSource{
+        public:
+            size_t fill(uint8_t* out, size_t len){
+                ssize_t got { read(STDIN_FILENO, out, len) };
+                return got > 0 ? static_cast<size_t>(got) : 0;
+            }
+    };
+
+    template<typename Source>
+    void generate(Source& source, const string& dist, size_t count){
+        VariateSampler<Source> sampler { source };
+        vector<double>         values(count);
+
+        if(dist == "normal"){
+            sampler.normal(values.data(), count);
+        }else if(dist == "exponential"){
+            sampler.exponential(values.data(), count);
+        }else{
+            std::unique_ptr<AliasTable> table;
+            if(dist.rfind("poisson:", 0) == 0){
+                table = std::make_unique<AliasTable>(AliasTable::poisson(std::stod(dist.substr(8))));
+            }else if(dist.rfind("discrete:", 0) == 0){
+                vector<double>     weights;
+                std::stringstream  list { dist.substr(9) };
+                for(string item; std::getline(list, item, ','); ) weights.push_back(std::stod(item));
+                table = std::make_unique<AliasTable>(weights);
+            }else{
+                throw std::invalid_argument("unknown distribution: " + dist);
+            }
+            for(double& value : values) value = static_cast<double>(sampler.discrete(*table));
+        }
+
+        for(double value : values) cout << value << '\n';
+        cerr << "variates: " << sampler.getVariates() << " bits: " << sampler.getBitsConsumed()
+             << " bits/variate: " << sampler.getBitsPerVariate() << '\n';
+    }
+
+} // End namespace
+
+int main(int argc, char** argv){
+    try{
+        if(argc == 4 && string(argv[1]) == "-"){
+            StreamSource source;
+            generate(source, argv[2], std::stoul(argv[3]));
+        }else if(argc == 5){
+            ApplianceClient client { argv[1], argv[2] };
+            generate(client, argv[3], std::stoul(argv[4]));
+        }else{
+            cerr << "Usage: " << argv[0] << " <host> <port> <normal|exponential|poisson:lambda|discrete:w0,w1,...> <count>\n"
+                 << "       " << argv[0] << " - <distribution> <count>\n";
+            return 1;
+        }
+    }catch(const std::exception& ex){
+        cerr << ex.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
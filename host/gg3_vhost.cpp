@@ -0,0 +1,721 @@
+// -----------------------------------------------------------------
+// nuclear rng - generation 3
+// Copyright (C) 2023,2024  Gabriele Bonacini
+//
+// This program is distributed under dual license:
+// - Creative Commons Attribution-NonCommercial 4.0 International (CC BY-NC 4.0) License
+// for non commercial use, the license has the following terms:
+// * Attribution — You must give appropriate credit, provide a link to the license,
+// and indicate if changes were made. You may do so in any reasonable manner,
+// but not in any way that suggests the licensor endorses you or your use.
+// * NonCommercial — You must not use the material for commercial purposes.
+// A copy of the license it's available to the following address:
+// http://creativecommons.org/licenses/by-nc/4.0/
+// - For commercial use a specific license is available contacting the author.
+// -----------------------------------------------------------------
+
+// vhost-user-rng backend: virtio-rng for QEMU guests, backed by one persistent connection to the appliance.
+//
+//   gg3_vhost <host> <port> <socket> [-b <buffer>] [-m <metrics_file>] [-i <seconds>]
+//
+// Every connection to the socket is a device, so several VMs can share it:
+//   qemu-system-x86_64 ... -object memory-backend-memfd,id=mem,size=2G,share=on -numa node,memdev=mem
+//                          -chardev socket,id=rng0,path=<socket> -device vhost-user-rng-pci,chardev=rng0
+//
+// The guest buffers are filled straight from the prefetch ring, no bounce buffer in between; the
+// split virtqueue only, no indirect descriptors and no event index. The device sockets are non-blocking,
+// a peer that stalls mid-message holds up only its own device. SIGUSR1 dumps the metrics on stderr.
+
+#include "gg3_prefetch.hpp"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+
+using geigergen3::Prefetcher,
+      std::cerr,
+      std::string,
+      std::vector,
+      std::map,
+      std::unique_ptr;
+
+namespace {
+
+    using Clock=std::chrono::steady_clock;
+
+    enum Request : uint32_t { GET_FEATURES = 1, SET_FEATURES = 2, SET_OWNER = 3, RESET_OWNER = 4, SET_MEM_TABLE = 5,
+                              SET_LOG_BASE = 6, SET_LOG_FD = 7, SET_VRING_NUM = 8, SET_VRING_ADDR = 9, SET_VRING_BASE = 10,
+                              GET_VRING_BASE = 11, SET_VRING_KICK = 12, SET_VRING_CALL = 13, SET_VRING_ERR = 14,
+                              GET_PROTOCOL_FEATURES = 15, SET_PROTOCOL_FEATURES = 16, GET_QUEUE_NUM = 17,
+                              SET_VRING_ENABLE = 18 };
+
+    const uint32_t              VERSION             { 0x1 },
+                                FLAG_REPLY          { 0x4 },
+                                FLAG_NEED_REPLY     { 0x8 },
+                                MAX_PAYLOAD         { 512 },
+                                MAX_REGIONS         { 8 },
+                                MAX_FDS             { 8 },
+                                MAX_QUEUE_SIZE      { 32'768 };
+    const uint64_t              VRING_NOFD          { 0x100 },
+                                VRING_IDX_MASK      { 0xff },
+                                F_VERSION_1         { 1ULL << 32 },
+                                F_PROTOCOL_FEATURES { 1ULL << 30 },
+                                PF_REPLY_ACK        { 1ULL << 3 },
+                                FEATURES            { F_VERSION_1 | F_PROTOCOL_FEATURES },
+                                PROTOCOL_FEATURES   { PF_REPLY_ACK };
+    const uint16_t              DESC_F_NEXT         { 1 },
+                                DESC_F_WRITE        { 2 },
+                                DESC_F_INDIRECT     { 4 },
+                                AVAIL_F_NO_INTERRUPT{ 1 };
+    const size_t                DEFAULT_BUFFER      { 256 * 1024 };
+
+    volatile std::sig_atomic_t  stopRequested       { 0 },
+                                dumpRequested       { 0 };
+
+    void onSignal(int sig) noexcept{
+        if(sig == SIGUSR1) dumpRequested = 1;
+        else               stopRequested = 1;
+    }
+
+    struct __attribute__((packed)) Header{
+        uint32_t      request,
+                      flags,
+                      size;
+    };
+
+    struct __attribute__((packed)) VringState{
+        uint32_t      index,
+                      num;
+    };
+
+    struct __attribute__((packed)) VringAddr{
+        uint32_t      index,
+                      flags;
+        uint64_t      desc,
+                      used,
+                      avail,
+                      log;
+    };
+
+    struct __attribute__((packed)) MemRegion{
+        uint64_t      guestAddr,
+                      size,
+                      userAddr,
+                      mmapOffset;
+    };
+
+    struct __attribute__((packed)) MemTable{
+        uint32_t      regions,
+                      padding;
+        MemRegion     region[MAX_REGIONS];
+    };
+
+    struct Desc{
+        uint64_t      addr;
+        uint32_t      len;
+        uint16_t      flags,
+                      next;
+    };
+
+    struct Avail{
+        uint16_t      flags,
+                      idx,
+                      ring[];
+    };
+
+    struct UsedElem{
+        uint32_t      id,
+                      len;
+    };
+
+    struct Used{
+        uint16_t      flags,
+                      idx;
+        UsedElem      ring[];
+    };
+
+    struct Mapping{
+        uint64_t      guestAddr   { 0 },
+                      userAddr    { 0 },
+                      size        { 0 };
+        uint8_t*      base        { nullptr };
+        void*         map         { MAP_FAILED };
+        size_t        mapLen      { 0 };
+    };
+
+    struct Vring{
+        uint32_t      num         { 0 };
+        Desc*         desc        { nullptr };
+        Avail*        avail       { nullptr };
+        Used*         used        { nullptr };
+        uint16_t      lastAvail   { 0 },
+                      usedIdx     { 0 };
+        int           kickFd      { -1 },
+                      callFd      { -1 };
+        bool          started     { false },
+                      enabled     { false },
+                      starved     { false };
+    };
+
+    // one vhost-user connection, that is one virtio-rng device with its request queue
+    class Device{
+        public:
+            Device(int fd, unsigned long id);
+            ~Device(void);
+
+            Device(const Device&)             = delete;
+            Device& operator=(const Device&)  = delete;
+
+            bool      handleMessages(void)                         noexcept;
+            bool      serveOne(Prefetcher& prefetcher)             noexcept;
+            void      kicked(void)                                 noexcept;
+            bool      isReady(void)                        const   noexcept;
+            int       getFd(void)                          const   noexcept;
+            int       getKickFd(void)                      const   noexcept;
+            string    metrics(void)                        const;
+
+        private:
+            int                fd;
+            unsigned long      id;
+            long               pid                 { -1 };
+            uint64_t           features            { 0 },
+                               protocolFeatures    { 0 };
+            vector<Mapping>    mappings;
+            Vring              vring;
+            // the message being received, with the fds come along with it
+            uint8_t            inbox[sizeof(Header) + MAX_PAYLOAD] {};
+            size_t             inboxLen            { 0 };
+            vector<int>        inboxFds;
+            uint64_t           bytes               { 0 },
+                               chains              { 0 },
+                               kicks               { 0 },
+                               stalls              { 0 },
+                               errors              { 0 };
+
+            ssize_t   receive(uint8_t* buff, size_t len)                           noexcept;
+            bool      dispatch(const Header& header, const uint8_t* payload, vector<int>& fds) noexcept;
+            bool      reply(const Header& request, const void* payload, uint32_t len) noexcept;
+            bool      setMemTable(const MemTable& table, vector<int>& fds)         noexcept;
+            void      unmap(void)                                                  noexcept;
+            void      stop(void)                                                   noexcept;
+            uint8_t*  fromGuest(uint64_t addr, uint64_t& len)              const   noexcept;
+            uint8_t*  fromUser(uint64_t addr)                              const   noexcept;
+            void      complete(uint16_t head, uint32_t len)                        noexcept;
+    };
+
+    Device::Device(int sock, unsigned long ident)
+        : fd{sock}, id{ident}
+    {
+        ucred     cred {};
+        socklen_t len  { sizeof(cred) };
+        if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0) pid = cred.pid;
+    }
+
+    Device::~Device(void){
+        stop();
+        if(vring.callFd >= 0) close(vring.callFd);
+        for(int received : inboxFds) close(received);
+        unmap();
+        close(fd);
+    }
+
+    void Device::unmap(void) noexcept{
+        for(Mapping& mapping : mappings) munmap(mapping.map, mapping.mapLen);
+        mappings.clear();
+    }
+
+    void Device::stop(void) noexcept{
+        if(vring.kickFd >= 0) close(vring.kickFd);
+        vring.kickFd  = -1;
+        vring.started = false;
+        vring.starved = false;
+    }
+
+    // guest physical addresses are used in the descriptors, QEMU virtual addresses for the rings
+    uint8_t* Device::fromGuest(uint64_t addr, uint64_t& len) const noexcept{
+        for(const Mapping& mapping : mappings){
+            if(addr >= mapping.guestAddr && addr - mapping.guestAddr < mapping.size){
+                len = std::min(len, mapping.size - ( addr - mapping.guestAddr ));
+                return mapping.base + ( addr - mapping.guestAddr );
+            }
+        }
+        return nullptr;
+    }
+
+    uint8_t* Device::fromUser(uint64_t addr) const noexcept{
+        for(const Mapping& mapping : mappings)
+            if(addr >= mapping.userAddr && addr - mapping.userAddr < mapping.size) return mapping.base + ( addr - mapping.userAddr );
+        return nullptr;
+    }
+
+    ssize_t Device::receive(uint8_t* buff, size_t len) noexcept{
+        char      control[CMSG_SPACE(MAX_FDS * sizeof(int))] {};
+        iovec     iov     { buff, len };
+        msghdr    msg     {};
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t   got     { recvmsg(fd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT) };
+        if(got <= 0) return got;
+        for(cmsghdr* cmsg { CMSG_FIRSTHDR(&msg) }; cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+            if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+            size_t count { ( cmsg->cmsg_len - CMSG_LEN(0) ) / sizeof(int) };
+            for(size_t i{0}; i < count; i++){
+                int received { -1 };
+                memcpy(&received, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                inboxFds.push_back(received);
+            }
+        }
+        return got;
+    }
+
+    // reads what the socket holds and handles every message completed: false when the peer has gone
+    // or sent a malformed one
+    bool Device::handleMessages(void) noexcept{
+        for(;;){
+            Header       header  {};
+            memcpy(&header, inbox, sizeof(header));
+            const bool   framed  { inboxLen >= sizeof(header) };
+            if(framed && header.size > MAX_PAYLOAD) return false;
+            const size_t want    { sizeof(header) + ( framed ? header.size : 0 ) };
+            if(framed && inboxLen == want){
+                vector<int> fds;
+                fds.swap(inboxFds);
+                inboxLen = 0;
+                // a short payload reads as zeros, as before
+                memset(inbox + want, 0, sizeof(inbox) - want);
+                bool        ok  { dispatch(header, inbox + sizeof(header), fds) };
+                for(int received : fds) close(received);
+                if(!ok) return false;
+                continue;
+            }
+            ssize_t      got     { receive(inbox + inboxLen, want - inboxLen) };
+            if(got == 0) return false;
+            if(got < 0)  return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            inboxLen += static_cast<size_t>(got);
+        }
+    }
+
+    // replies are a few bytes: a socket too full to take one means a peer not reading, the device goes
+    bool Device::reply(const Header& request, const void* payload, uint32_t len) noexcept{
+        uint8_t  buff[sizeof(Header) + sizeof(uint64_t)];
+        Header   header { request.request, VERSION | FLAG_REPLY, len };
+        if(len > sizeof(uint64_t)) return false;
+        memcpy(buff, &header, sizeof(header));
+        memcpy(buff + sizeof(header), payload, len);
+        return send(fd, buff, sizeof(header) + len, MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(header) + len);
+    }
+
+    bool Device::setMemTable(const MemTable& table, vector<int>& fds) noexcept{
+        if(table.regions > MAX_REGIONS || table.regions != fds.size()) return false;
+        unmap();
+        for(uint32_t i{0}; i < table.regions; i++){
+            const MemRegion& region { table.region[i] };
+            Mapping          mapping;
+            mapping.mapLen    = region.size + region.mmapOffset;
+            mapping.map       = mmap(nullptr, mapping.mapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fds[i], 0);
+            if(mapping.map == MAP_FAILED){
+                cerr << "gg3_vhost: device " << id << ": mmap: " << strerror(errno) << '\n';
+                unmap();
+                return false;
+            }
+            mapping.guestAddr = region.guestAddr;
+            mapping.userAddr  = region.userAddr;
+            mapping.size      = region.size;
+            mapping.base      = static_cast<uint8_t*>(mapping.map) + region.mmapOffset;
+            mappings.push_back(mapping);
+        }
+        return true;
+    }
+
+    // the fds left in the vector are closed by the caller
+    bool Device::dispatch(const Header& header, const uint8_t* payload, vector<int>& fds) noexcept{
+        uint64_t     value   { 0 };
+        VringState   state   {};
+        bool         ok      { true },
+                     replied { false };
+        memcpy(&value, payload, sizeof(value));
+        memcpy(&state, payload, sizeof(state));
+        // virtio-rng has a single queue: every vring request names queue 0
+        const bool   first   { state.index == 0 };
+
+        switch(header.request){
+            case GET_FEATURES:
+                value   = FEATURES;
+                replied = ok = reply(header, &value, sizeof(value));
+            break;
+            case SET_FEATURES:
+                features = value & FEATURES;
+            break;
+            case GET_PROTOCOL_FEATURES:
+                value   = PROTOCOL_FEATURES;
+                replied = ok = reply(header, &value, sizeof(value));
+            break;
+            case SET_PROTOCOL_FEATURES:
+                protocolFeatures = value & PROTOCOL_FEATURES;
+            break;
+            case GET_QUEUE_NUM:
+                value   = 1;
+                replied = ok = reply(header, &value, sizeof(value));
+            break;
+            case SET_OWNER:
+            break;
+            case RESET_OWNER:
+                stop();
+                features = 0;
+            break;
+            case SET_MEM_TABLE:
+                {
+                    MemTable table {};
+                    memcpy(&table, payload, std::min<size_t>(header.size, sizeof(table)));
+                    ok = setMemTable(table, fds);
+                }
+            break;
+            case SET_VRING_NUM:
+                ok = first && state.num > 0 && state.num <= MAX_QUEUE_SIZE && ( state.num & ( state.num - 1 ) ) == 0;
+                if(ok) vring.num = state.num;
+            break;
+            case SET_VRING_ADDR:
+                ok = first;
+                if(ok){
+                    VringAddr addr {};
+                    memcpy(&addr, payload, sizeof(addr));
+                    vring.desc  = reinterpret_cast<Desc*>(fromUser(addr.desc));
+                    vring.avail = reinterpret_cast<Avail*>(fromUser(addr.avail));
+                    vring.used  = reinterpret_cast<Used*>(fromUser(addr.used));
+                    ok          = vring.desc != nullptr && vring.avail != nullptr && vring.used != nullptr;
+                    if(ok) vring.usedIdx = vring.used->idx;
+                }
+            break;
+            case SET_VRING_BASE:
+                ok = first;
+                if(ok) vring.lastAvail = vring.usedIdx = static_cast<uint16_t>(state.num);
+            break;
+            case GET_VRING_BASE:
+                stop();
+                state   = { 0, vring.lastAvail };
+                replied = ok = reply(header, &state, sizeof(state));
+            break;
+            case SET_VRING_KICK:
+            case SET_VRING_CALL:
+            case SET_VRING_ERR:
+                {
+                    int received { ( value & VRING_NOFD ) == 0 && !fds.empty() ? fds[0] : -1 };
+                    fds.clear();
+                    if(( value & VRING_IDX_MASK ) != 0){
+                        ok = false;
+                        if(received >= 0) close(received);
+                    }else if(header.request == SET_VRING_KICK){
+                        // without an eventfd the queue is polled at every round of the loop
+                        stop();
+                        vring.kickFd  = received;
+                        vring.started = true;
+                        vring.enabled = vring.enabled || ( features & F_PROTOCOL_FEATURES ) == 0;
+                    }else if(header.request == SET_VRING_CALL){
+                        if(vring.callFd >= 0) close(vring.callFd);
+                        vring.callFd = received;
+                    }else if(received >= 0){
+                        close(received);
+                    }
+                }
+            break;
+            case SET_VRING_ENABLE:
+                ok = first;
+                if(ok) vring.enabled = state.num != 0;
+            break;
+            case SET_LOG_BASE:
+            case SET_LOG_FD:
+            default:
+                cerr << "gg3_vhost: device " << id << ": unsupported request " << header.request << '\n';
+                ok = false;
+        }
+        // the mappings outlive the region fds, closed by the caller
+        if(!ok) errors++;
+
+        if(!replied && ( header.flags & FLAG_NEED_REPLY ) != 0 && ( protocolFeatures & PF_REPLY_ACK ) != 0){
+            value = ok ? 0 : 1;
+            return reply(header, &value, sizeof(value));
+        }
+        return true;
+    }
+
+    void Device::kicked(void) noexcept{
+        uint64_t value { 0 };
+        if(vring.kickFd >= 0 && read(vring.kickFd, &value, sizeof(value)) > 0) kicks++;
+    }
+
+    bool Device::isReady(void) const noexcept{
+        return vring.started && vring.enabled && vring.num > 0 && vring.desc != nullptr;
+    }
+
+    int Device::getFd(void) const noexcept{
+        return fd;
+    }
+
+    int Device::getKickFd(void) const noexcept{
+        return vring.kickFd;
+    }
+
+    void Device::complete(uint16_t head, uint32_t len) noexcept{
+        UsedElem& elem { vring.used->ring[vring.usedIdx % vring.num] };
+        elem.id  = head;
+        elem.len = len;
+        vring.usedIdx++;
+        __atomic_store_n(&vring.used->idx, vring.usedIdx, __ATOMIC_RELEASE);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t one { 1 };
+        if(vring.callFd >= 0 && ( __atomic_load_n(&vring.avail->flags, __ATOMIC_RELAXED) & AVAIL_F_NO_INTERRUPT ) == 0
+           && write(vring.callFd, &one, sizeof(one)) < 0){ /* the guest is going away */ }
+    }
+
+    // one descriptor chain, filled in place from the prefetch ring: false when there's nothing to do,
+    // or no bytes to do it, and the chain stays in the avail ring for the next round
+    bool Device::serveOne(Prefetcher& prefetcher) noexcept{
+        if(!isReady()) return false;
+        uint16_t availIdx { __atomic_load_n(&vring.avail->idx, __ATOMIC_ACQUIRE) };
+        if(availIdx == vring.lastAvail){
+            vring.starved = false;
+            return false;
+        }
+        if(prefetcher.getAvailable() == 0){
+            if(!vring.starved) stalls++;
+            vring.starved = true;
+            return false;
+        }
+        vring.starved = false;
+
+        uint16_t head    { vring.avail->ring[vring.lastAvail % vring.num] };
+        uint32_t written { 0 };
+        bool     broken  { head >= vring.num };
+        for(uint32_t idx { head }, hops { 0 }; !broken; hops++){
+            Desc     desc    { vring.desc[idx] };
+            if(( desc.flags & DESC_F_INDIRECT ) != 0 || hops >= vring.num){
+                broken = true;
+                break;
+            }
+            if(( desc.flags & DESC_F_WRITE ) != 0){
+                uint64_t len     { desc.len };
+                uint8_t* buff    { fromGuest(desc.addr, len) };
+                if(buff == nullptr){
+                    broken = true;
+                    break;
+                }
+                size_t   got     { prefetcher.take(buff, static_cast<size_t>(len)) };
+                written += static_cast<uint32_t>(got);
+                if(got < len) break;
+            }
+            if(( desc.flags & DESC_F_NEXT ) == 0) break;
+            idx    = desc.next;
+            broken = idx >= vring.num;
+        }
+        if(broken){
+            cerr << "gg3_vhost: device " << id << ": malformed descriptor chain\n";
+            errors++;
+        }
+        vring.lastAvail++;
+        complete(head, written);
+        bytes += written;
+        chains++;
+        return true;
+    }
+
+    string Device::metrics(void) const{
+        std::ostringstream out;
+        string             labels { "{device=\"" + std::to_string(id) + "\",pid=\"" + std::to_string(pid) + "\"} " };
+        out << "gg3_vhost_device_bytes"   << labels << bytes   << '\n'
+            << "gg3_vhost_device_chains"  << labels << chains  << '\n'
+            << "gg3_vhost_device_kicks"   << labels << kicks   << '\n'
+            << "gg3_vhost_device_stalls"  << labels << stalls  << '\n'
+            << "gg3_vhost_device_errors"  << labels << errors  << '\n'
+            << "gg3_vhost_device_ready"   << labels << ( isReady() ? 1 : 0 ) << '\n';
+        return out.str();
+    }
+
+    class VhostServer{
+        public:
+            VhostServer(Prefetcher& prefetcher, const string& path);
+            ~VhostServer(void);
+
+            void      service(const string& metricsFile, unsigned long intervalS);
+
+        private:
+            Prefetcher&                       prefetcher;
+            const string                      path;
+            int                               listenFd    { -1 };
+            unsigned long                     nextId      { 0 };
+            int                               lastServed  { -1 };
+            map<int, unique_ptr<Device>>      devices;
+
+            void      serve(void)                         noexcept;
+            string    metrics(void)               const;
+    };
+
+    VhostServer::VhostServer(Prefetcher& pref, const string& pth)
+        : prefetcher{pref}, path{pth}
+    {
+        sockaddr_un addr {};
+        if(path.size() >= sizeof(addr.sun_path)) throw std::runtime_error("gg3_vhost: socket path too long");
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(listenFd < 0) throw std::runtime_error("gg3_vhost: socket: " + string(strerror(errno)));
+        unlink(path.c_str());
+        if(bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listenFd, SOMAXCONN) != 0){
+            close(listenFd);
+            throw std::runtime_error("gg3_vhost: " + path + ": " + string(strerror(errno)));
+        }
+    }
+
+    VhostServer::~VhostServer(void){
+        devices.clear();
+        close(listenFd);
+        unlink(path.c_str());
+    }
+
+    // round robin, a chain per device per turn, until the queues or the prefetch ring are empty; a turn
+    // starts after the device served last, a short ring doesn't go to the first one every time
+    void VhostServer::serve(void) noexcept{
+        for(bool progress { true }; progress; ){
+            progress = false;
+            auto next { devices.upper_bound(lastServed) };
+            for(size_t i{0}; i < devices.size(); i++, ++next){
+                if(next == devices.end()) next = devices.begin();
+                if(next->second->serveOne(prefetcher)){
+                    lastServed = next->first;
+                    progress   = true;
+                }
+            }
+        }
+    }
+
+    string VhostServer::metrics(void) const{
+        std::ostringstream out;
+        out << "gg3_vhost_buffer_bytes "      << prefetcher.getAvailable()  << '\n'
+            << "gg3_vhost_buffer_capacity "   << prefetcher.getCapacity()   << '\n'
+            << "gg3_vhost_fetched_bytes "     << prefetcher.getFetched()    << '\n'
+            << "gg3_vhost_reconnects "        << prefetcher.getReconnects() << '\n'
+            << "gg3_vhost_connected "         << ( prefetcher.isConnected() ? 1 : 0 ) << '\n'
+            << "gg3_vhost_devices "           << devices.size()             << '\n';
+        for(const auto& [fd, device] : devices) out << device->metrics();
+        return out.str();
+    }
+
+    void VhostServer::service(const string& metricsFile, unsigned long intervalS){
+        const int    POLL_MS     { 1'000 },
+                     NOFD_MS     { 10 };
+        auto         nextMetrics { Clock::now() + std::chrono::seconds(intervalS) };
+        while(stopRequested == 0){
+            vector<pollfd>  fds     { { listenFd, POLLIN, 0 }, { prefetcher.getEventFd(), POLLIN, 0 } };
+            vector<Device*> owners  { nullptr, nullptr };
+            bool            polled  { false };
+            for(const auto& [fd, device] : devices){
+                fds.push_back({ fd, POLLIN, 0 });
+                owners.push_back(device.get());
+                if(device->getKickFd() >= 0){
+                    fds.push_back({ device->getKickFd(), POLLIN, 0 });
+                    owners.push_back(device.get());
+                }
+                polled = polled || ( device->isReady() && device->getKickFd() < 0 );
+            }
+            if(poll(fds.data(), fds.size(), polled ? NOFD_MS : POLL_MS) < 0 && errno != EINTR)
+                throw std::runtime_error("gg3_vhost: poll: " + string(strerror(errno)));
+
+            if(fds[0].revents & POLLIN){
+                for(int fd { accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC) }; fd >= 0;
+                    fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)){
+                    devices.emplace(fd, std::make_unique<Device>(fd, nextId));
+                    cerr << "gg3_vhost: device " << nextId++ << " connected\n";
+                }
+            }
+            if(fds[1].revents & POLLIN) prefetcher.clearEvent();
+
+            vector<int> closed;
+            for(size_t i{2}; i < fds.size(); i++){
+                if(fds[i].revents == 0) continue;
+                Device* device { owners[i] };
+                if(fds[i].fd == device->getFd()){
+                    if(!device->handleMessages()) closed.push_back(device->getFd());
+                }else{
+                    device->kicked();
+                }
+            }
+            for(int fd : closed){
+                cerr << "gg3_vhost: device disconnected\n";
+                devices.erase(fd);
+            }
+            serve();
+
+            if(dumpRequested != 0){
+                dumpRequested = 0;
+                cerr << metrics();
+            }
+            if(!metricsFile.empty() && Clock::now() >= nextMetrics){
+                nextMetrics = Clock::now() + std::chrono::seconds(intervalS);
+                string        tmp  { metricsFile + ".tmp" };
+                std::ofstream file { tmp, std::ios::trunc };
+                file << metrics();
+                file.close();
+                if(!file || rename(tmp.c_str(), metricsFile.c_str()) != 0) cerr << "gg3_vhost: can't write " << metricsFile << '\n';
+            }
+        }
+    }
+
+} // End namespace
+
+int main(int argc, char** argv){
+    size_t         buffer      { DEFAULT_BUFFER };
+    string         metricsFile;
+    unsigned long  intervalS   { 10 };
+    try{
+        for(int opt{0}; ( opt = getopt(argc, argv, "b:m:i:") ) != -1; ){
+            switch(opt){
+                case 'b': buffer      = std::stoul(optarg);                    break;
+                case 'm': metricsFile = optarg;                                break;
+                case 'i': intervalS   = std::max(1UL, std::stoul(optarg));     break;
+                default:  optind      = argc + 1;
+            }
+        }
+    }catch(const std::exception& ex){
+        cerr << "gg3_vhost: " << ex.what() << '\n';
+        return 1;
+    }
+    if(argc - optind != 3){
+        cerr << "Usage: " << argv[0] << " <host> <port> <socket> [-b <buffer>] [-m <metrics_file>] [-i <seconds>]\n";
+        return 1;
+    }
+
+    try{
+        std::signal(SIGINT,  onSignal);
+        std::signal(SIGTERM, onSignal);
+        std::signal(SIGUSR1, onSignal);
+        std::signal(SIGPIPE, SIG_IGN);
+
+        Prefetcher  prefetcher { argv[optind], argv[optind + 1], buffer };
+        VhostServer server     { prefetcher, argv[optind + 2] };
+        server.service(metricsFile, intervalS);
+    }catch(const std::exception& ex){
+        cerr << ex.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
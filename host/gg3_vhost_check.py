@@ -0,0 +1,221 @@
+#!/usr/local/bin/python3
+
+# -----------------------------------------------------------------
+# nuclear rng - generation 3
+# Copyright (C) 2023,2024  Gabriele Bonacini
+#
+# This program is distributed under dual license:
+# - Creative Commons Attribution-NonCommercial 4.0 International (CC BY-NC 4.0) License
+# for non commercial use, the license has the following terms:
+# * Attribution — You must give appropriate credit, provide a link to the license,
+# and indicate if changes were made. You may do so in any reasonable manner,
+# but not in any way that suggests the licensor endorses you or your use.
+# * NonCommercial — You must not use the material for commercial purposes.
+# A copy of the license it's available to the following address:
+# http://creativecommons.org/licenses/by-nc/4.0/
+# - For commercial use a specific license is available contacting the author.
+# -----------------------------------------------------------------
+
+# gg3_vhost without QEMU: a fake appliance answering "req" from os.urandom, and vhost-user frontends
+# driving a split virtqueue over memfd guest memory, one thread per device. A stalled peer, a connection
+# that sends half a message and goes quiet, runs alongside: the other devices must keep being served.
+# Per-device bytes and chains are printed, the exit status is 1 when a device got nothing.
+#
+# Usage:
+#   gg3_vhost_check.py [--devices 2] [--duration 3] [--no-stall] [--appliance host:port]
+#                      [--vhost path] [--buffer bytes]
+
+import argparse
+import mmap
+import os
+import select
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+HOST_DIR = os.path.dirname(os.path.abspath(__file__))
+
+# vhost-user requests
+GET_FEATURES, SET_FEATURES, SET_OWNER, SET_MEM_TABLE = 1, 2, 3, 5
+SET_VRING_NUM, SET_VRING_ADDR, SET_VRING_BASE, GET_VRING_BASE = 8, 9, 10, 11
+SET_VRING_KICK, SET_VRING_CALL = 12, 13
+GET_PROTOCOL_FEATURES, SET_PROTOCOL_FEATURES, SET_VRING_ENABLE = 15, 16, 18
+
+VERSION, FLAG_NEED_REPLY = 0x1, 0x8
+PF_REPLY_ACK = 1 << 3
+DESC_F_NEXT, DESC_F_WRITE = 1, 2
+
+# guest layout: the rings at the start of one memfd region, the buffers after them
+QUEUE_SIZE = 64
+MEM_SIZE   = 1 << 20
+GUEST_ADDR = 0x40000000
+USER_ADDR  = 0x7f0000000000
+DESC, AVAIL, USED, BUFFERS = 0x0, 0x1000, 0x2000, 0x10000
+CHAIN_LEN  = 64
+
+def appliance(listener):
+    def serve(conn):
+        with conn:
+            conn.sendall(b"ready\n")
+            pending = b""
+            while True:
+                data = conn.recv(65536)
+                if not data:
+                    return
+                pending += data
+                count    = len(pending) // 3
+                commands = pending[:3 * count]
+                pending  = pending[3 * count:]
+                if b"end" in commands:
+                    return
+                conn.sendall(b"".join(b"%d:0:10\n" % value for value in os.urandom(count)))
+    while True:
+        conn, _ = listener.accept()
+        threading.Thread(target=serve, args=(conn,), daemon=True).start()
+
+class Frontend:
+    def __init__(self, path):
+        self.sock = socket.socket(socket.AF_UNIX)
+        self.sock.connect(path)
+        # a device left unanswered fails instead of hanging the check
+        self.sock.settimeout(5)
+        self.memfd = os.memfd_create("gg3_guest")
+        os.ftruncate(self.memfd, MEM_SIZE)
+        self.mem   = mmap.mmap(self.memfd, MEM_SIZE)
+        self.kick  = os.eventfd(0, os.EFD_NONBLOCK)
+        self.call  = os.eventfd(0, os.EFD_NONBLOCK)
+        self.bytes = 0
+        self.chains = 0
+        self.error = None
+
+    def message(self, request, payload=b"", fds=(), flags=VERSION, reply=False):
+        socket.send_fds(self.sock, [struct.pack("<III", request, flags, len(payload)) + payload], list(fds))
+        if not reply:
+            return None
+        _, _, size = struct.unpack("<III", self.recv_exact(12))
+        return self.recv_exact(size)
+
+    def recv_exact(self, size):
+        data = b""
+        while len(data) < size:
+            chunk = self.sock.recv(size - len(data))
+            if not chunk:
+                raise ConnectionError("gg3_vhost closed the device")
+            data += chunk
+        return data
+
+    def setup(self):
+        features = struct.unpack("<Q", self.message(GET_FEATURES, reply=True))[0]
+        self.message(GET_PROTOCOL_FEATURES, reply=True)
+        self.message(SET_PROTOCOL_FEATURES, struct.pack("<Q", PF_REPLY_ACK))
+        self.message(SET_OWNER)
+        self.message(SET_FEATURES, struct.pack("<Q", features))
+        region = struct.pack("<IIQQQQ", 1, 0, GUEST_ADDR, MEM_SIZE, USER_ADDR, 0)
+        if struct.unpack("<Q", self.message(SET_MEM_TABLE, region, [self.memfd],
+                                            VERSION | FLAG_NEED_REPLY, True))[0] != 0:
+            raise RuntimeError("memory table refused")
+        self.message(SET_VRING_NUM, struct.pack("<II", 0, QUEUE_SIZE))
+        self.message(SET_VRING_BASE, struct.pack("<II", 0, 0))
+        self.message(SET_VRING_ADDR, struct.pack("<IIQQQQ", 0, 0, USER_ADDR + DESC, USER_ADDR + USED,
+                                                 USER_ADDR + AVAIL, 0))
+        self.message(SET_VRING_KICK, struct.pack("<Q", 0), [self.kick])
+        self.message(SET_VRING_CALL, struct.pack("<Q", 0), [self.call])
+        self.message(SET_VRING_ENABLE, struct.pack("<II", 0, 1))
+
+    # a chain is two writable descriptors, half the buffer each
+    def post(self, index):
+        slot  = index % (QUEUE_SIZE // 2)
+        first = 2 * slot
+        base  = GUEST_ADDR + BUFFERS + CHAIN_LEN * slot
+        half  = CHAIN_LEN // 2
+        struct.pack_into("<QIHH", self.mem, DESC + 16 * first, base, half, DESC_F_WRITE | DESC_F_NEXT, first + 1)
+        struct.pack_into("<QIHH", self.mem, DESC + 16 * (first + 1), base + half, half, DESC_F_WRITE, 0)
+        struct.pack_into("<H", self.mem, AVAIL + 4 + 2 * (index % QUEUE_SIZE), first)
+
+    def drive(self, duration):
+        try:
+            self.setup()
+            posted, seen = 0, 0
+            deadline = time.time() + duration
+            while time.time() < deadline:
+                while posted - seen < QUEUE_SIZE // 2:
+                    self.post(posted)
+                    posted += 1
+                struct.pack_into("<H", self.mem, AVAIL + 2, posted & 0xffff)
+                os.eventfd_write(self.kick, 1)
+                select.select([self.call], [], [], 0.5)
+                try:
+                    os.eventfd_read(self.call)
+                except BlockingIOError:
+                    pass
+                used = struct.unpack_from("<H", self.mem, USED + 2)[0]
+                while seen & 0xffff != used:
+                    _, length = struct.unpack_from("<II", self.mem, USED + 4 + 8 * (seen % QUEUE_SIZE))
+                    self.bytes  += length
+                    self.chains += 1
+                    seen        += 1
+            self.message(GET_VRING_BASE, struct.pack("<II", 0, 0), reply=True)
+        except (OSError, RuntimeError) as ex:
+            self.error = str(ex)
+
+def main():
+    parser = argparse.ArgumentParser(description="Drive gg3_vhost with fake guests and a fake appliance")
+    parser.add_argument("--devices", type=int, default=2)
+    parser.add_argument("--duration", type=float, default=3.0)
+    parser.add_argument("--no-stall", action="store_true", help="no stalled peer alongside the devices")
+    parser.add_argument("--appliance", help="host:port of an appliance instead of the fake one")
+    parser.add_argument("--vhost", default=os.path.join(HOST_DIR, "gg3_vhost"))
+    parser.add_argument("--buffer", type=int, default=64 * 1024)
+    args = parser.parse_args()
+
+    if args.appliance:
+        host, port = args.appliance.rsplit(":", 1)
+    else:
+        listener = socket.create_server(("127.0.0.1", 0))
+        threading.Thread(target=appliance, args=(listener,), daemon=True).start()
+        host, port = listener.getsockname()[0], str(listener.getsockname()[1])
+
+    path  = os.path.join(tempfile.mkdtemp(prefix="gg3_vhost_"), "vhost.sock")
+    vhost = subprocess.Popen([args.vhost, host, port, path, "-b", str(args.buffer)], stderr=subprocess.DEVNULL)
+    try:
+        for _ in range(50):
+            if os.path.exists(path):
+                break
+            time.sleep(0.1)
+        else:
+            sys.exit("gg3_vhost_check: gg3_vhost not listening on " + path)
+
+        stalled = None
+        if not args.no_stall:
+            # half a header: gg3_vhost has to wait for the rest without blocking the others
+            stalled = socket.socket(socket.AF_UNIX)
+            stalled.connect(path)
+            stalled.send(struct.pack("<III", GET_FEATURES, VERSION, 0)[:6])
+
+        devices = [Frontend(path) for _ in range(args.devices)]
+        threads = [threading.Thread(target=device.drive, args=(args.duration,)) for device in devices]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        if stalled:
+            stalled.close()
+    finally:
+        vhost.terminate()
+        vhost.wait()
+
+    failed = 0
+    for number, device in enumerate(devices):
+        starved = device.error is not None or device.bytes == 0
+        failed += starved
+        print("device %d: %10d bytes %8d chains %10.1f B/s%s" %
+              (number, device.bytes, device.chains, device.bytes / args.duration,
+               "  FAILED: " + (device.error or "no bytes") if starved else ""))
+    sys.exit(1 if failed else 0)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,117 @@
+#!/usr/local/bin/python3
+
+# -----------------------------------------------------------------
+# nuclear rng - generation 3
+# Copyright (C) 2023,2024  Gabriele Bonacini
+#
+# This program is distributed under dual license:
+# - Creative Commons Attribution-NonCommercial 4.0 International (CC BY-NC 4.0) License
+# for non commercial use, the license has the following terms:
+# * Attribution — You must give appropriate credit, provide a link to the license,
+# and indicate if changes were made. You may do so in any reasonable manner,
+# but not in any way that suggests the licensor endorses you or your use.
+# * NonCommercial — You must not use the material for commercial purposes.
+# A copy of the license it's available to the following address:
+# http://creativecommons.org/licenses/by-nc/4.0/
+# - For commercial use a specific license is available contacting the author.
+# -----------------------------------------------------------------
+
+# Symbolize the PC histogram collected by the appliance profiler.
+#
+# Usage:
+#   pc_symbolize.py geiger_gen3.elf dump.txt
+#   pc_symbolize.py geiger_gen3.elf --host 192.168.178.28 [--port 6666] [--seconds 10]
+
+import argparse
+import bisect
+import socket
+import subprocess
+import sys
+import time
+from collections import defaultdict
+
+def load_symbols(elf, nm):
+    out = subprocess.run([nm, "-n", "-C", "--defined-only", elf],
+                         check=True, capture_output=True, text=True).stdout
+    addrs, names = [], []
+    for line in out.splitlines():
+        fields = line.split(None, 2)
+        if len(fields) != 3 or fields[1] not in "tTwW":
+            continue
+        # thumb function symbols carry the interworking bit
+        addrs.append(int(fields[0], 16) & ~1)
+        names.append(fields[2])
+    return addrs, names
+
+def symbolize(addrs, names, pc):
+    idx = bisect.bisect_right(addrs, pc) - 1
+    return names[idx] if idx >= 0 else "??"
+
+def recv_until(sock, marker):
+    data = b""
+    while not data.endswith(marker):
+        chunk = sock.recv(4096)
+        if not chunk:
+            break
+        data += chunk
+    return data.decode()
+
+def fetch_dump(host, port, seconds):
+    sock = socket.socket()
+    sock.connect((host, port))
+    recv_until(sock, b"ready\n")
+    sock.send(b"pst")
+    recv_until(sock, b"pst\n")
+    time.sleep(seconds)
+    sock.send(b"psp")
+    recv_until(sock, b"psp\n")
+    sock.send(b"pdm")
+    dump = recv_until(sock, b"pce\n")
+    sock.send(b"end")
+    sock.close()
+    return dump
+
+def parse_dump(text):
+    totals, hits = {}, defaultdict(list)
+    for line in text.splitlines():
+        fields = line.strip().split(":")
+        if fields[0] == "pcs" and len(fields) == 4:
+            totals[int(fields[1])] = (int(fields[2]), int(fields[3]))
+        elif fields[0] == "pc" and len(fields) == 4:
+            hits[int(fields[1])].append((int(fields[2], 16), int(fields[3])))
+    return totals, hits
+
+def main():
+    parser = argparse.ArgumentParser(description="Symbolize appliance PC samples")
+    parser.add_argument("elf")
+    parser.add_argument("dump", nargs="?")
+    parser.add_argument("--host")
+    parser.add_argument("--port", type=int, default=6666)
+    parser.add_argument("--seconds", type=float, default=10.0)
+    parser.add_argument("--nm", default="arm-none-eabi-nm")
+    parser.add_argument("--top", type=int, default=20)
+    args = parser.parse_args()
+
+    if args.host:
+        text = fetch_dump(args.host, args.port, args.seconds)
+    elif args.dump:
+        with open(args.dump) as dump:
+            text = dump.read()
+    else:
+        text = sys.stdin.read()
+
+    addrs, names = load_symbols(args.elf, args.nm)
+    totals, hits = parse_dump(text)
+
+    for core in sorted(totals):
+        samples, dropped = totals[core]
+        functions = defaultdict(int)
+        for pc, count in hits[core]:
+            functions[symbolize(addrs, names, pc)] += count
+        print("core%d: %d samples, %d not binned" % (core, samples, dropped))
+        for name, count in sorted(functions.items(), key=lambda item: -item[1])[:args.top]:
+            share = 100.0 * count / samples if samples else 0.0
+            print("  %6.2f%%  %8d  %s" % (share, count, name))
+
+if __name__ == "__main__":
+    main()
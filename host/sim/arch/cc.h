@@ -0,0 +1,12 @@
+#pragma once
+
+// lwIP platform definitions for the host simulation, NO_SYS with an external lock
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef int sys_prot_t;
+
+#define LWIP_PLATFORM_DIAG(x)     do { printf x; } while(0)
+#define LWIP_PLATFORM_ASSERT(x)   do { fprintf(stderr, "lwIP assertion \"%s\" failed at %s:%d\n", x, __FILE__, __LINE__); abort(); } while(0)
+#define LWIP_RAND()               ((u32_t)random())
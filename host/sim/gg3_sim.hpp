@@ -0,0 +1,69 @@
+// -----------------------------------------------------------------
+// nuclear rng - generation 3
+// Copyright (C) 2023,2024  Gabriele Bonacini
+//
+// This program is distributed under dual license:
+// - Creative Commons Attribution-NonCommercial 4.0 International (CC BY-NC 4.0) License
+// for non commercial use, the license has the following terms:
+// * Attribution — You must give appropriate credit, provide a link to the license,
+// and indicate if changes were made. You may do so in any reasonable manner,
+// but not in any way that suggests the licensor endorses you or your use.
+// * NonCommercial — You must not use the material for commercial purposes.
+// A copy of the license it's available to the following address:
+// http://creativecommons.org/licenses/by-nc/4.0/
+// - For commercial use a specific license is available contacting the author.
+// -----------------------------------------------------------------
+
+#pragma once
+
+// Host stand-ins for the Pico SDK parts used by geiger_gen3.hpp:
+// cores are threads, the cyw43 background irq is a polling thread and the converter is a simulated detector.
+
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <random>
+
+typedef unsigned int uint;
+typedef volatile uint32_t io_rw_32;
+
+namespace gg3sim {
+
+    inline constexpr uint32_t                   SYS_HZ               { 125'000'000 },
+                                                ADC_HZ               { 48'000'000 };
+    inline constexpr uint64_t                   PULSE_US             { 80 };
+    inline constexpr uint16_t                   PULSE_LEVEL          { 3'000 };
+
+    inline thread_local unsigned int            core                 { 0 };
+    // the cyw43 async context lock: lwIP callbacks and cyw43_arch_lwip_begin/end
+    inline std::recursive_mutex                 lwipLock;
+    inline std::atomic<unsigned int>            adcInput             { 0 };
+    inline std::atomic<double>                  cpm                  { 6'000.0 };
+    // 5V through the board divider (1/3) on 12 bits
+    inline std::atomic<uint16_t>                vsysRaw              { 2'069 };
+
+    inline const std::chrono::steady_clock::time_point  boot         { std::chrono::steady_clock::now() };
+
+    inline uint64_t nowNs(void) noexcept{
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - boot).count());
+    }
+
+    // Poisson arrivals, each one a flat pulse: arrivals during a pulse are lost, as in the real detector
+    inline uint16_t detector(void) noexcept{
+        thread_local std::mt19937_64  gen      { std::random_device{}() };
+        thread_local uint64_t         next     { 0 },
+                                      end      { 0 };
+        std::exponential_distribution<double> interval { cpm.load() / 60e6 };
+
+        uint64_t now { nowNs() / 1'000 };
+        if(next == 0) next = now + static_cast<uint64_t>(interval(gen));
+        if(now >= next){
+            end = next + PULSE_US;
+            do next += static_cast<uint64_t>(interval(gen)) + 1; while(next < end);
+        }
+        return now < end ? PULSE_LEVEL : 0;
+    }
+
+} // End namespace
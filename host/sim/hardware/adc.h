@@ -0,0 +1,8 @@
+#pragma once
+
+#include "../gg3_sim.hpp"
+
+inline void adc_init(void){}
+inline void adc_gpio_init(uint){}
+inline void adc_select_input(uint input){ gg3sim::adcInput = input; }
+inline uint16_t adc_read(void){ return gg3sim::adcInput == 3 ? gg3sim::vsysRaw.load() : gg3sim::detector(); }
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "../gg3_sim.hpp"
+
+enum clock_index { clk_gpout0=0, clk_gpout1, clk_gpout2, clk_gpout3, clk_ref, clk_sys, clk_peri, clk_usb, clk_adc, clk_rtc };
+
+inline uint32_t clock_get_hz(clock_index clk){ return clk == clk_adc ? gg3sim::ADC_HZ : gg3sim::SYS_HZ; }
+inline bool set_sys_clock_khz(uint32_t khz, bool){ return khz * 1'000 == gg3sim::SYS_HZ; }
@@ -0,0 +1,3 @@
+#pragma once
+
+#include "../gg3_sim.hpp"
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "../gg3_sim.hpp"
+
+enum { TIMER_IRQ_0 = 0 };
+
+inline void irq_set_exclusive_handler(uint, void (*)(void)){}
+inline void irq_set_enabled(uint, bool){}
+inline void irq_set_mask_enabled(uint32_t, bool){}
+inline bool irq_is_enabled(uint){ return false; }
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "../../gg3_sim.hpp"
+
+struct armv6m_scb_t{ io_rw_32 cpuid, icsr, vtor, aircr, scr; };
+
+namespace gg3sim {
+    inline thread_local armv6m_scb_t    scb         {};
+}
+
+#define scb_hw (&gg3sim::scb)
+
+enum : uint32_t { M0PLUS_ICSR_PENDSTSET_BITS = 1u << 26, M0PLUS_ICSR_PENDSTCLR_BITS = 1u << 25 };
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "../../gg3_sim.hpp"
+
+struct systick_hw_t{ io_rw_32 csr, rvr, cvr, calib; };
+
+namespace gg3sim {
+    inline systick_hw_t                 systick     {};
+}
+
+#define systick_hw (&gg3sim::systick)
+
+// Timebase reads this instead of the 24 bit counter: already 64 bit processor ticks
+inline uint64_t gg3HostTicks(void){ return gg3sim::nowNs() * ( gg3sim::SYS_HZ / 1'000'000 ) / 1'000; }
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "../../gg3_sim.hpp"
+
+struct vreg_and_chip_reset_hw_t{ io_rw_32 vreg, bod, chip_reset; };
+
+namespace gg3sim {
+    // 1.10V, the reset value
+    inline vreg_and_chip_reset_hw_t     vregAndChipReset { 0x0000'00B1, 0, 0 };
+}
+
+#define vreg_and_chip_reset_hw (&gg3sim::vregAndChipReset)
+
+enum : uint32_t { VREG_AND_CHIP_RESET_VREG_VSEL_BITS = 0x0000'00F0, VREG_AND_CHIP_RESET_VREG_VSEL_LSB = 4 };
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "../gg3_sim.hpp"
+
+typedef std::atomic_flag spin_lock_t;
+
+namespace gg3sim {
+    inline spin_lock_t                  spinLocks[32]  {};
+    inline std::atomic<int>             spinClaimed    { 0 };
+}
+
+inline void __dmb(void){ std::atomic_thread_fence(std::memory_order_seq_cst); }
+inline int  spin_lock_claim_unused(bool){ return gg3sim::spinClaimed++; }
+inline spin_lock_t* spin_lock_instance(uint num){ return &gg3sim::spinLocks[num]; }
+inline uint32_t spin_lock_blocking(spin_lock_t* lock){ while(lock->test_and_set(std::memory_order_acquire)); return 0; }
+inline void spin_unlock(spin_lock_t* lock, uint32_t){ lock->clear(std::memory_order_release); }
+// one thread per core: nothing interrupts a core, masking has no effect
+inline uint32_t save_and_disable_interrupts(void){ return 0; }
+inline void restore_interrupts(uint32_t){}
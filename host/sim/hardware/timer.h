@@ -0,0 +1,21 @@
+#pragma once
+
+#include "../gg3_sim.hpp"
+
+struct timer_hw_t{
+    io_rw_32 timehw, timelw, timehr, timelr;
+    io_rw_32 alarm[4];
+    io_rw_32 armed, timerawh, timerawl, dbgpause, pause, intr, inte, intf, ints;
+};
+
+namespace gg3sim {
+    inline timer_hw_t                   timer       {};
+    inline std::atomic<int>             alarms      { 0 };
+}
+
+// the alarms are never armed on the host: the PC sampler stays silent
+#define timer_hw (&gg3sim::timer)
+
+inline void hw_set_bits(io_rw_32* addr, uint32_t mask){ *addr = *addr | mask; }
+inline void hw_clear_bits(io_rw_32* addr, uint32_t mask){ *addr = *addr & ~mask; }
+inline int  hardware_alarm_claim_unused(bool){ return gg3sim::alarms++; }
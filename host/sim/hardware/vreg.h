@@ -0,0 +1,5 @@
+#pragma once
+
+enum vreg_voltage { VREG_VOLTAGE_1_10 = 11, VREG_VOLTAGE_1_15, VREG_VOLTAGE_1_20 };
+
+inline void vreg_set_voltage(vreg_voltage){}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "../gg3_sim.hpp"
+
+#include <cstdlib>
+
+// host simulation: a reboot ends the process
+inline void watchdog_reboot(uint32_t, uint32_t, uint32_t){ std::exit(1); }
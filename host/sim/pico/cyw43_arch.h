@@ -0,0 +1,32 @@
+#pragma once
+
+#include "../gg3_sim.hpp"
+
+#define CYW43_AUTH_WPA2_MIXED_PSK   0x00400006
+#define CYW43_ITF_STA               0
+#define CYW43_LINK_DOWN             0
+#define CYW43_LINK_JOIN             1
+#define CYW43_LINK_NOIP             2
+#define CYW43_LINK_UP               3
+#define CYW43_LINK_FAIL             (-1)
+#define CYW43_LINK_NONET            (-2)
+#define CYW43_LINK_BADAUTH          (-3)
+#define CYW43_WL_GPIO_VBUS_PIN      2
+
+struct cyw43_t{ int32_t rssi; };
+inline cyw43_t cyw43_state { -55 };
+
+inline int  cyw43_arch_init(void){ return 0; }
+inline void cyw43_arch_deinit(void){}
+inline void cyw43_arch_enable_sta_mode(void){}
+inline int  cyw43_arch_wifi_connect_async(const char*, const char*, uint32_t){ return 0; }
+inline int  cyw43_tcpip_link_status(cyw43_t*, int){ return CYW43_LINK_UP; }
+inline int  cyw43_wifi_get_rssi(cyw43_t* self, int32_t* rssi){ *rssi = self->rssi; return 0; }
+inline bool cyw43_arch_gpio_get(uint){ return true; }
+inline void cyw43_set_pio_clock_divisor(uint16_t, uint8_t){}
+
+inline void cyw43_arch_lwip_begin(void){ gg3sim::lwipLock.lock(); }
+inline void cyw43_arch_lwip_end(void){ gg3sim::lwipLock.unlock(); }
+inline void cyw43_arch_lwip_check(void){}
+inline void cyw43_thread_enter(void){ gg3sim::lwipLock.lock(); }
+inline void cyw43_thread_exit(void){ gg3sim::lwipLock.unlock(); }
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "../gg3_sim.hpp"
+
+inline uint get_core_num(void){ return gg3sim::core; }
+
+inline void multicore_launch_core1(void (*entry)(void)){
+    std::thread([entry](){ gg3sim::core = 1; entry(); }).detach();
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "../gg3_sim.hpp"
+
+struct mutex_t{ std::mutex lock; };
+
+inline void mutex_init(mutex_t*){}
+inline void mutex_enter_blocking(mutex_t* mtx){ mtx->lock.lock(); }
+inline void mutex_exit(mutex_t* mtx){ mtx->lock.unlock(); }
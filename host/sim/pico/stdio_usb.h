@@ -0,0 +1,3 @@
+#pragma once
+
+inline bool stdio_usb_connected(void){ return true; }
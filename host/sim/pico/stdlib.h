@@ -0,0 +1,17 @@
+#pragma once
+
+#include "../gg3_sim.hpp"
+
+typedef uint64_t absolute_time_t;
+
+enum { PICO_OK=0, PICO_ERROR_TIMEOUT=-1 };
+
+inline uint64_t time_us_64(void){ return gg3sim::nowNs() / 1'000; }
+inline uint32_t time_us_32(void){ return static_cast<uint32_t>(time_us_64()); }
+inline absolute_time_t get_absolute_time(void){ return time_us_64(); }
+inline uint64_t to_us_since_boot(absolute_time_t t){ return t; }
+inline void sleep_us(uint64_t us){ std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+inline void sleep_ms(uint32_t ms){ std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+inline bool stdio_init_all(void){ return true; }
+inline void tight_loop_contents(void){}
+inline void busy_wait_at_least_cycles(uint32_t cycles){ for(uint64_t end { gg3sim::nowNs() + cycles * 1'000ULL / ( gg3sim::SYS_HZ / 1'000'000 ) }; gg3sim::nowNs() < end; ); }
@@ -1,39 +1,251 @@
 #!/usr/local/bin/python3
 
+# -----------------------------------------------------------------
+# nuclear rng - generation 3
+# Copyright (C) 2023,2024  Gabriele Bonacini
+#
+# This program is distributed under dual license:
+# - Creative Commons Attribution-NonCommercial 4.0 International (CC BY-NC 4.0) License
+# for non commercial use, the license has the following terms:
+# * Attribution — You must give appropriate credit, provide a link to the license,
+# and indicate if changes were made. You may do so in any reasonable manner,
+# but not in any way that suggests the licensor endorses you or your use.
+# * NonCommercial — You must not use the material for commercial purposes.
+# A copy of the license it's available to the following address:
+# http://creativecommons.org/licenses/by-nc/4.0/
+# - For commercial use a specific license is available contacting the author.
+# -----------------------------------------------------------------
+
+# Protocol checks against an appliance, or gg3_netsim: each case connects on its own and the exit
+# status is 1 when one of them fails. Without cases, the original example: three "req" and "end".
+#
+# Usage:
+#   test.py [--host 192.168.178.28] [--port 6666] [--timeout 10] [case ...|all]
+
+import argparse
+import re
 import socket
+import struct
+import sys
+import time
+
+# protocol v2: header id (u16), type (u8), status (u8), payload length (u32)
+FRAME_END, FRAME_BYTES, FRAME_STATS, FRAME_CONFIG = 0, 1, 3, 4
+STATUS_OK, STATUS_PARTIAL = 0, 1
+
+# "sta" sections in order, with their number of fields
+STA_LAYOUT = [("cpm", 2), ("loop", 4), ("loopns", 2), ("link", 3), ("sched", 9), ("out", 3), ("disc", 8),
+              ("supply", 7), ("stream", 4), ("pool", 2), ("frac", 5), ("rsv", 6), ("iso", 2), ("bits", 6)]
+
+class Appliance:
+    def __init__(self, args, rcvbuf=0):
+        self.sock    = socket.socket()
+        if rcvbuf:
+            # before the connection, so that the window is small from the start
+            self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, rcvbuf)
+        self.sock.settimeout(args.timeout)
+        self.sock.connect((args.host, args.port))
+        self.pending = b""
+        check(self.line() == "ready", "no ready from the appliance")
+
+    def send(self, data):
+        self.sock.sendall(data.encode() if isinstance(data, str) else data)
+
+    def read(self, size):
+        while len(self.pending) < size:
+            data = self.sock.recv(65536)
+            if not data:
+                raise ConnectionError("connection closed by the appliance")
+            self.pending += data
+        data, self.pending = self.pending[:size], self.pending[size:]
+        return data
+
+    def line(self):
+        while b"\n" not in self.pending:
+            data = self.sock.recv(65536)
+            if not data:
+                raise ConnectionError("connection closed by the appliance")
+            self.pending += data
+        data, self.pending = self.pending.split(b"\n", 1)
+        return data.decode()
+
+    def frame(self, ident, kind, payload=b""):
+        self.send(struct.pack("<HBBI", ident, kind, 0, len(payload)) + payload)
+
+    def answer(self):
+        ident, kind, status, size = struct.unpack("<HBBI", self.read(8))
+        return ident, kind, status, self.read(size)
+
+    # "sta" has no newline: it is the last answer before "end", read up to the close
+    def stats(self):
+        self.send("staend")
+        while True:
+            data = self.sock.recv(65536)
+            if not data:
+                break
+            self.pending += data
+        self.sock.close()
+        return self.pending.decode()
+
+    def close(self):
+        self.send("end")
+        self.sock.close()
+
+def check(condition, message):
+    if not condition:
+        raise AssertionError(message)
+
+def sta_fields(line):
+    fields, pos = {}, 0
+    values = line.split(":")
+    for name, count in STA_LAYOUT:
+        check(pos < len(values) and values[pos] == name, "sta: section %s expected at field %d" % (name, pos))
+        fields[name] = [int(value) for value in values[pos + 1:pos + 1 + count]]
+        check(len(fields[name]) == count, "sta: section %s is short" % name)
+        pos += count + 1
+    check(pos == len(values), "sta: %d fields after the last section" % (len(values) - pos))
+    return fields
+
+def case_req(args):
+    appliance = Appliance(args)
+    # Sent 3 requests
+    for _ in range(3):
+        appliance.send("req")
+        print("RNG: " + appliance.line())
+    appliance.close()
 
-def client_program():
-    host = "192.168.178.28"  
-    port = 6666  
+def case_sta(args):
+    fields = sta_fields(Appliance(args).stats())
+    # loop times in microseconds, then in nanoseconds: read later, so the minimum can only be lower
+    loop, loopns = fields["loop"], fields["loopns"]
+    check(loopns[0] // 1000 <= loop[0] and loopns[1] // 1000 >= loop[1],
+          "sta: loop %d:%d us against %d:%d ns" % (loop[0], loop[1], loopns[0], loopns[1]))
+    print("sta: %d sections, loop %d:%d us" % (len(STA_LAYOUT), loop[0], loop[1]))
 
-    client_socket = socket.socket()  
-    client_socket.connect((host, port))  
+def case_burst(args):
+    # a pipelined burst read late through a small window: the appliance must slow down, not disconnect
+    appliance = Appliance(args, rcvbuf=4096)
+    appliance.send("req" * args.burst)
+    time.sleep(1)
+    for number in range(args.burst):
+        line = appliance.line()
+        check(re.fullmatch(r"\d+:\d+:\d+", line), "burst: answer %d is %r" % (number, line))
+    count, peak, stalls = sta_fields(appliance.stats())["out"]
+    print("burst: %d answers, output queue peak %d bytes, %d reading stalls" % (args.burst, peak, stalls))
 
-    i = 0
-    while i < 3:
-        # Sent 3 requests
-        message = "req"
+# "wait" answers are retried while the pool fills, up to the timeout
+def ask(appliance, args, command, prefix):
+    deadline = time.time() + args.timeout
+    while True:
+        appliance.send(command)
+        line = appliance.line()
+        if line != prefix + "wait" or time.time() > deadline:
+            check(line.startswith(prefix) and line != prefix + "wait", "%s answered %r" % (command, line))
+            return line[len(prefix):]
+        time.sleep(0.2)
 
-        client_socket.send(message.encode())  
-        data = client_socket.recv(1024).decode()  
+def stream_block(appliance, args, acked):
+    seq, data = ask(appliance, args, "sbk%012x" % acked, "sbk:").split(":")
+    return int(seq, 16), data
 
-        print('RNG: ' + data)  
-        i=i+1
+def case_resume(args):
+    appliance = Appliance(args)
+    token     = ask(appliance, args, "sop", "sop:")
+    blocks    = dict(stream_block(appliance, args, 0) for _ in range(3))
+    check(sorted(blocks) == [1, 2, 3], "resume: sequences %s" % sorted(blocks))
+    appliance.close()
 
-    data = client_socket.recv(1024).decode()  
+    # a new connection, with block 1 acknowledged: 2 and 3 come again, then new ones
+    appliance = Appliance(args)
+    appliance.send("srs%s%012x" % (token, 1))
+    line = appliance.line()
+    check(line == "srs:%s:%012x" % (token, 1), "resume: srs answered %r" % line)
+    for seq in (2, 3):
+        check(stream_block(appliance, args, 1) == (seq, blocks[seq]), "resume: block %d not replayed" % seq)
+    check(stream_block(appliance, args, 3)[0] == 4, "resume: no new block after the replayed ones")
+    appliance.send("scl" + token)
+    check(appliance.line() == "scl", "resume: session not released")
+    appliance.close()
+    print("resume: session %s, blocks 2 and 3 replayed" % token)
 
-    print('RNG: ' + data)  
+def case_v2(args):
+    appliance = Appliance(args)
+    appliance.send("bv2")
+    check(appliance.line() == "bv2", "v2: not available")
+    appliance.frame(1, FRAME_CONFIG, struct.pack("<BBHI", 0, 0, 0, 0))
+    ident, _, status, payload = appliance.answer()
+    check(ident == 1 and status == STATUS_OK and struct.unpack("<I", payload)[0] == 2, "v2: version not 2")
 
-    # Disconnect client
-    message = "end"
+    # the pool emptied, a request waiting for events must not hold back the stats asked after it
+    for ident in range(2, 100):
+        appliance.frame(ident, FRAME_BYTES, struct.pack("<HH", 1024, 0))
+        answer = appliance.answer()
+        check(answer[0] == ident, "v2: answer %d to request %d" % (answer[0], ident))
+        if answer[2] == STATUS_PARTIAL:
+            break
+    else:
+        raise AssertionError("v2: the pool didn't empty")
+    appliance.frame(100, FRAME_BYTES, struct.pack("<HH", 1024, 1000))
+    appliance.frame(101, FRAME_STATS)
+    first, second = appliance.answer(), appliance.answer()
+    check(first[0] == 101 and first[2] == STATUS_OK and first[3].startswith(b"cpm:"), "v2: stats not answered first")
+    check(second[0] == 100 and second[2] in (STATUS_OK, STATUS_PARTIAL), "v2: waiting bytes not answered")
+    appliance.frame(102, FRAME_END)
+    check(appliance.sock.recv(16) == b"", "v2: end didn't close the connection")
+    appliance.sock.close()
+    print("v2: stats overtook a wait of %d bytes answered later" % len(second[3]))
 
-    client_socket.send(message.encode())  
-    data = client_socket.recv(1024).decode()  
+def case_claim(args):
+    appliance = Appliance(args)
+    token     = ask(appliance, args, "rsv%06x%06x" % (64, 60), "rsv:")
+    # a slow source may not complete it: what was collected so far is claimed
+    deadline  = time.time() + args.timeout
+    while True:
+        appliance.send("rsq" + token)
+        state, collected = appliance.line().split(":")[1:3]
+        if state != "filling" or time.time() > deadline:
+            break
+        time.sleep(0.5)
+    check(state in ("filling", "ready"), "claim: reservation %s" % state)
+    appliance.send("rcl" + token)
+    line = appliance.line()
+    check(line.startswith("rcl:") and line != "rcl:lost", "claim: rcl answered %r" % line)
+    count = int(line[4:])
+    check(int(collected) <= count <= 64, "claim: %d bytes after %s collected" % (count, collected))
+    appliance.read(count)
+    # claimed once only
+    appliance.send("rcl" + token)
+    check(appliance.line() == "rcl:lost", "claim: claimed twice")
+    appliance.send("rsq" + token)
+    check(appliance.line() == "rsq:lost", "claim: still queried after the claim")
+    appliance.close()
+    print("claim: %d of 64 bytes, reservation %s when claimed" % (count, state))
 
-    print('End')  
+CASES = {"req": case_req, "sta": case_sta, "burst": case_burst, "resume": case_resume, "v2": case_v2,
+         "claim": case_claim}
 
-    client_socket.close()  
+def main():
+    parser = argparse.ArgumentParser(description="Protocol checks against a nuclear rng appliance")
+    parser.add_argument("--host", default="192.168.178.28")
+    parser.add_argument("--port", type=int, default=6666)
+    parser.add_argument("--timeout", type=float, default=10.0, help="seconds for each answer")
+    parser.add_argument("--burst", type=int, default=20000, help="requests sent at once by the burst case")
+    parser.add_argument("cases", nargs="*", default=["req"], help="|".join(CASES) + "|all")
+    args = parser.parse_args()
 
+    names = list(CASES) if "all" in args.cases else args.cases
+    for name in names:
+        if name not in CASES:
+            parser.error("unknown case " + name)
+    failed = 0
+    for name in names:
+        try:
+            CASES[name](args)
+            print("%s: ok" % name)
+        except (AssertionError, OSError, ValueError) as ex:
+            failed += 1
+            print("%s: FAILED: %s" % (name, ex))
+    sys.exit(1 if failed else 0)
 
-if __name__ == '__main__':
-    client_program()
+if __name__ == "__main__":
+    main()